@@ -30,6 +30,11 @@
 #include "logging.h"
 #include "stream.h"
 
+Stream* deviceInfo::createStream() const
+{
+    return createPlatformStream();
+}
+
 Context::Context() :
     m_streamCounter(0)
 {
@@ -105,7 +110,7 @@ int32_t Context::getNumFormats(CapDeviceID index) const
         LOG(LOG_ERR,"Internal device pointer is NULL");
         return -1; // device pointer is NULL!
     }
-    return m_devices[index]->m_formats.size();
+    return m_devices[index]->getFormats().size();
 }
 
 
@@ -121,19 +126,140 @@ bool Context::getFormatInfo(CapDeviceID index, CapFormatID formatID, CapFormatIn
         LOG(LOG_ERR,"Internal device pointer is NULL");
         return false; // device pointer is NULL!
     }
-    if (formatID < m_devices[index]->m_formats.size())
+    if (formatID < m_devices[index]->getFormats().size())
     {
-        *info = m_devices[index]->m_formats[formatID];
+        *info = m_devices[index]->getFormats()[formatID];
     }
     else
     {
-        LOG(LOG_ERR,"Invalid format ID (got %d but max ID is %d)\n", formatID, m_devices[index]->m_formats.size());
+        LOG(LOG_ERR,"Invalid format ID (got %d but max ID is %d)\n", formatID, m_devices[index]->getFormats().size());
         return false; // invalid format ID 
     }
     return true;
 }
 
-int32_t Context::openStream(CapDeviceID id, CapFormatID formatID)
+bool Context::chooseFormat(CapDeviceID index, uint32_t width, uint32_t height, uint32_t fps,
+    uint32_t outputFormat, CapFormatChoice &choice) const
+{
+    if (index >= m_devices.size())
+    {
+        LOG(LOG_ERR,"Device with ID %d not found", index);
+        return false; // no such device ID!
+    }
+    if (m_devices[index] == nullptr)
+    {
+        LOG(LOG_ERR,"Internal device pointer is NULL");
+        return false; // device pointer is NULL!
+    }
+
+    const std::vector<CapFormatInfo> &formats = m_devices[index]->getFormats();
+
+    // pick the frame size first: exact, else the smallest
+    // one covering the request, else the largest one.
+    bool     haveSize = false;
+    uint32_t sizeRank = 0;
+    uint64_t sizeArea = 0;
+    uint32_t sizeW = 0;
+    uint32_t sizeH = 0;
+    for(auto const &f : formats)
+    {
+        if (getConversionCost(f.fourcc, outputFormat) < 0.0f)
+        {
+            continue;
+        }
+
+        const uint64_t area = static_cast<uint64_t>(f.width)*f.height;
+        uint32_t rank = 2;
+        if ((f.width == width) && (f.height == height))
+        {
+            rank = 0;
+        }
+        else if ((f.width >= width) && (f.height >= height))
+        {
+            rank = 1;
+        }
+
+        bool better = !haveSize || (rank < sizeRank);
+        if (haveSize && (rank == sizeRank))
+        {
+            better = (rank == 1) ? (area < sizeArea) : (area > sizeArea);
+        }
+        if (better)
+        {
+            haveSize = true;
+            sizeRank = rank;
+            sizeArea = area;
+            sizeW = f.width;
+            sizeH = f.height;
+        }
+    }
+
+    if (!haveSize)
+    {
+        LOG(LOG_ERR,"chooseFormat: device %d has no usable formats\n", index);
+        return false;
+    }
+
+    // without a requested rate, aim for the best the camera does at that size
+    uint32_t targetFps = fps;
+    if (targetFps == 0)
+    {
+        for(auto const &f : formats)
+        {
+            if ((f.width == sizeW) && (f.height == sizeH) && (f.fps > targetFps) &&
+                (getConversionCost(f.fourcc, outputFormat) >= 0.0f))
+            {
+                targetFps = f.fps;
+            }
+        }
+    }
+
+    // then the cheapest format of that size that keeps up
+    bool haveFormat = false;
+    bool bestMeets  = false;
+    for(uint32_t i=0; i<formats.size(); i++)
+    {
+        const CapFormatInfo &f = formats[i];
+        const float cost = getConversionCost(f.fourcc, outputFormat);
+        if ((cost < 0.0f) || (f.width != sizeW) || (f.height != sizeH))
+        {
+            continue;
+        }
+
+        const float frameCostMs = cost * f.width * f.height * 1.0e-6f;
+        uint32_t maxFps = f.fps;
+        if ((frameCostMs > 0.0f) && (1000.0f/frameCostMs < maxFps))
+        {
+            maxFps = static_cast<uint32_t>(1000.0f/frameCostMs);
+        }
+        const bool meets = (maxFps >= targetFps);
+
+        bool better = !haveFormat || (meets && !bestMeets);
+        if (haveFormat && (meets == bestMeets))
+        {
+            better = meets ? (frameCostMs < choice.frameCostMs) : (maxFps > choice.fps);
+        }
+        if (better)
+        {
+            haveFormat = true;
+            bestMeets  = meets;
+            choice.formatID    = i;
+            choice.info        = f;
+            choice.fps         = (targetFps < maxFps) ? targetFps : maxFps;
+            choice.frameCostMs = frameCostMs;
+        }
+    }
+
+    choice.cpuLoad = choice.frameCostMs * choice.fps / 1000.0f;
+
+    LOG(LOG_INFO, "chooseFormat: %dx%d %s at %d fps, %.2f ms/frame, %.0f%% of a core\n",
+        choice.info.width, choice.info.height, fourCCToString(choice.info.fourcc).c_str(),
+        choice.fps, choice.frameCostMs, choice.cpuLoad*100.0f);
+
+    return true;
+}
+
+int32_t Context::openStream(CapDeviceID id, CapFormatID formatID, const CapStreamOptions *options)
 {
     deviceInfo *device = nullptr;
 
@@ -148,20 +274,43 @@ int32_t Context::openStream(CapDeviceID id, CapFormatID formatID)
     }
 
     // lookup desired format
-    if (formatID >= device->m_formats.size())
+    if (formatID >= device->getFormats().size())
     {
         LOG(LOG_ERR, "openStream: Requested format index out of range\n");
         return -1;        
     }
 
-    Stream *s = createPlatformStream();
+    Stream *s = device->createStream();
 
-    if (!s->open(this, device, device->m_formats[formatID].width,
-                 device->m_formats[formatID].height,
-                 device->m_formats[formatID].fourcc,
-                 device->m_formats[formatID].fps))
+    if (options != nullptr)
+    {
+        if (!s->setOutputFormat(options->outputFormat))
+        {
+            LOG(LOG_ERR, "openStream: Output format %d is not supported\n", options->outputFormat);
+            delete s;
+            return -1;
+        }
+        if (!s->setOutputScale(options->scaleDenom))
+        {
+            LOG(LOG_ERR, "openStream: Output scale 1/%d is not supported\n", options->scaleDenom);
+            delete s;
+            return -1;
+        }
+        if (!s->setOutputRegion(options->cropX, options->cropY, options->cropWidth, options->cropHeight,
+            options->outputWidth, options->outputHeight))
+        {
+            LOG(LOG_ERR, "openStream: Output region/size is not supported\n");
+            delete s;
+            return -1;
+        }
+        s->setCaptureFlags(options->flags);
+    }
+
+    const CapFormatInfo &format = device->getFormats()[formatID];
+    if (!s->open(this, device, format.width, format.height, format.fourcc, format.fps))
     {
         LOG(LOG_ERR, "Could not open stream for device %s\n", device->m_name.c_str());
+        delete s;
         return -1;
     }
     else
@@ -250,6 +399,137 @@ bool Context::hasNewFrame(int32_t streamID)
     return stream->hasNewFrame();
 }
 
+bool Context::waitForNewFrame(int32_t streamID, uint32_t timeoutMs)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "waitForNewFrame was called with a negative stream ID\n");
+        return false;
+    }
+
+    Stream *stream = m_streams[streamID];
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "waitForNewFrame was called with an unknown stream ID\n");
+        return false;
+    }
+
+    return stream->waitForNewFrame(timeoutMs);
+}
+
+const uint8_t* Context::lockFrame(int32_t streamID, uint32_t *RGBbufferBytes)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "lockFrame was called with a negative stream ID\n");
+        return nullptr;
+    }
+
+    Stream *stream = m_streams[streamID];
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "lockFrame was called with an unknown stream ID\n");
+        return nullptr;
+    }
+
+    return stream->lockFrame(RGBbufferBytes);
+}
+
+bool Context::releaseFrame(int32_t streamID)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "releaseFrame was called with a negative stream ID\n");
+        return false;
+    }
+
+    Stream *stream = m_streams[streamID];
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "releaseFrame was called with an unknown stream ID\n");
+        return false;
+    }
+
+    stream->releaseFrame();
+    return true;
+}
+
+bool Context::getFrameInfo(int32_t streamID, CapFrameInfo &info)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "getFrameInfo was called with a negative stream ID\n");
+        return false;
+    }
+
+    Stream *stream = m_streams[streamID];
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "getFrameInfo was called with an unknown stream ID\n");
+        return false;
+    }
+
+    stream->getFrameInfo(info);
+    return true;
+}
+
+bool Context::startRecording(int32_t streamID, const char *filename, uint32_t frames)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "startRecording was called with a negative stream ID\n");
+        return false;
+    }
+
+    Stream *stream = m_streams[streamID];
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "startRecording was called with an unknown stream ID\n");
+        return false;
+    }
+
+    return stream->startRecording(filename, frames);
+}
+
+bool Context::stopRecording(int32_t streamID)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "stopRecording was called with a negative stream ID\n");
+        return false;
+    }
+
+    Stream *stream = m_streams[streamID];
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "stopRecording was called with an unknown stream ID\n");
+        return false;
+    }
+
+    stream->stopRecording();
+    return true;
+}
+
+bool Context::getStreamOutputSize(int32_t streamID, uint32_t &width, uint32_t &height)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "getStreamOutputSize was called with a negative stream ID\n");
+        return false;
+    }
+
+    Stream *stream = m_streams[streamID];
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "getStreamOutputSize was called with an unknown stream ID\n");
+        return false;
+    }
+
+    width  = stream->getOutputWidth();
+    height = stream->getOutputHeight();
+    return true;
+}
+
 uint32_t Context::getStreamFrameCount(int32_t streamID)
 {
     if (streamID < 0)
@@ -94,6 +94,20 @@ public:
     /** get the format information from a device. */
     bool getFormatInfo(CapDeviceID index, CapFormatID id, CapFormatInfo *info) const;
 
+    /** choose the cheapest format of a device for a frame size and rate,
+        see Cap_chooseFormat. */
+    bool chooseFormat(CapDeviceID index, uint32_t width, uint32_t height, uint32_t fps,
+        uint32_t outputFormat, CapFormatChoice &choice) const;
+
+    /** Add a virtual device replaying recorded frames, see
+        Cap_addReplayDevice. Returns false if the platform
+        does not support replay devices or 'source' is invalid.
+    */
+    virtual bool addReplayDevice(const char *source)
+    {
+        return false;
+    }
+
     /** Opens a stream to a device with index/ID id and returns the stream ID.
         If an error occurs (device not found), -1 is returned.
 
@@ -103,7 +117,8 @@ public:
         Note: for now, only one stream per device is supported but opening more
               streams might or might not work.
     */
-    int32_t openStream(CapDeviceID id, CapFormatID formatID);
+    int32_t openStream(CapDeviceID id, CapFormatID formatID, 
+        const CapStreamOptions *options = nullptr);
 
     /** close the stream to a device */
     bool closeStream(int32_t streamID);
@@ -117,6 +132,29 @@ public:
     /** returns true if the stream has a new frame, false otherwise */
     bool hasNewFrame(int32_t streamID);
 
+    /** block until the stream has a new frame or the timeout expires.
+        returns true if a new frame is available. */
+    bool waitForNewFrame(int32_t streamID, uint32_t timeoutMs);
+
+    /** borrow the most recent frame of a stream without copying it,
+        returns nullptr on error. See Stream::lockFrame. */
+    const uint8_t* lockFrame(int32_t streamID, uint32_t *RGBbufferBytes);
+
+    /** return a frame borrowed with lockFrame */
+    bool releaseFrame(int32_t streamID);
+
+    /** get the metadata of the frame most recently handed to the application */
+    bool getFrameInfo(int32_t streamID, CapFrameInfo &info);
+
+    /** record the raw frames of a stream into a ring file, see Cap_startRecording */
+    bool startRecording(int32_t streamID, const char *filename, uint32_t frames);
+
+    /** stop a recording started with startRecording */
+    bool stopRecording(int32_t streamID);
+
+    /** get the size of the frames handed to the application */
+    bool getStreamOutputSize(int32_t streamID, uint32_t &width, uint32_t &height);
+
     /** returns the number of frames captured during the lifetime of the stream */
     uint32_t getStreamFrameCount(int32_t streamID);
 
@@ -184,6 +222,17 @@ protected:
     */
     virtual bool enumerateDevices() = 0;
 
+    /** Return the CPU cost of converting a frame with the given
+        fourcc to outputFormat, in nanoseconds per pixel, or a
+        negative value if the stream cannot convert it.
+
+        Platforms without a cost model treat all formats as free.
+    */
+    virtual float getConversionCost(uint32_t fourcc, uint32_t outputFormat) const
+    {
+        return 0.0f;
+    }
+
     /** Store a stream pointer in the m_streams map
         and return its unique ID */
     int32_t storeStream(Stream *stream);
@@ -30,15 +30,46 @@
 #include <vector>
 #include "openpnp-capture.h"
 
+class Stream;   // pre-declaration
+
 /** device information struct/object */
 class deviceInfo
 {
 public:
+    deviceInfo() : m_formatsLoaded(false) {}
     virtual ~deviceInfo() {}
 
+    /** The buffer formats of the device. Platforms that
+        enumerate formats lazily fill them in on first use,
+        see loadFormats.
+    */
+    const std::vector<CapFormatInfo>& getFormats()
+    {
+        if (!m_formatsLoaded)
+        {
+            m_formatsLoaded = true;
+            loadFormats();
+        }
+        return m_formats;
+    }
+
+    /** Create the stream object that captures from this device.
+        Returns createPlatformStream() unless the device needs
+        a stream of its own, e.g. a file replay device.
+    */
+    virtual Stream* createStream() const;
+
     std::string                 m_name;     ///< UTF-8 printable name
     std::string                 m_uniqueID; ///< UTF-8 string uniquely identifying a camera
-    std::vector<CapFormatInfo>  m_formats;  ///< available buffer formats
+    std::vector<CapFormatInfo>  m_formats;  ///< available buffer formats, use getFormats()
+
+protected:
+    /** Fill m_formats. Called once, by the first getFormats().
+        Platforms that enumerate up front leave this empty.
+    */
+    virtual void loadFormats() {}
+
+    bool                        m_formatsLoaded;
 };
 
 #endif
\ No newline at end of file
@@ -67,6 +67,15 @@ DLLPUBLIC uint32_t Cap_getDeviceCount(CapContext ctx)
     return 0;
 }
 
+DLLPUBLIC CapResult Cap_addReplayDevice(CapContext ctx, const char *source)
+{
+    if ((ctx != 0) && (source != NULL))
+    {
+        return reinterpret_cast<Context*>(ctx)->addReplayDevice(source) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC const char* Cap_getDeviceName(CapContext ctx, CapDeviceID id)
 {
     if (ctx != 0)
@@ -106,6 +115,19 @@ DLLPUBLIC CapResult Cap_getFormatInfo(CapContext ctx, CapDeviceID index, CapForm
     return CAPRESULT_ERR;    
 }
 
+DLLPUBLIC CapResult Cap_chooseFormat(CapContext ctx, CapDeviceID index, uint32_t width, uint32_t height,
+    uint32_t fps, CapOutputFormat outputFormat, CapFormatChoice *choice)
+{
+    if ((ctx != 0) && (choice != NULL))
+    {
+        if (reinterpret_cast<Context*>(ctx)->chooseFormat(index, width, height, fps, outputFormat, *choice))
+        {
+            return CAPRESULT_OK;
+        }
+    }
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC void Cap_setLogLevel(uint32_t level)
 {
     setLogLevel(level);
@@ -121,6 +143,16 @@ DLLPUBLIC CapStream Cap_openStream(CapContext ctx, CapDeviceID index, CapFormatI
     return -1;
 }
 
+DLLPUBLIC CapStream Cap_openStreamEx(CapContext ctx, CapDeviceID index, CapFormatID formatID, const CapStreamOptions *options)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->openStream(index, formatID, options);
+    }
+    return -1;
+}
+
 DLLPUBLIC CapResult Cap_closeStream(CapContext ctx, CapStream stream)
 {
     if (ctx != 0)
@@ -161,6 +193,78 @@ DLLPUBLIC uint32_t Cap_hasNewFrame(CapContext ctx, CapStream stream)
     return 0;
 }
 
+DLLPUBLIC uint32_t Cap_waitForNewFrame(CapContext ctx, CapStream stream, uint32_t timeoutMs)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->waitForNewFrame(stream, timeoutMs) ? 1 : 0;
+    }
+    return 0;
+}
+
+DLLPUBLIC CapResult Cap_lockFrame(CapContext ctx, CapStream stream, const void **RGBbufferPtr, uint32_t *RGBbufferBytes)
+{
+    if ((ctx != 0) && (RGBbufferPtr != NULL))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        const uint8_t *frame = c->lockFrame(stream, RGBbufferBytes);
+        *RGBbufferPtr = frame;
+        return (frame != nullptr) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_releaseFrame(CapContext ctx, CapStream stream)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->releaseFrame(stream) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getFrameInfo(CapContext ctx, CapStream stream, CapFrameInfo *info)
+{
+    if ((ctx != 0) && (info != NULL))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getFrameInfo(stream, *info) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_startRecording(CapContext ctx, CapStream stream, const char *filename, uint32_t frames)
+{
+    if ((ctx != 0) && (filename != NULL))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->startRecording(stream, filename, frames) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_stopRecording(CapContext ctx, CapStream stream)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->stopRecording(stream) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getStreamOutputSize(CapContext ctx, CapStream stream, uint32_t *width, uint32_t *height)
+{
+    if ((ctx != 0) && (width != NULL) && (height != NULL))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamOutputSize(stream, *width, *height) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC uint32_t Cap_getStreamFrameCount(CapContext ctx, CapStream stream)
 {
     if (ctx != 0)
@@ -27,6 +27,7 @@
 */
 
 #include <memory.h> // for memcpy
+#include <chrono>
 #include "stream.h"
 #include "context.h"
 
@@ -38,39 +39,210 @@
 Stream::Stream() :
     m_owner(nullptr),
     m_isOpen(false),
+    m_outputFormat(CAPOUTPUT_RGB24),
+    m_scaleDenom(1),
+    m_regionX(0),
+    m_regionY(0),
+    m_regionWidth(0),
+    m_regionHeight(0),
+    m_regionOutWidth(0),
+    m_regionOutHeight(0),
+    m_captureFlags(0),
+    m_backBuffer(0),
+    m_frontBuffer(2),
+    m_latestBuffer(1),
+    m_frameLocked(false),
+    m_waiters(0),
+    m_pickupWaiters(0),
+    m_hasMetadata(false),
+    m_hasSequence(false),
+    m_lastSequence(0),
+    m_droppedFrames(0),
+    m_overwrittenFrames(0),
     m_frames(0)
 {
+    memset(m_frameInfo, 0, sizeof(m_frameInfo));
 }
 
 Stream::~Stream()
 {
-    LOG(LOG_DEBUG,"Stream::~Stream reports %d frames captured.\n", m_frames);
+    LOG(LOG_DEBUG,"Stream::~Stream reports %d frames captured.\n", m_frames.load());
     //Note: close() should be called/handled by the PlatformStream!
 }
 
 bool Stream::hasNewFrame()
 {
-    m_bufferMutex.lock();
-    bool ok = m_newFrame;
-    m_bufferMutex.unlock();
-    return ok;
+    return (m_latestBuffer.load(std::memory_order_acquire) & c_freshFrame) != 0;
+}
+
+bool Stream::waitForNewFrame(uint32_t timeoutMs)
+{
+    if (hasNewFrame()) return true;
+
+    // publishFrame only takes the wait mutex when it sees a waiter,
+    // so register before re-checking the frame flag.
+    m_waiters.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        m_frameSignal.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]()
+        {
+            return !m_isOpen || ((m_latestBuffer.load() & c_freshFrame) != 0);
+        });
+    }
+    m_waiters.fetch_sub(1);
+
+    return m_isOpen && hasNewFrame();
+}
+
+const uint8_t* Stream::lockFrame(uint32_t *RGBbufferBytes)
+{
+    if (!m_isOpen) return nullptr;
+
+    if (!m_frameLocked)
+    {
+        // swap the front buffer for the latest frame, if there is one
+        if ((m_latestBuffer.load(std::memory_order_acquire) & c_freshFrame) != 0)
+        {
+            uint32_t latest = m_latestBuffer.exchange(m_frontBuffer, std::memory_order_acq_rel);
+            m_frontBuffer = latest & c_bufferIndexMask;
+            if (m_pickupWaiters.load() != 0)
+            {
+                notifyPickupWaiters();
+            }
+        }
+        m_frameLocked = true;
+    }
+
+    if (RGBbufferBytes != nullptr)
+    {
+        *RGBbufferBytes = static_cast<uint32_t>(m_frameBuffers[m_frontBuffer].size());
+    }
+    return m_frameBuffers[m_frontBuffer].data();
+}
+
+void Stream::releaseFrame()
+{
+    m_frameLocked = false;
 }
 
 bool Stream::captureFrame(uint8_t *RGBbufferPtr, uint32_t RGBbufferBytes)
 {
-    if (!m_isOpen) return false;
+    uint32_t frameBytes = 0;
+    const uint8_t *frame = lockFrame(&frameBytes);
+    if (frame == nullptr) return false;
 
-    m_bufferMutex.lock();    
-    size_t maxBytes = RGBbufferBytes <= m_frameBuffer.size() ? RGBbufferBytes : m_frameBuffer.size();
+    size_t maxBytes = RGBbufferBytes <= frameBytes ? RGBbufferBytes : frameBytes;
     if (maxBytes != 0)
     {
-        memcpy(RGBbufferPtr, &m_frameBuffer[0], maxBytes);
+        memcpy(RGBbufferPtr, frame, maxBytes);
     }
-    m_newFrame = false;
-    m_bufferMutex.unlock();
+    releaseFrame();
     return true;
 }
 
+void Stream::allocateFrameBuffers(size_t bytes)
+{
+    for(uint32_t i=0; i<3; i++)
+    {
+        m_frameBuffers[i].assign(bytes, 0);
+        if (bytes == 0) m_frameBuffers[i].shrink_to_fit();
+    }
+    m_backBuffer = 0;
+    m_frontBuffer = 2;
+    m_latestBuffer.store(1, std::memory_order_release);
+    m_frameLocked = false;
+
+    memset(m_frameInfo, 0, sizeof(m_frameInfo));
+    m_hasMetadata = false;
+    m_hasSequence = false;
+    m_droppedFrames = 0;
+    m_overwrittenFrames = 0;
+}
+
+void Stream::setFrameMetadata(uint64_t timestampUs, uint32_t sequence)
+{
+    if (m_hasSequence && (sequence > m_lastSequence + 1))
+    {
+        m_droppedFrames += sequence - m_lastSequence - 1;
+    }
+    m_lastSequence = sequence;
+    m_hasSequence = true;
+
+    CapFrameInfo &info = m_frameInfo[m_backBuffer];
+    info.timestampUs = timestampUs;
+    info.sequence = sequence;
+    m_hasMetadata = true;
+}
+
+void Stream::getFrameInfo(CapFrameInfo &info)
+{
+    info = m_frameInfo[m_frontBuffer];
+    info.droppedFrames = m_droppedFrames.load();
+    info.overwrittenFrames = m_overwrittenFrames.load();
+}
+
+void Stream::publishFrame()
+{
+    CapFrameInfo &info = m_frameInfo[m_backBuffer];
+    if (!m_hasMetadata)
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        info.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+        info.sequence = m_frames.load();
+    }
+    info.frameCount = m_frames.load() + 1;
+    m_hasMetadata = false;
+
+    uint32_t latest = m_latestBuffer.exchange(m_backBuffer | c_freshFrame);
+    m_backBuffer = latest & c_bufferIndexMask;
+    m_frames++;
+
+    // the consumer never picked up the frame we just replaced
+    if ((latest & c_freshFrame) != 0)
+    {
+        m_overwrittenFrames++;
+    }
+
+    if (m_waiters.load() != 0)
+    {
+        notifyFrameWaiters();
+    }
+}
+
+bool Stream::waitForPickup(uint32_t timeoutMs, const std::atomic<bool> &quit)
+{
+    if (!hasNewFrame()) return true;
+
+    // same registration order as waitForNewFrame
+    m_pickupWaiters.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        m_pickupSignal.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, &quit]()
+        {
+            return quit.load() || ((m_latestBuffer.load() & c_freshFrame) == 0);
+        });
+    }
+    m_pickupWaiters.fetch_sub(1);
+
+    return !hasNewFrame();
+}
+
+void Stream::notifyPickupWaiters()
+{
+    m_waitMutex.lock();
+    m_waitMutex.unlock();
+    m_pickupSignal.notify_all();
+}
+
+void Stream::notifyFrameWaiters()
+{
+    // taking the mutex orders this with a waiter that is
+    // between its predicate check and going to sleep.
+    m_waitMutex.lock();
+    m_waitMutex.unlock();
+    m_frameSignal.notify_all();
+}
+
 void Stream::submitBuffer(const uint8_t *ptr, size_t bytes)
 {
     // sanity check
@@ -79,11 +251,9 @@ void Stream::submitBuffer(const uint8_t *ptr, size_t bytes)
         return;
     }
     
-    m_bufferMutex.lock();
-    
-    if (m_frameBuffer.size() == 0)
+    if (frameBufferSize() == 0)
     {
-        LOG(LOG_ERR,"Stream::m_frameBuffer size is 0 - cant store frame buffers!\n");
+        LOG(LOG_ERR,"Stream::m_frameBuffers size is 0 - cant store frame buffers!\n");
     }
 
     // Generate warning every 100 frames if the frame buffer is not
@@ -95,11 +265,9 @@ void Stream::submitBuffer(const uint8_t *ptr, size_t bytes)
         LOG(LOG_WARNING, "Warning: captureFrame received incorrect buffer size (got %d want %d)\n", bytes, wantSize);
     }
 
-    if (m_frameBuffer.size() >= bytes)
+    if (frameBufferSize() >= bytes)
     {
-        memcpy(&m_frameBuffer[0], ptr, bytes);
-        m_newFrame = true; 
-        m_frames++;
+        memcpy(backBuffer(), ptr, bytes);
+        publishFrame();
     }
-    m_bufferMutex.unlock();
 }
@@ -29,9 +29,13 @@
 #define stream_h
 
 #include <stdint.h>
+#include <stddef.h>
 #include <vector>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include "logging.h"
+#include "openpnp-capture.h"
 
 class Context;      // pre-declaration
 class deviceInfo;   // pre-declaration
@@ -54,16 +58,152 @@ public:
     /** Close a capture stream */
     virtual void close() {};
 
+    /** Select the layout of the frames handed to the consumer
+        (CAPOUTPUT_xxx). Must be called before open().
+        Returns false if the platform cannot produce it; the
+        base implementation only supports CAPOUTPUT_RGB24.
+    */
+    virtual bool setOutputFormat(uint32_t format)
+    {
+        if (format != CAPOUTPUT_RGB24) return false;
+        m_outputFormat = format;
+        return true;
+    }
+
+    /** Return the layout of the frames handed to the consumer */
+    uint32_t getOutputFormat() const
+    {
+        return m_outputFormat;
+    }
+
+    /** Deliver frames at 1/denom of the capture resolution.
+        Must be called before open(). Returns false if the
+        value is not supported; the base implementation
+        only supports 1. The platform open() may still fail
+        when the capture format cannot be scaled.
+    */
+    virtual bool setOutputScale(uint32_t denom)
+    {
+        if (denom != 1) return false;
+        m_scaleDenom = denom;
+        return true;
+    }
+
+    /** Deliver only the region (x, y, width, height) of the camera
+        frame, resampled to outWidth x outHeight. A zero width/height
+        selects the rest of the frame, a zero output size the region
+        size at 1/scaleDenom. Must be called before open(). Returns
+        false if the platform cannot crop/resample; the base
+        implementation only accepts the whole frame.
+    */
+    virtual bool setOutputRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+        uint32_t outWidth, uint32_t outHeight)
+    {
+        return (x == 0) && (y == 0) && (width == 0) && (height == 0) &&
+            (outWidth == 0) && (outHeight == 0);
+    }
+
+    /** Set CAPSTREAM_xxx flags. Must be called before open().
+        Flags the platform does not implement are ignored.
+    */
+    void setCaptureFlags(uint32_t flags)
+    {
+        m_captureFlags = flags;
+    }
+
+    /** Return the left edge of the delivered region of the camera frame,
+        rounded down to an even pixel so 4:2:x chroma stays aligned */
+    uint32_t getRegionX() const
+    {
+        return ((m_regionX < m_width) ? m_regionX : 0) & ~1u;
+    }
+
+    /** Return the top edge of the delivered region of the camera frame */
+    uint32_t getRegionY() const
+    {
+        return (m_regionY < m_height) ? m_regionY : 0;
+    }
+
+    /** Return the width of the delivered region of the camera frame */
+    uint32_t getRegionWidth() const
+    {
+        const uint32_t maxWidth = m_width - getRegionX();
+        return ((m_regionWidth == 0) || (m_regionWidth > maxWidth)) ? maxWidth : m_regionWidth;
+    }
+
+    /** Return the height of the delivered region of the camera frame */
+    uint32_t getRegionHeight() const
+    {
+        const uint32_t maxHeight = m_height - getRegionY();
+        return ((m_regionHeight == 0) || (m_regionHeight > maxHeight)) ? maxHeight : m_regionHeight;
+    }
+
+    /** Return the width of the frames handed to the consumer */
+    uint32_t getOutputWidth() const
+    {
+        if (m_regionOutWidth != 0) return m_regionOutWidth;
+        return (getRegionWidth() + m_scaleDenom - 1) / m_scaleDenom;
+    }
+
+    /** Return the height of the frames handed to the consumer */
+    uint32_t getOutputHeight() const
+    {
+        if (m_regionOutHeight != 0) return m_regionOutHeight;
+        return (getRegionHeight() + m_scaleDenom - 1) / m_scaleDenom;
+    }
+
+    /** true if the consumer gets the whole camera frame at 1/scaleDenom */
+    bool isFullFrame() const
+    {
+        return (getRegionWidth() == m_width) && (getRegionHeight() == m_height) &&
+            (getOutputWidth() == (m_width + m_scaleDenom - 1) / m_scaleDenom) &&
+            (getOutputHeight() == (m_height + m_scaleDenom - 1) / m_scaleDenom);
+    }
+
+    /** Return the number of bytes per pixel of the output format */
+    uint32_t getOutputBytesPerPixel() const
+    {
+        switch(m_outputFormat)
+        {
+        case CAPOUTPUT_RGBAF32:
+            return 16;
+        case CAPOUTPUT_Y8:
+            return 1;
+        default:
+            return 3;
+        }
+    }
+
     /** Returns true if a new frame is available for reading using 'captureFrame'. 
         The internal new frame flag is reset by captureFrame.
     */
     bool hasNewFrame();
 
+    /** Block until a new frame is available or 'timeoutMs'
+        milliseconds have passed. Returns true if a new frame
+        is available. Returns false on timeout or when the
+        stream is closed while waiting.
+    */
+    bool waitForNewFrame(uint32_t timeoutMs);
+
     /** Retrieve the most recently captured frame and copy it in a
         buffer pointed to by RGBbufferPtr. The maximum buffer size 
         must be supplied in RGBbufferBytes.
     */
     bool captureFrame(uint8_t *RGBbufferPtr, uint32_t RGBbufferBytes);
+
+    /** Borrow the most recently captured frame without copying it.
+        The returned buffer is owned by the consumer until releaseFrame
+        is called; the capture thread never writes to it in the mean time.
+        Calling lockFrame again before releaseFrame returns the same frame.
+
+        Only one consumer thread per stream is supported.
+        Returns nullptr if the stream is not open.
+    */
+    const uint8_t* lockFrame(uint32_t *RGBbufferBytes);
+
+    /** Hand a frame borrowed by lockFrame back to the stream */
+    void releaseFrame();
     
     /** Set the frame rate of this stream.
         Returns false if the camera does not support the desired
@@ -80,14 +220,31 @@ public:
     /** Return the FOURCC media type of the stream */
     virtual uint32_t getFOURCC() = 0;
 
-    /** Return the number of frames captured.
-        FIXME: protect by mutex 
-    */
+    /** Return the number of frames captured. */
     uint32_t getFrameCount() const
     {
-        return m_frames;
+        return m_frames.load();
     }
 
+    /** Metadata of the frame most recently returned by
+        lockFrame/captureFrame, plus the current drop and
+        overwrite totals. Consumer thread only.
+    */
+    void getFrameInfo(CapFrameInfo &info);
+
+    /** Start recording the raw frames, as delivered by the camera
+        and before any conversion, into a ring file holding the
+        most recent 'frames' frames. See Cap_startRecording.
+        Returns false if the platform does not support recording.
+    */
+    virtual bool startRecording(const char *filename, uint32_t frames)
+    {
+        return false;
+    }
+
+    /** Stop recording and close the ring file */
+    virtual void stopRecording() {}
+
     /** get the limits of a camera/stream property (exposure, zoom etc) */
     virtual bool getPropertyLimits(uint32_t propID, int32_t *min, int32_t *max, int32_t *dValue) = 0;
 
@@ -115,16 +272,94 @@ protected:
     */
     virtual void submitBuffer(const uint8_t* ptr, size_t bytes);
 
+    /** Allocate the frame buffers, 'bytes' each. Pass 0 to free them.
+        Must not be called while the capture thread is running.
+    */
+    void allocateFrameBuffers(size_t bytes);
+
+    /** Size of a single frame buffer in bytes */
+    size_t frameBufferSize() const
+    {
+        return m_frameBuffers[0].size();
+    }
+
+    /** The buffer the capture thread writes the next frame into.
+        Only the capture thread may access it.
+    */
+    uint8_t* backBuffer()
+    {
+        return m_frameBuffers[m_backBuffer].data();
+    }
+
+    /** Publish the back buffer as the most recent frame and
+        take over the previously published buffer as the new
+        back buffer. Lock-free; called by the capture thread only.
+    */
+    void publishFrame();
+
+    /** Record the driver timestamp (microseconds, monotonic clock)
+        and sequence number of the frame in the back buffer. Gaps in
+        the sequence numbers are counted as dropped frames.
+        Frames published without metadata get a library timestamp.
+        Called by the capture thread only.
+    */
+    void setFrameMetadata(uint64_t timestampUs, uint32_t sequence);
+
+    /** Wake up all threads blocked in waitForNewFrame,
+        e.g. when the stream is being closed. */
+    void notifyFrameWaiters();
+
+    /** Block the capture thread until the consumer picked up the
+        latest frame with lockFrame, 'quit' is set or 'timeoutMs'
+        milliseconds have passed. Returns true if there is no
+        unread frame left.
+    */
+    bool waitForPickup(uint32_t timeoutMs, const std::atomic<bool> &quit);
+
+    /** Wake up a capture thread blocked in waitForPickup,
+        call it after setting its 'quit' flag. */
+    void notifyPickupWaiters();
+
+    static const uint32_t c_bufferIndexMask = 0x3;  ///< buffer index bits of m_latestBuffer
+    static const uint32_t c_freshFrame      = 0x4;  ///< set in m_latestBuffer until the consumer picks it up
+
     Context*    m_owner;                    ///< The context object associated with this stream
 
     uint32_t    m_width;                    ///< The width of the frame in pixels
     uint32_t    m_height;                   ///< The height of the frame in pixels
     bool        m_isOpen;
+    uint32_t    m_outputFormat;             ///< CAPOUTPUT_xxx layout of the frame buffers
+    uint32_t    m_scaleDenom;               ///< frames are delivered at 1/m_scaleDenom of the capture size
+    uint32_t    m_regionX;                  ///< requested region of the camera frame, see setOutputRegion
+    uint32_t    m_regionY;
+    uint32_t    m_regionWidth;
+    uint32_t    m_regionHeight;
+    uint32_t    m_regionOutWidth;           ///< requested output size, 0 = region size at 1/m_scaleDenom
+    uint32_t    m_regionOutHeight;
+    uint32_t    m_captureFlags;             ///< CAPSTREAM_xxx
+
+    /** Triple buffer: the capture thread owns the back buffer, the consumer
+        owns the front buffer and the latest completed frame sits in between.
+        Ownership changes hands with a single atomic exchange. */
+    std::vector<uint8_t>    m_frameBuffers[3];
+    uint32_t                m_backBuffer;   ///< index of the buffer being written (capture thread)
+    uint32_t                m_frontBuffer;  ///< index of the buffer being read (consumer)
+    std::atomic<uint32_t>   m_latestBuffer; ///< index of the latest frame, plus c_freshFrame
+    bool                    m_frameLocked;  ///< consumer holds the front buffer (consumer only)
+
+    std::mutex              m_waitMutex;    ///< only used to block/wake waitForNewFrame callers
+    std::condition_variable m_frameSignal;  ///< signalled by publishFrame when someone is waiting
+    std::atomic<uint32_t>   m_waiters;      ///< number of threads in waitForNewFrame
+    std::condition_variable m_pickupSignal; ///< signalled by lockFrame when the capture thread waits for it
+    std::atomic<uint32_t>   m_pickupWaiters; ///< number of threads in waitForPickup
 
-    std::mutex  m_bufferMutex;              ///< mutex to protect m_frameBuffer and m_newFrame
-    bool        m_newFrame;                 ///< new frame buffer flag
-    std::vector<uint8_t> m_frameBuffer;     ///< raw frame buffer
-    uint32_t    m_frames;                   ///< number of frames captured
+    CapFrameInfo            m_frameInfo[3]; ///< metadata of each frame buffer, travels with the buffer
+    bool                    m_hasMetadata;  ///< setFrameMetadata was called for the back buffer
+    bool                    m_hasSequence;  ///< m_lastSequence is valid
+    uint32_t                m_lastSequence; ///< driver sequence number of the previous frame
+    std::atomic<uint32_t>   m_droppedFrames;
+    std::atomic<uint32_t>   m_overwrittenFrames;
+    std::atomic<uint32_t> m_frames;         ///< number of frames captured
 };
 
 #endif
\ No newline at end of file
@@ -88,6 +88,40 @@ typedef uint32_t CapFormatID;   ///< format identifier 0 .. numFormats
 
 typedef uint32_t CapPropertyID; ///< property ID (exposure, zoom, focus etc.)
 
+// frame layouts returned by Cap_captureFrame / Cap_lockFrame:
+#define CAPOUTPUT_RGB24         0   ///< 24-bit RGB, 3 bytes per pixel (default)
+#define CAPOUTPUT_RGBAF32       1   ///< 32-bit float RGBA in [0..1], alpha = 1, 16 bytes per pixel
+#define CAPOUTPUT_Y8            2   ///< 8-bit full range luma, 1 byte per pixel; (Linux) read straight from the Y plane / JPEG luma
+
+typedef uint32_t CapOutputFormat; ///< output frame layout, CAPOUTPUT_xxx
+
+// stream flags for CapStreamOptions, platforms ignore the ones they don't implement:
+#define CAPSTREAM_SHAREDTHREAD  0x1 ///< (Linux) capture on a single epoll thread and worker pool shared by all streams
+
+/** Metadata of a captured frame, see Cap_getFrameInfo */
+struct CapFrameInfo
+{
+    uint64_t timestampUs;       ///< capture time in microseconds (monotonic clock), from the driver when available
+    uint32_t sequence;          ///< frame sequence number, from the driver when available
+    uint32_t frameCount;        ///< number of frames delivered by the stream up to and including this one
+    uint32_t droppedFrames;     ///< frames the driver dropped (gaps in the sequence numbers) since the stream was opened
+    uint32_t overwrittenFrames; ///< frames replaced by a newer frame before the application read them
+};
+
+/** Options for Cap_openStreamEx */
+struct CapStreamOptions
+{
+    CapOutputFormat outputFormat;   ///< CAPOUTPUT_xxx layout of the frames
+    uint32_t        scaleDenom;     ///< 1, 2, 4 or 8: deliver frames at 1/scaleDenom of the camera resolution (rounded up)
+    uint32_t        flags;          ///< CAPSTREAM_xxx
+    uint32_t        cropX;          ///< left edge of the region of the camera frame to deliver (rounded down to even)
+    uint32_t        cropY;          ///< top edge of that region
+    uint32_t        cropWidth;      ///< width of the region, 0 = up to the right edge
+    uint32_t        cropHeight;     ///< height of the region, 0 = up to the bottom edge
+    uint32_t        outputWidth;    ///< resample the region to this width, 0 = region width / scaleDenom
+    uint32_t        outputHeight;   ///< resample the region to this height, 0 = region height / scaleDenom
+};
+
 struct CapFormatInfo
 {
     uint32_t width;     ///< width in pixels
@@ -97,6 +131,16 @@ struct CapFormatInfo
     uint32_t bpp;       ///< bits per pixel
 };
 
+/** The format picked by Cap_chooseFormat and what it is expected to cost */
+struct CapFormatChoice
+{
+    CapFormatID   formatID;     ///< index of the chosen format
+    CapFormatInfo info;         ///< the chosen format
+    uint32_t      fps;          ///< expected frame rate, limited by the camera and the conversion cost
+    float         frameCostMs;  ///< expected CPU time to convert one frame, in milliseconds
+    float         cpuLoad;      ///< expected fraction of one CPU core spent converting at 'fps'
+};
+
 #define CAPRESULT_OK  0
 #define CAPRESULT_ERR 1
 #define CAPRESULT_DEVICENOTFOUND 2
@@ -108,6 +152,23 @@ struct CapFormatInfo
 **********************************************************************************/
 
 /** Initialize the capture library
+
+    On Linux, recorded frames can be listed as extra (virtual)
+    devices for testing and benchmarking without cameras, with the
+    OPENPNP_CAPTURE_REPLAY environment variable:
+
+        path,width,height,fourcc,fps[;path,width,height,fourcc,fps...]
+
+    'path' is a directory with one frame per file or a raw dump of
+    concatenated frames (RGB3, YUYV, NV12, YU12, YV12 or MJPG), e.g.
+    OPENPNP_CAPTURE_REPLAY=/data/frames,640,480,MJPG,30
+    An fps of 0 replays as fast as frames can be converted.
+
+    Ring files written by Cap_startRecording describe their own format,
+    so the path alone is enough. They replay at an fps of 0, which for
+    ring files means as fast as the application reads the frames:
+    every recorded frame is delivered exactly once per loop.
+
     @return The context ID.
 */
 DLLPUBLIC CapContext Cap_createContext(void);
@@ -118,6 +179,17 @@ DLLPUBLIC CapContext Cap_createContext(void);
 */
 DLLPUBLIC CapResult Cap_releaseContext(CapContext ctx);
 
+/** Add a virtual device replaying recorded frames to a context (Linux only).
+    'source' uses the syntax of one OPENPNP_CAPTURE_REPLAY entry, see
+    Cap_createContext. The device is appended to the device list and its
+    unique ID is "replay:" followed by the path.
+
+    @param ctx The ID of the context.
+    @param source path[,width,height,fourcc,fps] of the recording.
+    @return CAPRESULT_OK if the device was added.
+*/
+DLLPUBLIC CapResult Cap_addReplayDevice(CapContext ctx, const char *source);
+
 /** Get the number of capture devices on the system.
     note: this can change dynamically due to the
     pluggin and unplugging of USB devices.
@@ -179,6 +251,32 @@ DLLPUBLIC int32_t Cap_getNumFormats(CapContext ctx, CapDeviceID index);
 */
 DLLPUBLIC CapResult Cap_getFormatInfo(CapContext ctx, CapDeviceID index, CapFormatID id, CapFormatInfo *info); 
 
+/** Choose the format of a device that delivers a given frame size and
+    rate at the lowest CPU cost.
+
+    The exact size is used when the device offers it, otherwise the
+    smallest larger size, otherwise the largest size available. Among
+    the formats of that size, the cheapest one that can sustain the
+    requested frame rate wins; if none can, the one with the highest
+    achievable rate.
+
+    Conversion costs come from a micro-benchmark of the platform's
+    converters (RGB24, YUYV, NV12, YUV420 and MJPEG on Linux) that runs
+    once per process, on first use. Platforms without a cost model
+    report a cost of 0 and choose on size and frame rate alone.
+
+    @param ctx The ID of the context.
+    @param index The device index of the capture device.
+    @param width The desired frame width.
+    @param height The desired frame height.
+    @param fps The desired frame rate, 0 for the highest rate offered at the chosen size.
+    @param outputFormat The CAPOUTPUT_xxx format the stream will be opened with.
+    @param choice pointer to a CapFormatChoice structure to be filled with data.
+    @return The CapResult.
+*/
+DLLPUBLIC CapResult Cap_chooseFormat(CapContext ctx, CapDeviceID index, uint32_t width, uint32_t height,
+    uint32_t fps, CapOutputFormat outputFormat, CapFormatChoice *choice);
+
 
 /********************************************************************************** 
      STREAM MANAGEMENT
@@ -196,6 +294,32 @@ DLLPUBLIC CapResult Cap_getFormatInfo(CapContext ctx, CapDeviceID index, CapForm
 */
 DLLPUBLIC CapStream Cap_openStream(CapContext ctx, CapDeviceID index, CapFormatID formatID);
 
+/** Open a capture stream like Cap_openStream, but with a different
+    layout and/or size for the frames handed to the application.
+
+    Converting to the output layout happens in the capture thread, in
+    the same pass that decodes the camera format, so e.g. YUYV frames
+    are turned into float RGBA without an intermediate RGB frame.
+
+    The frames can be cropped to a region of the camera frame and
+    scaled down by an integer (scaleDenom) or fractional factor
+    (outputWidth/outputHeight), with nearest-pixel sampling. This too
+    happens in the conversion pass: only the pixels that end up in
+    the output are converted, and MJPEG frames are decoded at a
+    reduced size in the DCT domain with the rows and columns outside
+    the region skipped. Fields not set in a shorter initializer are
+    zero, which selects the whole frame. Cropping and resampling are
+    currently only supported on Linux.
+
+    @param ctx The ID of the context.
+    @param index The device index of the capture device.
+    @param formatID The index/ID of the frame buffer format (0 .. number returned by Cap_getNumFormats() minus 1 ).
+    @param options The output options, NULL for the defaults of Cap_openStream.
+    @return The stream ID or -1 if the device does not exist, the stream format ID is incorrect
+            or the options are not supported for this format/platform.
+*/
+DLLPUBLIC CapStream Cap_openStreamEx(CapContext ctx, CapDeviceID index, CapFormatID formatID, const CapStreamOptions *options);
+
 /** Close a capture stream 
     @param ctx The ID of the context.
     @param stream The stream ID.
@@ -214,14 +338,96 @@ DLLPUBLIC uint32_t Cap_isOpenStream(CapContext ctx, CapStream stream);
      FRAME CAPTURING / INFO
 **********************************************************************************/
 
-/** this function copies the most recent RGB frame data
-    to the given buffer.
+/** this function copies the most recent frame data
+    to the given buffer. The frame layout is the stream's
+    CapStreamOptions::outputFormat (24-bit RGB for streams
+    opened with Cap_openStream) and its size is given by
+    Cap_getStreamOutputSize.
 */
 DLLPUBLIC CapResult Cap_captureFrame(CapContext ctx, CapStream stream, void *RGBbufferPtr, uint32_t RGBbufferBytes);
 
 /** returns 1 if a new frame has been captured, 0 otherwise */
 DLLPUBLIC uint32_t Cap_hasNewFrame(CapContext ctx, CapStream stream);
 
+/** Block until a new frame has been captured or the timeout expires.
+    The capture thread signals waiting threads as soon as a frame is
+    published, so a consumer wakes up within one frame interval
+    instead of polling Cap_hasNewFrame.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param timeoutMs The maximum time to wait in milliseconds.
+    @return 1 if a new frame is available, 0 on timeout or error.
+*/
+DLLPUBLIC uint32_t Cap_waitForNewFrame(CapContext ctx, CapStream stream, uint32_t timeoutMs);
+
+/** Borrow the most recent frame without copying it.
+
+    The stream keeps its frames in a triple buffer; the borrowed
+    buffer is not touched by the capture thread until it is handed
+    back with Cap_releaseFrame. Calling Cap_lockFrame again before
+    releasing returns the same frame. Only one thread per stream
+    should borrow frames.
+
+    The frame is laid out as requested with CapStreamOptions::outputFormat
+    (CAPOUTPUT_xxx, 24-bit RGB for streams opened with Cap_openStream),
+    tightly packed rows of the width and height returned by
+    Cap_getStreamOutputSize.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param RGBbufferPtr receives a pointer to the frame, in the stream's output format.
+    @param RGBbufferBytes receives the size of the frame in bytes.
+    @return CAPRESULT_OK if a frame was borrowed.
+*/
+DLLPUBLIC CapResult Cap_lockFrame(CapContext ctx, CapStream stream, const void **RGBbufferPtr, uint32_t *RGBbufferBytes);
+
+/** Hand a frame borrowed with Cap_lockFrame back to the stream */
+DLLPUBLIC CapResult Cap_releaseFrame(CapContext ctx, CapStream stream);
+
+/** get the metadata of the frame most recently returned by Cap_captureFrame
+    or Cap_lockFrame. The drop and overwrite counters are the current totals
+    of the stream.
+
+    On Linux the timestamp and sequence number come from V4L2 and the
+    timestamp uses CLOCK_MONOTONIC (the same clock as std::chrono::steady_clock),
+    so the latency of a frame is now - timestampUs. On other platforms
+    the timestamp is taken when the frame arrives in the library.
+
+    @return CAPRESULT_OK if info was written.
+*/
+DLLPUBLIC CapResult Cap_getFrameInfo(CapContext ctx, CapStream stream, CapFrameInfo *info);
+
+/** start recording the raw frames of a stream, exactly as the camera delivers
+    them and before any conversion, into a ring file (Linux only).
+
+    The file is preallocated and memory mapped when recording starts, so
+    recording costs a copy per frame on the capture thread and nothing else.
+    When 'frames' frames have been recorded the oldest ones are overwritten,
+    so the file always holds the most recent burst. Together with the frame
+    data, the timestamp and sequence number of every frame are stored.
+
+    Ring files can be replayed with Cap_addReplayDevice.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param filename the ring file to create; an existing file is overwritten.
+    @param frames the number of frames the ring holds.
+    @return CAPRESULT_OK if recording has started.
+*/
+DLLPUBLIC CapResult Cap_startRecording(CapContext ctx, CapStream stream, const char *filename, uint32_t frames);
+
+/** stop a recording started with Cap_startRecording and close the ring file.
+    Closing a stream also stops its recording.
+    @return CAPRESULT_OK if the stream exists.
+*/
+DLLPUBLIC CapResult Cap_stopRecording(CapContext ctx, CapStream stream);
+
+/** get the size of the frames returned by Cap_captureFrame / Cap_lockFrame,
+    which differs from the capture format when the stream was opened with
+    a scaleDenom, crop region or output size. */
+DLLPUBLIC CapResult Cap_getStreamOutputSize(CapContext ctx, CapStream stream, uint32_t *width, uint32_t *height);
+
 /** returns the number of frames captured during the lifetime of the stream. 
     For debugging purposes */
 DLLPUBLIC uint32_t Cap_getStreamFrameCount(CapContext ctx, CapStream stream);
@@ -0,0 +1,345 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Shared epoll capture loop
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "capturereactor.h"
+#include "platformstream.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+int xioctl(int fh, int request, void *arg);
+
+CaptureReactor& CaptureReactor::instance()
+{
+    static CaptureReactor reactor;
+    return reactor;
+}
+
+CaptureReactor::CaptureReactor() :
+    m_nextID(1),
+    m_quit(false),
+    m_epoll(-1),
+    m_wakeup(-1)
+{
+}
+
+CaptureReactor::~CaptureReactor()
+{
+    stop();
+}
+
+bool CaptureReactor::addStream(PlatformStream *stream, int fd, uint32_t nBuffers)
+{
+    std::lock_guard<std::mutex> lifecycle(m_lifecycle);
+
+    std::unique_ptr<Source> src(new Source());
+    src->stream     = stream;
+    src->helper.reset(new PlatformStreamHelper(fd));
+    src->busy       = false;
+    src->hasPending = false;
+
+    if (!src->helper->createAndMapBuffers(nBuffers) ||
+        !src->helper->queueAllBuffers() ||
+        !src->helper->streamOn())
+    {
+        return false;
+    }
+
+    if (m_epoll < 0)
+    {
+        if (!start())
+        {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t id = m_nextID++;
+
+    epoll_event ev;
+    CLEAR(ev);
+    ev.events   = EPOLLIN;
+    ev.data.u64 = id;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        LOG(LOG_ERR, "CaptureReactor: epoll_ctl failed (errno=%d)\n", errno);
+        return false;
+    }
+
+    m_sources[id] = std::move(src);
+    LOG(LOG_DEBUG, "CaptureReactor: servicing %d streams\n", m_sources.size());
+    return true;
+}
+
+void CaptureReactor::removeStream(PlatformStream *stream)
+{
+    std::lock_guard<std::mutex> lifecycle(m_lifecycle);
+
+    std::unique_ptr<Source> src;
+    bool last = false;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto iter = m_sources.begin();
+        while((iter != m_sources.end()) && (iter->second->stream != stream))
+        {
+            iter++;
+        }
+        if (iter == m_sources.end())
+        {
+            return;
+        }
+
+        Source *s = iter->second.get();
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, s->helper->m_fd, nullptr);
+        s->hasPending = false;
+        m_idleSignal.wait(lock, [s]() { return !s->busy; });
+
+        src = std::move(iter->second);
+        m_sources.erase(iter);
+        last = m_sources.empty();
+    }
+
+    // turns streaming off and unmaps the buffers
+    src.reset();
+
+    if (last)
+    {
+        stop();
+    }
+}
+
+bool CaptureReactor::start()
+{
+    m_epoll  = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((m_epoll < 0) || (m_wakeup < 0))
+    {
+        LOG(LOG_ERR, "CaptureReactor: could not create epoll/eventfd (errno=%d)\n", errno);
+        stop();
+        return false;
+    }
+
+    epoll_event ev;
+    CLEAR(ev);
+    ev.events   = EPOLLIN;
+    ev.data.u64 = 0;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+
+    m_quit = false;
+    m_reactor = std::thread(&CaptureReactor::reactorFunction, this);
+
+    // conversion is the expensive part; a few workers is plenty
+    uint32_t nWorkers = std::thread::hardware_concurrency() / 2;
+    nWorkers = (nWorkers < 1) ? 1 : ((nWorkers > 4) ? 4 : nWorkers);
+    for(uint32_t i=0; i<nWorkers; i++)
+    {
+        m_workers.push_back(std::thread(&CaptureReactor::workerFunction, this));
+    }
+
+    LOG(LOG_DEBUG, "CaptureReactor started with %d workers\n", nWorkers);
+    return true;
+}
+
+void CaptureReactor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_jobSignal.notify_all();
+
+    if (m_wakeup >= 0)
+    {
+        uint64_t one = 1;
+        if (::write(m_wakeup, &one, sizeof(one)) != sizeof(one))
+        {
+            LOG(LOG_ERR, "CaptureReactor: could not wake the reactor thread\n");
+        }
+    }
+
+    if (m_reactor.joinable())
+    {
+        m_reactor.join();
+    }
+    for(auto &worker : m_workers)
+    {
+        worker.join();
+    }
+    m_workers.clear();
+    m_jobs.clear();
+
+    if (m_epoll >= 0)
+    {
+        ::close(m_epoll);
+        m_epoll = -1;
+    }
+    if (m_wakeup >= 0)
+    {
+        ::close(m_wakeup);
+        m_wakeup = -1;
+    }
+    LOG(LOG_DEBUG, "CaptureReactor stopped\n");
+}
+
+void CaptureReactor::reactorFunction()
+{
+    const int maxEvents = 16;
+    epoll_event events[maxEvents];
+
+    while(true)
+    {
+        int n = epoll_wait(m_epoll, events, maxEvents, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(LOG_ERR, "CaptureReactor: epoll_wait failed (errno=%d)\n", errno);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_quit)
+        {
+            return;
+        }
+
+        for(int i=0; i<n; i++)
+        {
+            // the source may have been removed after epoll_wait returned
+            auto iter = m_sources.find(events[i].data.u64);
+            if (iter == m_sources.end())
+            {
+                continue;
+            }
+
+            Source &src = *iter->second;
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0)
+            {
+                // device unplugged or stream stopped, don't spin on it
+                LOG(LOG_ERR, "CaptureReactor: device error, no longer servicing it\n");
+                epoll_ctl(m_epoll, EPOLL_CTL_DEL, src.helper->m_fd, nullptr);
+                continue;
+            }
+            readSource(iter->first, src);
+        }
+    }
+}
+
+void CaptureReactor::readSource(uint64_t id, Source &src)
+{
+    while(true)
+    {
+        v4l2_buffer buf;
+        CLEAR(buf);
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+
+        if (xioctl(src.helper->m_fd, VIDIOC_DQBUF, &buf) == -1)
+        {
+            if (errno != EAGAIN)
+            {
+                LOG(LOG_ERR, "CaptureReactor: VIDIOC_DQBUF error (errno=%d), no longer servicing device\n", errno);
+                epoll_ctl(m_epoll, EPOLL_CTL_DEL, src.helper->m_fd, nullptr);
+            }
+            return;
+        }
+
+        if (!src.busy)
+        {
+            src.busy = true;
+            Job job;
+            job.id  = id;
+            job.buf = buf;
+            m_jobs.push_back(job);
+            m_jobSignal.notify_one();
+        }
+        else
+        {
+            // only the newest frame waits for the worker
+            if (src.hasPending)
+            {
+                requeue(src, src.pending);
+            }
+            src.pending    = buf;
+            src.hasPending = true;
+        }
+    }
+}
+
+void CaptureReactor::workerFunction()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+        m_jobSignal.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+        if (m_quit)
+        {
+            return;
+        }
+
+        Job job = m_jobs.front();
+        m_jobs.pop_front();
+
+        // busy sources are never erased, see removeStream
+        Source &src = *m_sources[job.id];
+        while(true)
+        {
+            lock.unlock();
+            src.stream->threadSubmitBuffer(src.helper->getBufferPointer(job.buf.index),
+                job.buf.bytesused, &job.buf);
+            requeue(src, job.buf);
+            lock.lock();
+
+            if (!src.hasPending || m_quit)
+            {
+                break;
+            }
+            job.buf = src.pending;
+            src.hasPending = false;
+        }
+
+        src.busy = false;
+        m_idleSignal.notify_all();
+    }
+}
+
+void CaptureReactor::requeue(Source &src, v4l2_buffer &buf)
+{
+    if (xioctl(src.helper->m_fd, VIDIOC_QBUF, &buf) == -1)
+    {
+        LOG(LOG_ERR, "CaptureReactor: VIDIOC_QBUF error (errno=%d)\n", errno);
+    }
+}
@@ -0,0 +1,123 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Shared epoll capture loop
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#ifndef linux_capturereactor_h
+#define linux_capturereactor_h
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <linux/videodev2.h>
+
+class PlatformStream;
+class PlatformStreamHelper;
+
+/** Services the V4L2 devices of all streams opened with
+    CAPSTREAM_SHAREDTHREAD from a single epoll thread.
+
+    The reactor thread dequeues buffers as soon as a device has
+    one ready and hands them to a small pool of worker threads
+    for conversion. A stream has at most one frame being converted;
+    when a newer frame arrives in the mean time it replaces the
+    waiting one, which goes straight back to the driver. That keeps
+    a slow consumer from starving the device of buffers.
+
+    The threads are started with the first stream and stopped
+    when the last one is removed, so the thread count does not
+    depend on the number of cameras.
+*/
+class CaptureReactor
+{
+public:
+    static CaptureReactor& instance();
+
+    /** Map and queue the buffers of an open device, turn
+        streaming on and start servicing it.
+        Returns false if the device could not be set up.
+    */
+    bool addStream(PlatformStream *stream, int fd, uint32_t nBuffers);
+
+    /** Stop servicing a stream and release its buffers. Blocks until
+        a conversion in progress has finished; the stream is not
+        called anymore when this returns.
+    */
+    void removeStream(PlatformStream *stream);
+
+private:
+    CaptureReactor();
+    ~CaptureReactor();
+
+    struct Source
+    {
+        PlatformStream  *stream;
+        std::unique_ptr<PlatformStreamHelper> helper;
+        bool            busy;       ///< a worker owns this source
+        bool            hasPending; ///< 'pending' holds a newer frame for the worker
+        v4l2_buffer     pending;
+    };
+
+    struct Job
+    {
+        uint64_t    id;
+        v4l2_buffer buf;
+    };
+
+    bool start();
+    void stop();
+
+    void reactorFunction();
+    void workerFunction();
+
+    /** dequeue all ready buffers of a source, m_mutex must be held */
+    void readSource(uint64_t id, Source &src);
+
+    /** give a buffer back to the driver */
+    static void requeue(Source &src, v4l2_buffer &buf);
+
+    std::mutex              m_lifecycle;    ///< serializes addStream/removeStream
+    std::mutex              m_mutex;        ///< protects everything below
+    std::condition_variable m_jobSignal;    ///< wakes workers
+    std::condition_variable m_idleSignal;   ///< signalled when a source stops being busy
+    std::deque<Job>         m_jobs;
+    std::map<uint64_t, std::unique_ptr<Source> > m_sources;    ///< by epoll id, 0 is the wake-up eventfd
+    uint64_t                m_nextID;
+    bool                    m_quit;
+
+    int                     m_epoll;
+    int                     m_wakeup;       ///< eventfd used to stop the reactor thread
+    std::thread             m_reactor;
+    std::vector<std::thread> m_workers;
+};
+
+#endif
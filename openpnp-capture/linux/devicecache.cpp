@@ -0,0 +1,238 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Cached V4L2 device enumeration
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <linux/videodev2.h>
+
+#include "devicecache.h"
+#include "platformdeviceinfo.h"
+#include "../common/logging.h"
+#include "../common/context.h"
+
+void platformDeviceInfo::loadFormats()
+{
+    m_formats = V4L2DeviceCache::instance().getFormats(m_devicePath, m_busInfo);
+}
+
+V4L2DeviceCache& V4L2DeviceCache::instance()
+{
+    static V4L2DeviceCache *cache = new V4L2DeviceCache();
+    return *cache;
+}
+
+bool V4L2DeviceCache::query(const std::string &path, Device &device)
+{
+    struct stat st;
+    if ((stat(path.c_str(), &st) != 0) || !S_ISCHR(st.st_mode))
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.erase(path);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(path);
+        if ((it != m_entries.end()) && (it->second.rdev == st.st_rdev) && (it->second.ctime == st.st_ctime))
+        {
+            device = it->second.device;
+            return it->second.isCapture;
+        }
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR /* required */ | O_NONBLOCK);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    // nodes that fail QUERYCAP are remembered as non-capture devices too
+    v4l2_capability video_cap;
+    memset(&video_cap, 0, sizeof(video_cap));
+    if (ioctl(fd, VIDIOC_QUERYCAP, &video_cap) == -1)
+    {
+        LOG(LOG_ERR, "enumerateDevices: Can't get capabilities\n");
+    }
+    ::close(fd);
+
+    Entry entry;
+    entry.rdev           = st.st_rdev;
+    entry.ctime          = st.st_ctime;
+    entry.isCapture      = (video_cap.device_caps & V4L2_CAP_VIDEO_CAPTURE) != 0;
+    entry.device.name    = std::string((const char*)video_cap.card);
+    entry.device.busInfo = std::string((const char*)video_cap.bus_info);
+    entry.formats        = std::make_shared<FormatList>();
+
+    if (entry.isCapture)
+    {
+        LOG(LOG_INFO,"Name: '%s'\n", video_cap.card);
+        LOG(LOG_INFO,"Path: '%s'\n", path.c_str());
+        LOG(LOG_INFO,"Bus : '%s'\n", video_cap.bus_info);
+        LOG(LOG_INFO,"capflags = %08X\n", video_cap.capabilities);
+        LOG(LOG_INFO,"devflags = %08X\n", video_cap.device_caps);
+        LOG(LOG_INFO,"read/write %ssupported\n", ((video_cap.device_caps & V4L2_CAP_READWRITE) != 0) ? "" : "NOT ");
+        LOG(LOG_INFO,"streaming I/O %ssupported\n", ((video_cap.device_caps & V4L2_CAP_STREAMING) != 0) ? "" : "NOT ");
+        LOG(LOG_INFO,"async I/O %ssupported\n", ((video_cap.device_caps & V4L2_CAP_ASYNCIO) != 0) ? "" : "NOT ");
+    }
+
+    device = entry.device;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[path] = entry;
+    return entry.isCapture;
+}
+
+std::vector<CapFormatInfo> V4L2DeviceCache::getFormats(const std::string &path, const std::string &busInfo)
+{
+    std::shared_ptr<FormatList> list;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(path);
+        if ((it == m_entries.end()) || (it->second.device.busInfo != busInfo))
+        {
+            LOG(LOG_ERR, "getFormats: %s is not the device at %s\n", busInfo.c_str(), path.c_str());
+            return std::vector<CapFormatInfo>();
+        }
+        list = it->second.formats;
+    }
+
+    // enumerating under the device's own lock makes a second caller
+    // wait for the first one instead of enumerating again
+    std::lock_guard<std::mutex> lock(list->mutex);
+    if (!list->enumerated)
+    {
+        int fd = ::open(path.c_str(), O_RDWR /* required */ | O_NONBLOCK);
+        if (fd == -1)
+        {
+            LOG(LOG_ERR, "getFormats: Can't open device %s\n", path.c_str());
+            return std::vector<CapFormatInfo>();
+        }
+        enumerateFormats(fd, list->formats);
+        ::close(fd);
+        list->enumerated = true;
+    }
+    return list->formats;
+}
+
+void V4L2DeviceCache::enumerateFormats(int fd, std::vector<CapFormatInfo> &formats)
+{
+    formats.clear();
+
+    // enumerate the frame formats
+    v4l2_fmtdesc fmtdesc;
+    uint32_t index = 0;
+    fmtdesc.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    bool tryMore = true;
+    while(tryMore)
+    {
+        fmtdesc.index = index;
+    
+        if (ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == -1)
+        {
+            tryMore = false;
+        }
+        else
+        {
+            LOG(LOG_INFO, "Format %d\n", index);
+            LOG(LOG_INFO, "  FOURCC = %s\n", fourCCToString(fmtdesc.pixelformat).c_str());
+
+            // .. then we enumerate all the frame buffer sizes for that
+            // pixel format type.
+            uint32_t frmindex = 0;
+            CapFormatInfo cinfo;
+            cinfo.fourcc = fmtdesc.pixelformat;
+            cinfo.bpp = 0;
+            while(queryFrameSize(fd, frmindex, fmtdesc.pixelformat, &cinfo.width, &cinfo.height))
+            {
+                frmindex++;
+                cinfo.fps = findMaxFrameRate(fd, fmtdesc.pixelformat, cinfo.width, cinfo.height);
+                formats.push_back(cinfo);
+                LOG(LOG_INFO, "  %d x %d\n", cinfo.width, cinfo.height);
+            }
+        }
+        index++;
+    }
+}
+
+bool V4L2DeviceCache::queryFrameSize(int fd, uint32_t index, uint32_t pixelformat, uint32_t *width, uint32_t *height)
+{
+    v4l2_frmsizeenum frmSize;
+    frmSize.index = index;
+    frmSize.pixel_format = pixelformat;
+    if (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmSize) != -1)
+    {
+        if (frmSize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+            *width  = frmSize.discrete.width;
+            *height = frmSize.discrete.height;
+        }
+        else
+        {
+            LOG(LOG_WARNING, "queryFrameSize returned non-discrete frame size!\n");
+            *width = 0;
+            *height = 0;
+        }
+
+        return true;
+    }
+    return false;
+}
+
+uint32_t V4L2DeviceCache::findMaxFrameRate(int fd, uint32_t pixelformat, 
+    uint32_t width, uint32_t height)
+{
+    uint32_t fps = 0;
+
+    // now search the frame rates
+    v4l2_frmivalenum ivals;
+    ivals.pixel_format = pixelformat;
+    ivals.width = width;
+    ivals.height = height;
+    ivals.index = 0;
+    while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ivals) != -1)
+    {
+        if (ivals.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+        {
+            LOG(LOG_INFO,"  FPS %d/%d", ivals.discrete.denominator, ivals.discrete.numerator);
+            uint32_t v = ivals.discrete.denominator/ivals.discrete.numerator;
+            if (fps < v)
+            {
+                fps = v;
+            }
+        }
+        ivals.index++;
+    }
+
+    return fps;
+}
@@ -0,0 +1,112 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Cached V4L2 device enumeration
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#ifndef linux_devicecache_h
+#define linux_devicecache_h
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "openpnp-capture.h"
+
+/** Process-wide cache of what the V4L2 devices report, shared
+    by all contexts.
+
+    Walking VIDIOC_ENUM_FMT, VIDIOC_ENUM_FRAMESIZES and
+    VIDIOC_ENUM_FRAMEINTERVALS of a camera with many modes takes
+    hundreds of milliseconds, so the format list of a device is only
+    enumerated when it is first asked for and then kept. Entries are
+    keyed by device path and bus info and are dropped when the device
+    node is re-created (a different camera plugged in), which is
+    detected by comparing the stat() results.
+
+    Each device enumerates under a lock of its own, so a slow camera
+    only holds up the callers asking for that camera's formats.
+
+    The cache is never destroyed, so enumerations still running on
+    other threads at exit are safe.
+*/
+class V4L2DeviceCache
+{
+public:
+    static V4L2DeviceCache& instance();
+
+    struct Device
+    {
+        std::string name;       ///< card name
+        std::string busInfo;    ///< bus location, tells identical cameras apart
+    };
+
+    /** Get the name and bus info of the capture device at 'path'.
+        Only opens the device when it is not cached or has changed.
+        Returns false if there is no capture device at 'path'.
+    */
+    bool query(const std::string &path, Device &device);
+
+    /** Get the formats of the device at 'path', enumerating them on
+        the first call. 'busInfo' must match the cached device, else
+        an empty list is returned.
+    */
+    std::vector<CapFormatInfo> getFormats(const std::string &path, const std::string &busInfo);
+
+protected:
+    V4L2DeviceCache() {}
+
+    struct FormatList
+    {
+        FormatList() : enumerated(false) {}
+
+        std::mutex  mutex;      ///< held while enumerating, a second caller waits for the first
+        bool        enumerated;
+        std::vector<CapFormatInfo> formats;
+    };
+
+    struct Entry
+    {
+        dev_t   rdev;           ///< device number of the node
+        time_t  ctime;          ///< changes when udev re-creates the node
+        bool    isCapture;      ///< false for metadata and output nodes
+        Device  device;
+        std::shared_ptr<FormatList> formats;    ///< outlives the entry while it is being enumerated
+    };
+
+    static void enumerateFormats(int fd, std::vector<CapFormatInfo> &formats);
+    static bool queryFrameSize(int fd, uint32_t index, uint32_t pixelformat, uint32_t *width, uint32_t *height);
+    static uint32_t findMaxFrameRate(int fd, uint32_t pixelformat, uint32_t width, uint32_t height);
+
+    std::mutex                      m_mutex;    ///< guards m_entries only, never held during ioctls
+    std::map<std::string, Entry>    m_entries;  ///< by device path
+};
+
+#endif
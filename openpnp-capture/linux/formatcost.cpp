@@ -0,0 +1,223 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Conversion cost model for capture format negotiation
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#include <linux/videodev2.h>
+#include <chrono>
+#include <vector>
+#include <string.h>
+
+#include "formatcost.h"
+#include "yuvconverters.h"
+#include "mjpeghelper.h"
+#include "../common/logging.h"
+#include "openpnp-capture.h"
+
+namespace
+{
+    const uint32_t c_width  = 640;
+    const uint32_t c_height = 480;
+    const uint32_t c_runs   = 5;    ///< the fastest of this many runs is used
+
+    /** Time 'fn' and return the cost per test frame pixel in ns */
+    template<class F> float measure(F fn)
+    {
+        double best = 0.0;
+        for(uint32_t i=0; i<c_runs; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+            if ((i == 0) || (ns.count() < best))
+            {
+                best = ns.count();
+            }
+        }
+        return static_cast<float>(best / (c_width*c_height));
+    }
+
+    /** Compress a 24-bit RGB frame to JPEG in memory */
+    std::vector<uint8_t> compressJPEG(const uint8_t *rgb, uint32_t width, uint32_t height)
+    {
+        jpeg_compress_struct cinfo;
+        jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_compress(&cinfo);
+
+        unsigned char *mem = nullptr;
+        unsigned long memBytes = 0;
+        jpeg_mem_dest(&cinfo, &mem, &memBytes);
+
+        cinfo.image_width      = width;
+        cinfo.image_height     = height;
+        cinfo.input_components = 3;
+        cinfo.in_color_space   = JCS_RGB;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, 85, TRUE);
+
+        jpeg_start_compress(&cinfo, TRUE);
+        while(cinfo.next_scanline < cinfo.image_height)
+        {
+            JSAMPROW row = const_cast<uint8_t*>(rgb + cinfo.next_scanline*width*3);
+            jpeg_write_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+
+        std::vector<uint8_t> jpeg(mem, mem + memBytes);
+        jpeg_destroy_compress(&cinfo);
+        free(mem);
+        return jpeg;
+    }
+}
+
+const FormatCostModel& FormatCostModel::instance()
+{
+    static FormatCostModel model;
+    return model;
+}
+
+FormatCostModel::FormatCostModel()
+{
+    calibrate();
+}
+
+float FormatCostModel::getCost(uint32_t fourcc, uint32_t outputFormat) const
+{
+    if (outputFormat > CAPOUTPUT_Y8)
+    {
+        return -1.0f;
+    }
+    auto iter = m_costs[outputFormat].find(fourcc);
+    return (iter != m_costs[outputFormat].end()) ? iter->second : -1.0f;
+}
+
+void FormatCostModel::calibrate()
+{
+    const uint32_t pixels = c_width*c_height;
+    std::vector<uint8_t> rgb(pixels*3);
+    std::vector<uint8_t> yuv(pixels*2);
+    std::vector<uint8_t> out(pixels*3);
+    std::vector<float>   rgba(pixels*4);
+
+    // gradients with some noise, so the JPEG is not trivially compressible
+    uint32_t seed = 12345;
+    for(uint32_t y=0; y<c_height; y++)
+    {
+        for(uint32_t x=0; x<c_width; x++)
+        {
+            seed = seed*1664525 + 1013904223;
+            uint8_t noise = (seed >> 24) & 0x1F;
+            uint8_t *p = &rgb[(x + y*c_width)*3];
+            p[0] = static_cast<uint8_t>(x*255/c_width) ^ noise;
+            p[1] = static_cast<uint8_t>(y*255/c_height) ^ noise;
+            p[2] = static_cast<uint8_t>((x+y)*255/(c_width+c_height));
+        }
+    }
+    for(uint32_t i=0; i<yuv.size(); i++)
+    {
+        yuv[i] = rgb[i];
+    }
+    std::vector<uint8_t> jpeg = compressJPEG(&rgb[0], c_width, c_height);
+
+    // RGB24 is copied or expanded
+    m_costs[CAPOUTPUT_RGB24][V4L2_PIX_FMT_RGB24] = measure([&]()
+    {
+        memcpy(&out[0], &rgb[0], out.size());
+    });
+    m_costs[CAPOUTPUT_RGBAF32][V4L2_PIX_FMT_RGB24] = measure([&]()
+    {
+        RGB2RGBAF(&rgb[0], &rgba[0], pixels);
+    });
+    const FrameGeometry full = FrameGeometry::full(c_width, c_height);
+    m_costs[CAPOUTPUT_Y8][V4L2_PIX_FMT_RGB24] = measure([&]()
+    {
+        RGB2Y(&rgb[0], c_width*3, full, &out[0]);
+    });
+
+    // YUV layouts, the buffer is large enough for all of them
+    struct
+    {
+        YUVLayout layout;
+        uint32_t  fourcc;
+    } layouts[] =
+    {
+        {YUVLayout::YUYV, V4L2_PIX_FMT_YUYV},
+        {YUVLayout::NV12, V4L2_PIX_FMT_NV12},
+        {YUVLayout::I420, V4L2_PIX_FMT_YUV420},
+    };
+    for(auto &l : layouts)
+    {
+        YUVFrame frame;
+        frame.layout     = l.layout;
+        frame.width      = c_width;
+        frame.height     = c_height;
+        frame.planes[0]  = &yuv[0];
+        frame.strides[0] = (l.layout == YUVLayout::YUYV) ? c_width*2 : c_width;
+        frame.planes[1]  = &yuv[pixels];
+        frame.strides[1] = (l.layout == YUVLayout::I420) ? c_width/2 : c_width;
+        frame.planes[2]  = &yuv[pixels + pixels/4];
+        frame.strides[2] = c_width/2;
+
+        m_costs[CAPOUTPUT_RGB24][l.fourcc] = measure([&]()
+        {
+            YUV2RGB(frame, &out[0]);
+        });
+        m_costs[CAPOUTPUT_RGBAF32][l.fourcc] = measure([&]()
+        {
+            YUV2RGBAF(frame, &rgba[0]);
+        });
+        m_costs[CAPOUTPUT_Y8][l.fourcc] = measure([&]()
+        {
+            YUV2Y(frame, full, &out[0]);
+        });
+    }
+    m_costs[CAPOUTPUT_RGB24][V4L2_PIX_FMT_YVU420]    = m_costs[CAPOUTPUT_RGB24][V4L2_PIX_FMT_YUV420];
+    m_costs[CAPOUTPUT_RGBAF32][V4L2_PIX_FMT_YVU420]  = m_costs[CAPOUTPUT_RGBAF32][V4L2_PIX_FMT_YUV420];
+    m_costs[CAPOUTPUT_Y8][V4L2_PIX_FMT_YVU420]       = m_costs[CAPOUTPUT_Y8][V4L2_PIX_FMT_YUV420];
+
+    // MJPEG, decoded to RGB24 and expanded for float output
+    MJPEGHelper helper;
+    float decodeCost = measure([&]()
+    {
+        helper.decompressFrame(&jpeg[0], jpeg.size(), &out[0], c_width, c_height);
+    });
+    m_costs[CAPOUTPUT_RGB24][V4L2_PIX_FMT_MJPEG]   = decodeCost;
+    m_costs[CAPOUTPUT_RGBAF32][V4L2_PIX_FMT_MJPEG] = decodeCost + m_costs[CAPOUTPUT_RGBAF32][V4L2_PIX_FMT_RGB24];
+    m_costs[CAPOUTPUT_Y8][V4L2_PIX_FMT_MJPEG] = measure([&]()
+    {
+        helper.decompressFrame(&jpeg[0], jpeg.size(), &out[0], c_width, c_height, 1, true);
+    });
+
+    LOG(LOG_INFO, "Conversion cost (ns/pixel, RGB24/RGBAF32/Y8): RGB3 %.2f/%.2f/%.2f YUYV %.2f/%.2f/%.2f "
+        "NV12 %.2f/%.2f/%.2f YU12 %.2f/%.2f/%.2f MJPG %.2f/%.2f/%.2f\n",
+        m_costs[0][V4L2_PIX_FMT_RGB24],  m_costs[1][V4L2_PIX_FMT_RGB24],  m_costs[2][V4L2_PIX_FMT_RGB24],
+        m_costs[0][V4L2_PIX_FMT_YUYV],   m_costs[1][V4L2_PIX_FMT_YUYV],   m_costs[2][V4L2_PIX_FMT_YUYV],
+        m_costs[0][V4L2_PIX_FMT_NV12],   m_costs[1][V4L2_PIX_FMT_NV12],   m_costs[2][V4L2_PIX_FMT_NV12],
+        m_costs[0][V4L2_PIX_FMT_YUV420], m_costs[1][V4L2_PIX_FMT_YUV420], m_costs[2][V4L2_PIX_FMT_YUV420],
+        m_costs[0][V4L2_PIX_FMT_MJPEG],  m_costs[1][V4L2_PIX_FMT_MJPEG],  m_costs[2][V4L2_PIX_FMT_MJPEG]);
+}
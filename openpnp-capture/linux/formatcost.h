@@ -0,0 +1,61 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Conversion cost model for capture format negotiation
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#ifndef linux_formatcost_h
+#define linux_formatcost_h
+
+#include <stdint.h>
+#include <map>
+
+/** CPU cost of turning each supported capture format into each
+    output format (CAPOUTPUT_xxx), in nanoseconds per pixel.
+
+    The costs are measured once per process, the first time the
+    model is used, by running the real converters on a synthetic
+    640x480 test frame. MJPEG is measured on a frame compressed
+    at quality 85; busy scenes decode slower than that.
+*/
+class FormatCostModel
+{
+public:
+    static const FormatCostModel& instance();
+
+    /** Returns the cost in ns/pixel, or a negative value if
+        frames with this fourcc cannot be converted. */
+    float getCost(uint32_t fourcc, uint32_t outputFormat) const;
+
+private:
+    FormatCostModel();
+
+    void calibrate();
+
+    std::map<uint32_t, float> m_costs[3];  ///< fourcc -> ns/pixel, per output format
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Memory-mapped raw frame ring file
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include "framering.h"
+#include "../common/logging.h"
+
+static const char c_ringMagic[8] = {'C','A','P','R','I','N','G','1'};
+
+static size_t pageAlign(size_t bytes)
+{
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return ((bytes + page - 1) / page) * page;
+}
+
+// **********************************************************************
+//   FrameRingWriter
+// **********************************************************************
+
+FrameRingWriter::FrameRingWriter() :
+    m_fd(-1),
+    m_map(nullptr),
+    m_mapBytes(0),
+    m_header(nullptr)
+{
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+    close();
+}
+
+bool FrameRingWriter::create(const std::string &filename, uint32_t width, uint32_t height,
+    uint32_t fourcc, uint32_t fps, uint32_t bytesPerLine, size_t slotBytes, uint32_t slotCount)
+{
+    close();
+
+    if ((slotBytes == 0) || (slotCount == 0))
+    {
+        LOG(LOG_ERR, "FrameRingWriter: empty ring requested\n");
+        return false;
+    }
+
+    const size_t headerBytes = pageAlign(sizeof(FrameRingHeader));
+    const size_t slotStride  = pageAlign(sizeof(FrameRingSlot) + slotBytes);
+    const size_t totalBytes  = headerBytes + slotStride*slotCount;
+
+    m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+    {
+        LOG(LOG_ERR, "FrameRingWriter: cannot create %s (errno = %d)\n", filename.c_str(), errno);
+        return false;
+    }
+
+    // reserve the blocks up front so writing a frame can never
+    // run out of disk space half way through the mapping
+    int err = posix_fallocate(m_fd, 0, totalBytes);
+    if (err != 0)
+    {
+        LOG(LOG_ERR, "FrameRingWriter: cannot allocate %d MB for %s (errno = %d)\n",
+            static_cast<int>(totalBytes >> 20), filename.c_str(), err);
+        close();
+        return false;
+    }
+
+    // MAP_POPULATE faults all pages in now instead of on the capture thread
+    void *map = mmap(nullptr, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG(LOG_ERR, "FrameRingWriter: cannot map %s (errno = %d)\n", filename.c_str(), errno);
+        close();
+        return false;
+    }
+
+    m_map      = static_cast<uint8_t*>(map);
+    m_mapBytes = totalBytes;
+    m_header   = reinterpret_cast<FrameRingHeader*>(m_map);
+
+    memset(m_header, 0, sizeof(FrameRingHeader));
+    m_header->width         = width;
+    m_header->height        = height;
+    m_header->fourcc        = fourcc;
+    m_header->fps           = fps;
+    m_header->bytesPerLine  = bytesPerLine;
+    m_header->slotCount     = slotCount;
+    m_header->slotOffset    = headerBytes;
+    m_header->slotBytes     = slotBytes;
+    m_header->slotStride    = slotStride;
+    memcpy(m_header->magic, c_ringMagic, sizeof(c_ringMagic));
+
+    LOG(LOG_INFO, "Recording to %s: %d slots of %d bytes\n", filename.c_str(), slotCount, 
+        static_cast<int>(slotBytes));
+    return true;
+}
+
+bool FrameRingWriter::write(const uint8_t *data, size_t bytes, uint64_t timestampUs, uint32_t sequence)
+{
+    if (m_header == nullptr)
+    {
+        return false;
+    }
+
+    if (bytes > m_header->slotBytes)
+    {
+        m_header->framesSkipped++;
+        return false;
+    }
+
+    const uint64_t slotIndex = m_header->framesWritten % m_header->slotCount;
+    uint8_t *slotPtr = m_map + m_header->slotOffset + slotIndex*m_header->slotStride;
+
+    FrameRingSlot *slot = reinterpret_cast<FrameRingSlot*>(slotPtr);
+    memcpy(slotPtr + sizeof(FrameRingSlot), data, bytes);
+    slot->timestampUs = timestampUs;
+    slot->sequence    = sequence;
+    slot->bytes       = static_cast<uint32_t>(bytes);
+
+    m_header->framesWritten++;
+    return true;
+}
+
+void FrameRingWriter::close()
+{
+    if (m_header != nullptr)
+    {
+        LOG(LOG_INFO, "Recorded %d frames (%d skipped)\n", static_cast<int>(m_header->framesWritten),
+            static_cast<int>(m_header->framesSkipped));
+    }
+
+    if (m_map != nullptr)
+    {
+        munmap(m_map, m_mapBytes);
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+
+    m_fd       = -1;
+    m_map      = nullptr;
+    m_mapBytes = 0;
+    m_header   = nullptr;
+}
+
+void FrameRingWriter::swap(FrameRingWriter &other)
+{
+    std::swap(m_fd, other.m_fd);
+    std::swap(m_map, other.m_map);
+    std::swap(m_mapBytes, other.m_mapBytes);
+    std::swap(m_header, other.m_header);
+}
+
+// **********************************************************************
+//   FrameRingReader
+// **********************************************************************
+
+FrameRingReader::FrameRingReader() :
+    m_map(nullptr),
+    m_mapBytes(0),
+    m_header(nullptr)
+{
+}
+
+FrameRingReader::~FrameRingReader()
+{
+    close();
+}
+
+bool FrameRingReader::isFrameRing(const std::string &filename)
+{
+    char magic[sizeof(c_ringMagic)];
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const bool ok = (read(fd, magic, sizeof(magic)) == sizeof(magic)) &&
+        (memcmp(magic, c_ringMagic, sizeof(magic)) == 0);
+    ::close(fd);
+    return ok;
+}
+
+bool FrameRingReader::open(const std::string &filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOG(LOG_ERR, "FrameRingReader: cannot open %s (errno = %d)\n", filename.c_str(), errno);
+        return false;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(FrameRingHeader)))
+    {
+        LOG(LOG_ERR, "FrameRingReader: %s is too small\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    // the mapping stays valid after closing the descriptor
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        LOG(LOG_ERR, "FrameRingReader: cannot map %s (errno = %d)\n", filename.c_str(), errno);
+        return false;
+    }
+
+    m_map      = static_cast<uint8_t*>(map);
+    m_mapBytes = st.st_size;
+    m_header   = reinterpret_cast<const FrameRingHeader*>(m_map);
+
+    const uint64_t needed = m_header->slotOffset + m_header->slotStride*m_header->slotCount;
+    if ((memcmp(m_header->magic, c_ringMagic, sizeof(c_ringMagic)) != 0) ||
+        (m_header->slotCount == 0) ||
+        (m_header->slotOffset < sizeof(FrameRingHeader)) ||
+        (m_header->slotStride < sizeof(FrameRingSlot) + m_header->slotBytes) ||
+        (needed > m_mapBytes))
+    {
+        LOG(LOG_ERR, "FrameRingReader: %s is not a valid frame ring\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    // the frames are read once, front to back
+    madvise(m_map, m_mapBytes, MADV_SEQUENTIAL);
+    return true;
+}
+
+void FrameRingReader::close()
+{
+    if (m_map != nullptr)
+    {
+        munmap(m_map, m_mapBytes);
+    }
+    m_map      = nullptr;
+    m_mapBytes = 0;
+    m_header   = nullptr;
+}
+
+uint32_t FrameRingReader::getFrameCount() const
+{
+    if (m_header == nullptr)
+    {
+        return 0;
+    }
+    if (m_header->framesWritten < m_header->slotCount)
+    {
+        return static_cast<uint32_t>(m_header->framesWritten);
+    }
+    return m_header->slotCount;
+}
+
+const FrameRingSlot* FrameRingReader::getFrame(uint32_t index) const
+{
+    const uint32_t count = getFrameCount();
+    if (index >= count)
+    {
+        return nullptr;
+    }
+
+    // the oldest frame sits right after the most recently written one
+    const uint64_t first = m_header->framesWritten - count;
+    const uint64_t slotIndex = (first + index) % m_header->slotCount;
+    const uint8_t *slotPtr = m_map + m_header->slotOffset + slotIndex*m_header->slotStride;
+
+    const FrameRingSlot *slot = reinterpret_cast<const FrameRingSlot*>(slotPtr);
+    if (slot->bytes > m_header->slotBytes)
+    {
+        return nullptr;
+    }
+    return slot;
+}
@@ -0,0 +1,152 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Memory-mapped raw frame ring file
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#ifndef linux_framering_h
+#define linux_framering_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/** On-disk layout of a frame ring file.
+
+    The file starts with a FrameRingHeader, followed (at slotOffset)
+    by 'slotCount' slots of 'slotStride' bytes each. Every slot holds a FrameRingSlot
+    followed by up to 'slotBytes' bytes of raw frame data, exactly as
+    the driver delivered it. Frame N is stored in slot N % slotCount,
+    so the file always holds the most recent slotCount frames.
+*/
+struct FrameRingHeader
+{
+    char     magic[8];          ///< "CAPRING1"
+    uint32_t width;             ///< frame width in pixels
+    uint32_t height;            ///< frame height in pixels
+    uint32_t fourcc;            ///< V4L2 pixel format of the raw frames
+    uint32_t fps;               ///< frame rate the frames were captured at
+    uint32_t bytesPerLine;      ///< stride of the first plane, 0 if unknown
+    uint32_t slotCount;         ///< number of frame slots in the file
+    uint64_t slotOffset;        ///< file offset of the first slot
+    uint64_t slotBytes;         ///< maximum size of a frame
+    uint64_t slotStride;        ///< distance between slots, page aligned
+    uint64_t framesWritten;     ///< total number of frames written
+    uint64_t framesSkipped;     ///< frames that did not fit in a slot
+};
+
+struct FrameRingSlot
+{
+    uint64_t timestampUs;       ///< capture time (monotonic clock, microseconds)
+    uint32_t sequence;          ///< driver sequence number
+    uint32_t bytes;             ///< size of the frame data following this struct
+};
+
+/** Records raw frames into a preallocated, memory-mapped ring file.
+
+    All disk space is allocated and mapped (and pre-faulted) by
+    create(), so write() is a plain memcpy into the mapping: no
+    allocation and no system calls per frame. The kernel writes the
+    dirty pages back in the background.
+*/
+class FrameRingWriter
+{
+public:
+    FrameRingWriter();
+    ~FrameRingWriter();
+
+    /** Create (or truncate) 'filename' with room for 'slotCount' frames
+        of at most 'slotBytes' bytes each. */
+    bool create(const std::string &filename, uint32_t width, uint32_t height,
+        uint32_t fourcc, uint32_t fps, uint32_t bytesPerLine, size_t slotBytes, uint32_t slotCount);
+
+    /** Store a frame in the next slot, overwriting the oldest one
+        when the ring is full. Returns false if the frame is too large. */
+    bool write(const uint8_t *data, size_t bytes, uint64_t timestampUs, uint32_t sequence);
+
+    /** Unmap and close the file; the frames stay on disk */
+    void close();
+
+    /** Exchange the files of two writers */
+    void swap(FrameRingWriter &other);
+
+    bool isOpen() const
+    {
+        return m_header != nullptr;
+    }
+
+    uint64_t getFramesWritten() const
+    {
+        return (m_header != nullptr) ? m_header->framesWritten : 0;
+    }
+
+protected:
+    FrameRingWriter(const FrameRingWriter&) = delete;
+    FrameRingWriter& operator=(const FrameRingWriter&) = delete;
+
+    int              m_fd;
+    uint8_t         *m_map;
+    size_t           m_mapBytes;
+    FrameRingHeader *m_header;
+};
+
+/** Read-only view of a frame ring file written by FrameRingWriter */
+class FrameRingReader
+{
+public:
+    FrameRingReader();
+    ~FrameRingReader();
+
+    /** Map 'filename'. Returns false if it is not a frame ring file */
+    bool open(const std::string &filename);
+
+    void close();
+
+    /** Returns true if 'filename' starts with the frame ring magic */
+    static bool isFrameRing(const std::string &filename);
+
+    const FrameRingHeader& header() const
+    {
+        return *m_header;
+    }
+
+    /** Number of frames held by the ring */
+    uint32_t getFrameCount() const;
+
+    /** Return the metadata of the index'th stored frame, oldest first.
+        The frame data follows the slot struct. */
+    const FrameRingSlot* getFrame(uint32_t index) const;
+
+protected:
+    FrameRingReader(const FrameRingReader&) = delete;
+    FrameRingReader& operator=(const FrameRingReader&) = delete;
+
+    uint8_t         *m_map;
+    size_t           m_mapBytes;
+    const FrameRingHeader *m_header;
+};
+
+#endif
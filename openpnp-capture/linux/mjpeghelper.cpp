@@ -28,27 +28,201 @@
 */
 
 #include "mjpeghelper.h"
-
-#include "contrib/stb_image.h"
 #include "../common/logging.h"
 
+MJPEGHelper::MJPEGHelper()
+{
+    m_cinfo.err = jpeg_std_error(&m_error.pub);
+    m_error.pub.error_exit = errorExit;
+    m_error.pub.output_message = outputMessage;
+    jpeg_create_decompress(&m_cinfo);
+}
+
+MJPEGHelper::~MJPEGHelper()
+{
+    jpeg_destroy_decompress(&m_cinfo);
+}
+
+void MJPEGHelper::errorExit(j_common_ptr cinfo)
+{
+    // report the error and return to decompressFrame
+    (*cinfo->err->output_message)(cinfo);
+    ErrorManager *err = reinterpret_cast<ErrorManager*>(cinfo->err);
+    longjmp(err->jump, 1);
+}
+
+void MJPEGHelper::outputMessage(j_common_ptr cinfo)
+{
+    // corrupt frames are common on USB cameras,
+    // so don't spam stderr with them.
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    LOG(LOG_VERBOSE, "MJPG: %s\n", msg);
+}
+
 bool MJPEGHelper::decompressFrame(
     const uint8_t *inBuffer,
     size_t inBytes, uint8_t *outBuffer,
-    uint32_t outBufWidth, uint32_t outBufHeight)
+    uint32_t outBufWidth, uint32_t outBufHeight,
+    uint32_t scaleDenom, bool grayscale)
 {
-    int32_t width, height, jpegSubsamp;
-    uint8_t *jpegPtr = stbi_load_from_memory(inBuffer, inBytes, &width, &height, &jpegSubsamp, 3);
-    
-    if ((width != outBufWidth) || (height != outBufHeight))
+    if ((inBuffer == nullptr) || (inBytes == 0) || (outBuffer == nullptr))
     {
-        LOG(LOG_ERR, "JPEG load failed");
-        stbi_image_free(jpegPtr);
         return false;
     }
+
+    if (setjmp(m_error.jump))
+    {
+        // libjpeg reported a fatal error; reset the decoder
+        // so it can be used for the next frame.
+        jpeg_abort_decompress(&m_cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&m_cinfo, const_cast<uint8_t*>(inBuffer), inBytes);
+    if (jpeg_read_header(&m_cinfo, TRUE) != JPEG_HEADER_OK)
+    {
+        jpeg_abort_decompress(&m_cinfo);
+        return false;
+    }
+
+    m_cinfo.out_color_space = grayscale ? JCS_GRAYSCALE : JCS_RGB;
+    m_cinfo.scale_num   = 1;
+    m_cinfo.scale_denom = scaleDenom;
+    jpeg_calc_output_dimensions(&m_cinfo);
+
+    if ((m_cinfo.output_width != outBufWidth) || (m_cinfo.output_height != outBufHeight))
+    {
+        LOG(LOG_ERR, "MJPG: frame is %dx%d, expected %dx%d\n", 
+            m_cinfo.output_width, m_cinfo.output_height, outBufWidth, outBufHeight);
+        jpeg_abort_decompress(&m_cinfo);
+        return false;
+    }
+
+    jpeg_start_decompress(&m_cinfo);
+
+    m_rows.resize(outBufHeight);
+    for(uint32_t y=0; y<outBufHeight; y++)
+    {
+        m_rows[y] = outBuffer + y*outBufWidth*m_cinfo.output_components;
+    }
+
+    while (m_cinfo.output_scanline < m_cinfo.output_height)
+    {
+        jpeg_read_scanlines(&m_cinfo, &m_rows[m_cinfo.output_scanline],
+            m_cinfo.output_height - m_cinfo.output_scanline);
+    }
+
+    jpeg_finish_decompress(&m_cinfo);
+
+    LOG(LOG_VERBOSE, "MJPG: %d %d size %d bytes\n", outBufWidth, outBufHeight, inBytes);
+    return true;
+}
+
+bool MJPEGHelper::decompressRegion(
+    const uint8_t *inBuffer, size_t inBytes,
+    const FrameGeometry &geometry, uint8_t *outBuffer, bool grayscale)
+{
+    if ((inBuffer == nullptr) || (inBytes == 0) || (outBuffer == nullptr) ||
+        (geometry.cropWidth == 0) || (geometry.cropHeight == 0))
+    {
+        return false;
+    }
+
+    if (setjmp(m_error.jump))
+    {
+        jpeg_abort_decompress(&m_cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&m_cinfo, const_cast<uint8_t*>(inBuffer), inBytes);
+    if (jpeg_read_header(&m_cinfo, TRUE) != JPEG_HEADER_OK)
+    {
+        jpeg_abort_decompress(&m_cinfo);
+        return false;
+    }
+
+    if ((geometry.cropX + geometry.cropWidth > m_cinfo.image_width) ||
+        (geometry.cropY + geometry.cropHeight > m_cinfo.image_height))
+    {
+        LOG(LOG_ERR, "MJPG: frame is %dx%d, smaller than the crop region\n",
+            m_cinfo.image_width, m_cinfo.image_height);
+        jpeg_abort_decompress(&m_cinfo);
+        return false;
+    }
+
+    // the smallest DCT scale that does not drop below the output size
+    uint32_t num = 8;
+    for(uint32_t n=1; n<8; n++)
+    {
+        if ((geometry.cropWidth*n >= geometry.outWidth*8) && (geometry.cropHeight*n >= geometry.outHeight*8))
+        {
+            num = n;
+            break;
+        }
+    }
+
+    m_cinfo.out_color_space = grayscale ? JCS_GRAYSCALE : JCS_RGB;
+    m_cinfo.scale_num   = num;
+    m_cinfo.scale_denom = 8;
+    jpeg_start_decompress(&m_cinfo);
+
+    // the region in scaled pixels
+    const uint32_t left   = geometry.cropX*num/8;
+    const uint32_t top    = geometry.cropY*num/8;
+    uint32_t width  = geometry.cropWidth*num/8;
+    uint32_t height = geometry.cropHeight*num/8;
+    width  = (width == 0) ? 1 : ((left + width > m_cinfo.output_width) ? m_cinfo.output_width - left : width);
+    height = (height == 0) ? 1 : ((top + height > m_cinfo.output_height) ? m_cinfo.output_height - top : height);
+
+    // libjpeg widens the crop to whole iMCU columns
+    JDIMENSION cropLeft  = left;
+    JDIMENSION cropWidth = width;
+    if ((left != 0) || (width != m_cinfo.output_width))
+    {
+        jpeg_crop_scanline(&m_cinfo, &cropLeft, &cropWidth);
+    }
+
+    const uint32_t components = m_cinfo.output_components;
+    m_row.resize(m_cinfo.output_width*components);
+    m_columns.resize(geometry.outWidth);
+    for(uint32_t x=0; x<geometry.outWidth; x++)
+    {
+        m_columns[x] = components*(sampleCoord(x, left, width, geometry.outWidth) - cropLeft);
+    }
+
+    if (top > 0)
+    {
+        jpeg_skip_scanlines(&m_cinfo, top);
+    }
+
+    JSAMPROW row = &m_row[0];
+    uint8_t *out = outBuffer;
+    for(uint32_t y=0; y<geometry.outHeight; y++)
+    {
+        const uint32_t srcRow = sampleCoord(y, top, height, geometry.outHeight);
+        while (m_cinfo.output_scanline <= srcRow)
+        {
+            jpeg_read_scanlines(&m_cinfo, &row, 1);
+        }
+        for(uint32_t x=0; x<geometry.outWidth; x++)
+        {
+            const uint8_t *src = row + m_columns[x];
+            for(uint32_t c=0; c<components; c++)
+            {
+                *out++ = src[c];
+            }
+        }
+    }
+
+    // the rows below the region are never decoded
+    if (m_cinfo.output_scanline < m_cinfo.output_height)
+    {
+        jpeg_abort_decompress(&m_cinfo);
+    }
     else
     {
-        LOG(LOG_VERBOSE, "MJPG: %d %d size %d bytes\n", width, height, inBytes);
+        jpeg_finish_decompress(&m_cinfo);
     }
     return true;
-}
\ No newline at end of file
+}
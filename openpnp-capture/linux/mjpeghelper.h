@@ -32,17 +32,74 @@
 
 #include <stdint.h>
 #include <stdlib.h> // size_t
+#include <stdio.h>  // jpeglib.h needs FILE
+#include <setjmp.h>
+#include <vector>
+#include <jpeglib.h>
+#include "yuvconverters.h"   // FrameGeometry
 
+/** MJPEG frame decoder.
+    The libjpeg decompressor is created once and reused for
+    every frame; decoded rows are written straight into the
+    caller's buffer.
+*/
 class MJPEGHelper
 {
 public:
-    /** Decompress a JPEG contained in the buffer. 
+    MJPEGHelper();
+    ~MJPEGHelper();
+
+    /** Decompress a JPEG contained in the buffer to 24-bit RGB.
+
+        With a scaleDenom of 2, 4 or 8 the frame is decoded at
+        1/scaleDenom of its size in the DCT domain, which is
+        considerably cheaper than decoding and downscaling.
+
         The width and height of the output buffer are for
-        sanity checking only. If the JPEG does not match
+        sanity checking only. If the (scaled) JPEG does not match
         the buffer size, the function will return false.
+
+        With 'grayscale' set only the luma component is decoded,
+        to one byte per pixel; libjpeg skips the chroma entirely.
     */
     bool decompressFrame(const uint8_t *inBuffer, size_t inBytes, 
-        uint8_t *outBuffer, uint32_t outBufWidth, uint32_t outButHeight);
+        uint8_t *outBuffer, uint32_t outBufWidth, uint32_t outBufHeight,
+        uint32_t scaleDenom = 1, bool grayscale = false);
+
+    /** Decompress the region 'geometry' of a JPEG to 24-bit RGB of
+        geometry.outWidth x geometry.outHeight pixels, with the
+        nearest-pixel sampling of FrameGeometry.
+
+        The JPEG is decoded at the smallest M/8 DCT scale that still
+        has at least as many pixels as the output. Columns left and
+        right of the region are skipped with jpeg_crop_scanline, rows
+        above it with jpeg_skip_scanlines, and decoding stops after
+        the last row that is sampled.
+    */
+    bool decompressRegion(const uint8_t *inBuffer, size_t inBytes,
+        const FrameGeometry &geometry, uint8_t *outBuffer, bool grayscale = false);
+
+    /** Returns the size of a dimension decoded at 1/scaleDenom */
+    static uint32_t scaledSize(uint32_t size, uint32_t scaleDenom)
+    {
+        return (size + scaleDenom - 1) / scaleDenom;
+    }
+
+private:
+    struct ErrorManager
+    {
+        jpeg_error_mgr  pub;        ///< must be first, libjpeg casts to it
+        jmp_buf         jump;       ///< where to go when libjpeg reports a fatal error
+    };
+
+    static void errorExit(j_common_ptr cinfo);
+    static void outputMessage(j_common_ptr cinfo);
+
+    jpeg_decompress_struct  m_cinfo;
+    ErrorManager            m_error;
+    std::vector<JSAMPROW>   m_rows;     ///< output row pointers, reused between frames
+    std::vector<uint8_t>    m_row;      ///< one decoded row, for decompressRegion
+    std::vector<uint32_t>   m_columns;  ///< sampled byte offsets within m_row
 };
 
 #endif
@@ -37,6 +37,9 @@
 #include "../common/logging.h"
 #include "platformstream.h"
 #include "platformcontext.h"
+#include "formatcost.h"
+#include "devicecache.h"
+#include "replaystream.h"
 
 // a platform factory function needed by
 // libmain.cpp
@@ -56,170 +59,123 @@ PlatformContext::~PlatformContext()
 {
 }
 
-bool PlatformContext::enumerateDevices()
+float PlatformContext::getConversionCost(uint32_t fourcc, uint32_t outputFormat) const
 {
-    int fd;
-    v4l2_capability  video_cap;
+    return FormatCostModel::instance().getCost(fourcc, outputFormat);
+}
 
+bool PlatformContext::enumerateDevices()
+{
     LOG(LOG_INFO,"Enumerating devices\n");
 
     const uint32_t maxDevices = 64; // FIXME: is this a sane number for linux?
 
-    uint32_t dcount = 0;
-    while(dcount < maxDevices)
+    // only the names are needed here, the format lists are
+    // enumerated when the application first asks for them
+    V4L2DeviceCache &cache = V4L2DeviceCache::instance();
+    for(uint32_t dcount = 0; dcount < maxDevices; dcount++)
     {
         char fname[100];
-        snprintf(fname, sizeof(fname), "/dev/video%d", dcount++);
+        snprintf(fname, sizeof(fname), "/dev/video%d", dcount);
 
-        if ((fd = ::open(fname, O_RDWR /* required */ | O_NONBLOCK)) == -1)
+        V4L2DeviceCache::Device device;
+        if (!cache.query(fname, device))
         {
-            //LOG(LOG_ERR, "enumerateDevices: Can't open device %s\n", fname);
             continue;
         }
 
-        if (ioctl(fd, VIDIOC_QUERYCAP, &video_cap) == -1)
-        {
-            ::close(fd);
-            LOG(LOG_ERR, "enumerateDevices: Can't get capabilities\n");
-            continue;
-        }
-        
-        if ((video_cap.device_caps & V4L2_CAP_VIDEO_CAPTURE) != 0)
-        {
-            LOG(LOG_INFO,"Name: '%s'\n", video_cap.card);
-            LOG(LOG_INFO,"Path: '%s'\n", fname);
-            LOG(LOG_INFO,"Bus : '%s'\n", video_cap.bus_info);
-            LOG(LOG_INFO,"capflags = %08X\n", video_cap.capabilities);
-            LOG(LOG_INFO,"devflags = %08X\n", video_cap.device_caps);
-
-            if ((video_cap.device_caps & V4L2_CAP_READWRITE) != 0)
-            {
-                LOG(LOG_INFO,"read/write supported\n");
-            }
-            else
-            {
-                LOG(LOG_INFO,"read/write NOT supported\n");
-            }
-
-            if ((video_cap.device_caps & V4L2_CAP_STREAMING) != 0)
-            {
-                LOG(LOG_INFO,"streaming I/O supported\n");
-            }
-            else
-            {
-                LOG(LOG_INFO,"streaming I/O NOT supported\n");
-            }            
-
-            if ((video_cap.device_caps & V4L2_CAP_ASYNCIO) != 0)
-            {
-                LOG(LOG_INFO,"async I/O supported\n");
-            }
-            else
-            {
-                LOG(LOG_INFO,"async I/O NOT supported\n");
-            }   
-
-            platformDeviceInfo* dinfo = new platformDeviceInfo();
-            dinfo->m_name = std::string((const char*)video_cap.card);
-            dinfo->m_devicePath = std::string(fname);
-            dinfo->m_uniqueID = dinfo->m_name + " ";
-            dinfo->m_uniqueID.append((const char*)video_cap.bus_info);
-            
-            // enumerate the frame formats
-            v4l2_fmtdesc fmtdesc;
-            uint32_t index = 0;
-            fmtdesc.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-            // FIXME: add FPS information
-            // https://linuxtv.org/downloads/v4l-dvb-apis/uapi/v4l/vidioc-enum-frameintervals.html
-
-            bool tryMore = true;
-            while(tryMore)
-            {
-                fmtdesc.index = index;
-            
-                if (ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == -1)
-                {
-                    tryMore = false;
-                }
-                else
-                {
-                    LOG(LOG_INFO, "Format %d\n", index);
-                    LOG(LOG_INFO, "  FOURCC = %s\n", fourCCToString(fmtdesc.pixelformat).c_str());
-
-                    // .. then we enumerate all the frame buffer sizes for that
-                    // pixel format type.
-                    uint32_t frmindex = 0;
-                    CapFormatInfo cinfo;
-                    cinfo.fourcc = fmtdesc.pixelformat;
-                    while(queryFrameSize(fd, frmindex, fmtdesc.pixelformat, &cinfo.width, &cinfo.height))
-                    {
-                        frmindex++;
-                        cinfo.fps = findMaxFrameRate(fd, fmtdesc.pixelformat, cinfo.width, cinfo.height);
-                        dinfo->m_formats.push_back(cinfo);
-                        LOG(LOG_INFO, "  %d x %d\n", cinfo.width, cinfo.height);
-                    }
-                }
-                index++;
-            }
-
-            m_devices.push_back(dinfo);
-        }
-
-        ::close(fd);         
+        platformDeviceInfo* dinfo = new platformDeviceInfo();
+        dinfo->m_name = device.name;
+        dinfo->m_devicePath = std::string(fname);
+        dinfo->m_busInfo = device.busInfo;
+        dinfo->m_uniqueID = dinfo->m_name + " ";
+        dinfo->m_uniqueID.append(device.busInfo);
+        m_devices.push_back(dinfo);
     }
+
+    addReplayDevices();
     return true;
 }
 
-
-bool PlatformContext::queryFrameSize(int fd, uint32_t index, uint32_t pixelformat, uint32_t *width, uint32_t *height)
+void PlatformContext::addReplayDevices()
 {
-    v4l2_frmsizeenum frmSize;
-    frmSize.index = index;
-    frmSize.pixel_format = pixelformat;
-    if (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmSize) != -1)
+    const char *env = getenv("OPENPNP_CAPTURE_REPLAY");
+    if (env == nullptr)
     {
-        if (frmSize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
-        {
-            *width  = frmSize.discrete.width;
-            *height = frmSize.discrete.height;
-        }
-        else
+        return;
+    }
+
+    std::string list(env);
+    size_t start = 0;
+    while(start < list.size())
+    {
+        size_t end = list.find(';', start);
+        if (end == std::string::npos)
         {
-            LOG(LOG_WARNING, "queryFrameSize returned non-discrete frame size!\n");
-            *width = 0;
-            *height = 0;
+            end = list.size();
         }
-
-        return true;
+        addReplayDevice(list.substr(start, end - start).c_str());
+        start = end + 1;
     }
-    return false;
 }
 
-uint32_t PlatformContext::findMaxFrameRate(int fd, uint32_t pixelformat, 
-    uint32_t width, uint32_t height)
+bool PlatformContext::addReplayDevice(const char *source)
 {
-    uint32_t fps = 0;
-
-    // now search the frame rates
-    v4l2_frmivalenum ivals;
-    ivals.pixel_format = pixelformat;
-    ivals.width = width;
-    ivals.height = height;
-    ivals.index = 0;
-    while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ivals) != -1)
+    std::string entry(source);
+    CapFormatInfo cinfo;
+    cinfo.bpp = 0;
+
+    std::string path;
+    if (FrameRingReader::isFrameRing(entry))
+    {
+        // ring files carry their own format
+        FrameRingReader ring;
+        if (!ring.open(entry))
+        {
+            return false;
+        }
+        path         = entry;
+        cinfo.width  = ring.header().width;
+        cinfo.height = ring.header().height;
+        cinfo.fourcc = ring.header().fourcc;
+        cinfo.fps    = 0;
+    }
+    else
     {
-        if (ivals.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+        // path,width,height,fourcc,fps - the path may contain commas
+        std::vector<std::string> fields;
+        size_t pos = entry.size();
+        for(uint32_t i=0; i<4; i++)
         {
-            LOG(LOG_INFO,"  FPS %d/%d", ivals.discrete.denominator, ivals.discrete.numerator);
-            uint32_t v = ivals.discrete.denominator/ivals.discrete.numerator;
-            if (fps < v)
+            size_t comma = entry.rfind(',', pos - 1);
+            if ((pos == 0) || (comma == std::string::npos))
             {
-                fps = v;
+                break;
             }
+            fields.insert(fields.begin(), entry.substr(comma + 1, pos - comma - 1));
+            pos = comma;
         }
-        ivals.index++;
+        if ((fields.size() != 4) || (fields[2].size() != 4))
+        {
+            LOG(LOG_ERR, "Replay device: expected path,width,height,fourcc,fps but got '%s'\n", entry.c_str());
+            return false;
+        }
+
+        path         = entry.substr(0, pos);
+        cinfo.width  = strtoul(fields[0].c_str(), nullptr, 10);
+        cinfo.height = strtoul(fields[1].c_str(), nullptr, 10);
+        cinfo.fourcc = v4l2_fourcc(fields[2][0], fields[2][1], fields[2][2], fields[2][3]);
+        cinfo.fps    = strtoul(fields[3].c_str(), nullptr, 10);
     }
 
-    return fps;
+    replayDeviceInfo *dinfo = new replayDeviceInfo();
+    dinfo->m_devicePath = path;
+    dinfo->m_name       = "Replay " + dinfo->m_devicePath;
+    dinfo->m_uniqueID   = "replay:" + dinfo->m_devicePath;
+    dinfo->m_formats.push_back(cinfo);
+    m_devices.push_back(dinfo);
+
+    LOG(LOG_INFO, "Replay device: %s (%dx%d %s %d fps)\n", dinfo->m_devicePath.c_str(),
+        cinfo.width, cinfo.height, fourCCToString(cinfo.fourcc).c_str(), cinfo.fps);
+    return true;
 }
@@ -60,16 +60,22 @@ public:
     PlatformContext();
     virtual ~PlatformContext();
 
-protected:
-    bool queryFrameSize(int fd, uint32_t index, uint32_t pixelformat, uint32_t *width, uint32_t *height);
-
-    uint32_t findMaxFrameRate(int fd, uint32_t pixelformat, uint32_t width, uint32_t height);
+    /** Add a replayDeviceInfo for one OPENPNP_CAPTURE_REPLAY entry */
+    virtual bool addReplayDevice(const char *source) override;
 
+protected:
     /** Enumerate V4L capture devices and put their 
-        information into the m_devices array 
+        information into the m_devices array. The formats
+        are filled in lazily, see V4L2DeviceCache.
     */
     virtual bool enumerateDevices();
 
+    /** Add the replay devices listed in OPENPNP_CAPTURE_REPLAY */
+    void addReplayDevices();
+
+    /** Conversion costs measured by FormatCostModel */
+    virtual float getConversionCost(uint32_t fourcc, uint32_t outputFormat) const;
+
 };
 
 #endif
\ No newline at end of file
@@ -49,6 +49,12 @@ public:
     }
 
     std::string     m_devicePath;   ///< unique device path
+    std::string     m_busInfo;      ///< V4L2 bus info, identifies the device in V4L2DeviceCache
+
+protected:
+    /** Formats come from the V4L2DeviceCache, which enumerates
+        them for the first context that asks */
+    virtual void loadFormats() override;
 };
 
 #endif
\ No newline at end of file
@@ -38,12 +38,14 @@
 #include <sys/mman.h>
 #include <memory.h>
 #include <string>
+#include <chrono>
 #include "scopedptr.h"
 
 #include "platformdeviceinfo.h"
 #include "platformstream.h"
 #include "platformcontext.h"
 #include "yuvconverters.h"
+#include "capturereactor.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
@@ -320,7 +322,7 @@ void captureThreadFunctionAsync(PlatformStream *stream, int fd, size_t bufferSiz
         }
 
         //assert(buf.index < nBuffers);
-        stream->threadSubmitBuffer(helper->getBufferPointer(buf.index), buf.bytesused);
+        stream->threadSubmitBuffer(helper->getBufferPointer(buf.index), buf.bytesused, &buf);
 
         // re-queue the buffer
         if (xioctl(fd, VIDIOC_QBUF, &buf) == -1)
@@ -344,7 +346,9 @@ void captureThreadFunctionAsync(PlatformStream *stream, int fd, size_t bufferSiz
 PlatformStream::PlatformStream() : 
     Stream(),
     m_quitThread(false),
-    m_helperThread(nullptr)
+    m_helperThread(nullptr),
+    m_useReactor(false),
+    m_recording(false)
 {
 
 }
@@ -361,9 +365,9 @@ void PlatformStream::close()
     m_owner = nullptr;
     m_width = 0;
     m_height = 0;
-    m_frameBuffer.resize(0);
     m_isOpen = false; 
     m_quitThread = true;
+    notifyFrameWaiters();
 
     if (m_helperThread != nullptr)
     {
@@ -374,6 +378,17 @@ void PlatformStream::close()
         m_helperThread = nullptr;
     }
 
+    if (m_useReactor)
+    {
+        CaptureReactor::instance().removeStream(this);
+        m_useReactor = false;
+    }
+
+    // the capture thread has stopped writing,
+    // so the buffers can go.
+    allocateFrameBuffers(0);
+    stopRecording();
+
     ::close(m_deviceHandle);
 
     m_deviceHandle = -1;    
@@ -484,17 +499,30 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
         return false;
     }    
 
-    // set the (max) size of the frame buffer in Stream class
-    //
-    // Note: we only support 24-bit per pixel RGB
-    // buffers for now!
-    m_frameBuffer.resize(m_width*m_height*3);
+    if (!allocateOutputBuffers())
+    {
+        close();
+        return false;
+    }
 
     m_isOpen = true;
 
     // create the helper thread to read from the device
     m_quitThread = false;
 
+    if ((m_captureFlags & CAPSTREAM_SHAREDTHREAD) != 0)
+    {
+        // let the shared epoll thread dequeue our buffers
+        if (!CaptureReactor::instance().addStream(this, m_deviceHandle, 8))
+        {
+            LOG(LOG_ERR, "Could not add the stream to the capture reactor\n");
+            close();
+            return false;
+        }
+        m_useReactor = true;
+        return true;
+    }
+
     // for now, assume we always have streaming driver support
 #ifdef __V4L2_NO_STREAMNING_SUPPORT
     m_helperThread = new std::thread(&captureThreadFunction, this,
@@ -528,25 +556,127 @@ V4L2_PIX_FMT_SBGGR8  BA81
 
 //#define FRAMEDUMP
 
-void PlatformStream::threadSubmitBuffer(void *ptr, size_t bytes)
+void PlatformStream::threadSubmitBuffer(void *ptr, size_t bytes, const v4l2_buffer *buf)
 {
     if (ptr != nullptr) 
     {
-        switch(m_fmt.fmt.pix.pixelformat)
+        if (buf != nullptr)
+        {
+            // V4L2 timestamps are CLOCK_MONOTONIC for virtually all
+            // capture drivers (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+            uint64_t timestampUs = static_cast<uint64_t>(buf->timestamp.tv_sec)*1000000 + buf->timestamp.tv_usec;
+            setFrameMetadata(timestampUs, buf->sequence);
+        }
+
+        const uint8_t *src = (const uint8_t*)ptr;
+
+        if (m_recording)
+        {
+            // the lock is only ever contended by start/stopRecording
+            std::lock_guard<std::mutex> lock(m_recordMutex);
+            if (buf != nullptr)
+            {
+                m_recorder.write(src, bytes, static_cast<uint64_t>(buf->timestamp.tv_sec)*1000000 + buf->timestamp.tv_usec,
+                    buf->sequence);
+            }
+            else
+            {
+                auto now = std::chrono::steady_clock::now().time_since_epoch();
+                m_recorder.write(src, bytes, std::chrono::duration_cast<std::chrono::microseconds>(now).count(),
+                    getFrameCount());
+            }
+        }
+        const uint32_t pixFormat = m_fmt.fmt.pix.pixelformat;
+
+        YUVFrame frame;
+        frame.width  = m_width;
+        frame.height = m_height;
+
+        switch(pixFormat)
         {
         case V4L2_PIX_FMT_RGB24:
-            Stream::submitBuffer((uint8_t*)ptr, bytes);
+            {
+                // only a whole, unscaled and unpadded frame can be handed over as is,
+                // everything else is resampled through m_geometry
+                const uint32_t stride = (m_fmt.fmt.pix.bytesperline != 0) ? m_fmt.fmt.pix.bytesperline : m_width*3;
+                if (isFullFrame() && (m_scaleDenom == 1) && (stride == m_width*3) &&
+                    (getOutputFormat() != CAPOUTPUT_Y8))
+                {
+                    submitRGB(src, bytes);
+                    break;
+                }
+                if (bytes < stride*m_height)
+                {
+                    LOG(LOG_WARNING, "ThreadSubmitBuffer: short RGB frame (%d bytes)\n", bytes);
+                    break;
+                }
+                if (getOutputFormat() == CAPOUTPUT_Y8)
+                {
+                    RGB2Y(src, stride, m_geometry, backBuffer());
+                }
+                else if (getOutputFormat() == CAPOUTPUT_RGBAF32)
+                {
+                    RGB2RGBAF(src, stride, m_geometry, reinterpret_cast<float*>(backBuffer()));
+                }
+                else
+                {
+                    RGB2RGB(src, stride, m_geometry, backBuffer());
+                }
+                publishFrame();
+            }
             break;
         case V4L2_PIX_FMT_YUYV:
             // here we implement our own ::submitBuffer replacement
-            // so we can decode the 16-bit YUYV frames and copy the 24-bit
-            // RGB pixels into m_frameBuffer
-            m_bufferMutex.lock();
-            YUYV2RGB((const uint8_t*)ptr, &m_frameBuffer[0], bytes);
-            m_newFrame = true;
-            m_frames++;
-            m_bufferMutex.unlock();
-            break;            
+            // so we can decode the 16-bit YUYV frames straight into
+            // the back buffer
+            frame.layout     = YUVLayout::YUYV;
+            frame.planes[0]  = src;
+            frame.strides[0] = (m_fmt.fmt.pix.bytesperline != 0) ? m_fmt.fmt.pix.bytesperline : m_width*2;
+            if (bytes < frame.strides[0]*m_height)
+            {
+                LOG(LOG_WARNING, "ThreadSubmitBuffer: short YUYV frame (%d bytes)\n", bytes);
+                break;
+            }
+            submitYUV(frame);
+            break;
+        case V4L2_PIX_FMT_NV12:
+            {
+                const uint32_t stride = (m_fmt.fmt.pix.bytesperline != 0) ? m_fmt.fmt.pix.bytesperline : m_width;
+                frame.layout     = YUVLayout::NV12;
+                frame.planes[0]  = src;
+                frame.strides[0] = stride;
+                frame.planes[1]  = src + stride*m_height;
+                frame.strides[1] = stride;
+                if (bytes < stride*m_height + stride*((m_height+1)/2))
+                {
+                    LOG(LOG_WARNING, "ThreadSubmitBuffer: short NV12 frame (%d bytes)\n", bytes);
+                    break;
+                }
+                submitYUV(frame);
+            }
+            break;
+        case V4L2_PIX_FMT_YUV420:   // YU12 / I420
+        case V4L2_PIX_FMT_YVU420:   // YV12, same with U and V swapped
+            {
+                const uint32_t stride = (m_fmt.fmt.pix.bytesperline != 0) ? m_fmt.fmt.pix.bytesperline : m_width;
+                const uint32_t chromaStride = (stride+1)/2;
+                const uint32_t chromaBytes  = chromaStride*((m_height+1)/2);
+                const bool swapUV = (pixFormat == V4L2_PIX_FMT_YVU420);
+                frame.layout     = YUVLayout::I420;
+                frame.planes[0]  = src;
+                frame.strides[0] = stride;
+                frame.planes[swapUV ? 2 : 1] = src + stride*m_height;
+                frame.planes[swapUV ? 1 : 2] = src + stride*m_height + chromaBytes;
+                frame.strides[1] = chromaStride;
+                frame.strides[2] = chromaStride;
+                if (bytes < stride*m_height + 2*chromaBytes)
+                {
+                    LOG(LOG_WARNING, "ThreadSubmitBuffer: short YUV420 frame (%d bytes)\n", bytes);
+                    break;
+                }
+                submitYUV(frame);
+            }
+            break;
         case 0x47504A4D:    // MJPG
             #ifdef FRAMEDUMP
             {
@@ -563,15 +693,28 @@ void PlatformStream::threadSubmitBuffer(void *ptr, size_t bytes)
             #endif        
 
             // here we implement our own ::submitBuffer replacement
-            // so we can decode the MJEG frames and copy the 24-bit
-            // RGB pixels into m_frameBuffer
-            m_bufferMutex.lock();
-            if (m_mjpegHelper.decompressFrame((uint8_t*)ptr, bytes, &m_frameBuffer[0], m_width, m_height))
+            // so we can decode the MJEG frames straight into the
+            // 24-bit RGB or luma back buffer
             {
-                m_newFrame = true; 
-                m_frames++;
+                const bool toFloat = (getOutputFormat() == CAPOUTPUT_RGBAF32);
+                const bool gray = (getOutputFormat() == CAPOUTPUT_Y8);
+                uint8_t *out = toFloat ? &m_rgbBuffer[0] : backBuffer();
+                const bool ok = isFullFrame() ?
+                    m_mjpegHelper.decompressFrame(src, bytes, out, getOutputWidth(), getOutputHeight(), m_scaleDenom, gray) :
+                    m_mjpegHelper.decompressRegion(src, bytes, m_geometry, out, gray);
+                if (!ok)
+                {
+                    break;
+                }
+                if (toFloat)
+                {
+                    submitRGB(&m_rgbBuffer[0], m_rgbBuffer.size());
+                }
+                else
+                {
+                    publishFrame();
+                }
             }
-            m_bufferMutex.unlock();
             break;
         default:
             LOG(LOG_DEBUG, "ThreadSubmitBuffer: unsupported format %s (%08X)\n", fourCCToString(m_fmt.fmt.pix.pixelformat).c_str(),
@@ -581,6 +724,153 @@ void PlatformStream::threadSubmitBuffer(void *ptr, size_t bytes)
     }
 }
 
+bool PlatformStream::startRecording(const char *filename, uint32_t frames)
+{
+    if (!m_isOpen)
+    {
+        LOG(LOG_ERR, "startRecording() was called on a closed stream\n");
+        return false;
+    }
+
+    // sizeimage is the largest frame the driver can deliver,
+    // which matters for the compressed formats
+    size_t slotBytes = m_fmt.fmt.pix.sizeimage;
+    if (slotBytes == 0)
+    {
+        slotBytes = m_width*m_height*3;
+    }
+
+    uint32_t fps = 0;
+    v4l2_streamparm sparam;
+    CLEAR(sparam);
+    sparam.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if ((m_deviceHandle >= 0) && (xioctl(m_deviceHandle, VIDIOC_G_PARM, &sparam) != -1) &&
+        (sparam.parm.capture.timeperframe.numerator != 0))
+    {
+        fps = sparam.parm.capture.timeperframe.denominator / sparam.parm.capture.timeperframe.numerator;
+    }
+
+    // create the file outside the lock, it can take a while
+    FrameRingWriter recorder;
+    if (!recorder.create(filename, m_width, m_height, m_fmt.fmt.pix.pixelformat, fps,
+        m_fmt.fmt.pix.bytesperline, slotBytes, frames))
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_recordMutex);
+    m_recorder.swap(recorder);
+    m_recording = true;
+    return true;
+}
+
+void PlatformStream::stopRecording()
+{
+    FrameRingWriter recorder;
+    {
+        std::lock_guard<std::mutex> lock(m_recordMutex);
+        m_recording = false;
+        m_recorder.swap(recorder);
+    }
+    // 'recorder' unmaps the file here, without holding up the capture thread
+}
+
+bool PlatformStream::allocateOutputBuffers()
+{
+    const bool isMJPEG = (m_fmt.fmt.pix.pixelformat == 0x47504A4D);
+
+    // set the (max) size of the frame buffer in Stream class
+    const uint32_t outWidth  = getOutputWidth();
+    const uint32_t outHeight = getOutputHeight();
+    if ((outWidth == 0) || (outHeight == 0))
+    {
+        LOG(LOG_ERR, "Output region is empty\n");
+        return false;
+    }
+
+    m_geometry.cropX      = getRegionX();
+    m_geometry.cropY      = getRegionY();
+    m_geometry.cropWidth  = getRegionWidth();
+    m_geometry.cropHeight = getRegionHeight();
+    m_geometry.outWidth   = outWidth;
+    m_geometry.outHeight  = outHeight;
+
+    allocateFrameBuffers(outWidth*outHeight*getOutputBytesPerPixel());
+    if ((getOutputFormat() == CAPOUTPUT_RGBAF32) && isMJPEG)
+    {
+        m_rgbBuffer.resize(outWidth*outHeight*3);
+    }
+    return true;
+}
+
+void PlatformStream::submitYUV(const YUVFrame &frame)
+{
+    if (getOutputFormat() == CAPOUTPUT_Y8)
+    {
+        YUV2Y(frame, m_geometry, backBuffer());
+    }
+    else if (getOutputFormat() == CAPOUTPUT_RGBAF32)
+    {
+        YUV2RGBAF(frame, m_geometry, reinterpret_cast<float*>(backBuffer()));
+    }
+    else
+    {
+        YUV2RGB(frame, m_geometry, backBuffer());
+    }
+    publishFrame();
+}
+
+void PlatformStream::submitRGB(const uint8_t *rgb, size_t bytes)
+{
+    if (getOutputFormat() == CAPOUTPUT_RGBAF32)
+    {
+        const uint32_t pixels = getOutputWidth()*getOutputHeight();
+        if (bytes < pixels*3)
+        {
+            LOG(LOG_WARNING, "ThreadSubmitBuffer: short RGB frame (%d bytes)\n", bytes);
+            return;
+        }
+        RGB2RGBAF(rgb, reinterpret_cast<float*>(backBuffer()), pixels);
+        publishFrame();
+    }
+    else
+    {
+        Stream::submitBuffer(rgb, bytes);
+    }
+}
+
+bool PlatformStream::setOutputScale(uint32_t denom)
+{
+    if ((denom != 1) && (denom != 2) && (denom != 4) && (denom != 8))
+    {
+        return false;
+    }
+    m_scaleDenom = denom;
+    return true;
+}
+
+bool PlatformStream::setOutputRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    uint32_t outWidth, uint32_t outHeight)
+{
+    m_regionX         = x;
+    m_regionY         = y;
+    m_regionWidth     = width;
+    m_regionHeight    = height;
+    m_regionOutWidth  = outWidth;
+    m_regionOutHeight = outHeight;
+    return true;
+}
+
+bool PlatformStream::setOutputFormat(uint32_t format)
+{
+    if ((format != CAPOUTPUT_RGB24) && (format != CAPOUTPUT_RGBAF32) && (format != CAPOUTPUT_Y8))
+    {
+        return false;
+    }
+    m_outputFormat = format;
+    return true;
+}
+
 bool PlatformStream::setFrameRate(uint32_t fps)
 {    
     struct v4l2_streamparm param;
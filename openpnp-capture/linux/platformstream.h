@@ -35,10 +35,13 @@
 #include <vector>
 #include <mutex>
 #include <thread>
+#include <atomic>
 #include <linux/videodev2.h>
 #include "../common/logging.h"
 #include "../common/stream.h"
 #include "mjpeghelper.h"
+#include "yuvconverters.h"
+#include "framering.h"
 
 
 class Context;          // pre-declaration
@@ -134,6 +137,21 @@ public:
 
     virtual bool setFrameRate(uint32_t fps) override;
 
+    /** Linux supports 24-bit RGB, float RGBA and 8-bit luma output */
+    virtual bool setOutputFormat(uint32_t format) override;
+
+    /** Linux supports 1/2, 1/4 and 1/8 scaling */
+    virtual bool setOutputScale(uint32_t denom) override;
+
+    /** Linux crops and resamples in the conversion pass */
+    virtual bool setOutputRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+        uint32_t outWidth, uint32_t outHeight) override;
+
+    /** Record the raw V4L2 frames into a FrameRingWriter file */
+    virtual bool startRecording(const char *filename, uint32_t frames) override;
+
+    virtual void stopRecording() override;
+
     /** called by the capture thread/function to query if it
         should quit */
     bool getThreadQuitState() const
@@ -144,14 +162,31 @@ public:
     /** public submit buffer so the capture thread/function
         can access it. In additon, this function handles any 
         conversion to RGB output buffers, if necessary */
-    void threadSubmitBuffer(void *ptr, size_t bytes);
+    void threadSubmitBuffer(void *ptr, size_t bytes, const v4l2_buffer *buf = nullptr);
 
 protected:
+    /** allocate the frame buffers for m_width x m_height frames with
+        the fourcc in m_fmt, in the requested output format and scale */
+    bool allocateOutputBuffers();
+
+    /** convert a YUV frame into the back buffer, in the output format */
+    void submitYUV(const YUVFrame &frame);
+
+    /** copy/expand an RGB24 frame into the back buffer, in the RGB24 or RGBAF32 output format */
+    void submitRGB(const uint8_t *rgb, size_t bytes);
+
     int         m_deviceHandle;     ///< V4L2 device handle
     v4l2_format m_fmt;              ///< V4L2 frame format
-    bool        m_quitThread;       ///< if true, captureThreadFunction should return
+    std::atomic<bool> m_quitThread; ///< if true, captureThreadFunction should return
     std::thread *m_helperThread;    ///< helper object threading control
+    bool        m_useReactor;       ///< the stream is serviced by the CaptureReactor instead of m_helperThread
     MJPEGHelper m_mjpegHelper;      ///< helper to convert MJPEG stream to RGB
+    std::vector<uint8_t> m_rgbBuffer; ///< RGB24 scratch frame, for MJPEG decoding to float output
+    FrameGeometry m_geometry;       ///< region and output size, resolved by allocateOutputBuffers
+
+    std::atomic<bool> m_recording;  ///< m_recorder is open, checked without taking the lock
+    std::mutex  m_recordMutex;      ///< protects m_recorder against start/stopRecording
+    FrameRingWriter m_recorder;     ///< raw frame ring, see startRecording
 };
 
 #endif
\ No newline at end of file
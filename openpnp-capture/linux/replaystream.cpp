@@ -0,0 +1,337 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    File-backed replay capture device
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "replaystream.h"
+#include "../common/context.h"
+
+Stream* replayDeviceInfo::createStream() const
+{
+    return new ReplayStream();
+}
+
+ReplayStream::ReplayStream() :
+    PlatformStream(),
+    m_fps(0)
+{
+    m_deviceHandle = -1;
+}
+
+ReplayStream::~ReplayStream()
+{
+    close();
+}
+
+void ReplayStream::close()
+{
+    m_quitThread = true;
+    notifyPickupWaiters();
+    if (m_replayThread.joinable())
+    {
+        m_replayThread.join();
+    }
+
+    m_data.clear();
+    m_spans.clear();
+    m_ring.close();
+
+    PlatformStream::close();
+}
+
+bool ReplayStream::setFrameRate(uint32_t fps)
+{
+    m_fps = fps;
+    return true;
+}
+
+bool ReplayStream::open(Context *owner, deviceInfo *device, uint32_t width, uint32_t height, 
+    uint32_t fourCC, uint32_t fps)
+{
+    if (m_isOpen)
+    {
+        LOG(LOG_INFO,"open() was called on an active stream.\n");
+        close();
+    }
+
+    replayDeviceInfo *dinfo = dynamic_cast<replayDeviceInfo*>(device);
+    if ((owner == nullptr) || (dinfo == nullptr))
+    {
+        LOG(LOG_ERR,"ReplayStream::open() needs an owner and a replay device\n");
+        return false;
+    }
+
+    // the conversion code only looks at the fourcc and bytesperline
+    memset(&m_fmt, 0, sizeof(m_fmt));
+    m_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    m_fmt.fmt.pix.width       = width;
+    m_fmt.fmt.pix.height      = height;
+    m_fmt.fmt.pix.pixelformat = fourCC;
+
+    if (!loadFrames(dinfo->m_devicePath, fourCC))
+    {
+        return false;
+    }
+
+    if (m_ring.getFrameCount() != 0)
+    {
+        const FrameRingHeader &header = m_ring.header();
+        if ((header.width != width) || (header.height != height) || (header.fourcc != fourCC))
+        {
+            LOG(LOG_ERR, "ReplayStream: %s holds %dx%d %s frames\n", dinfo->m_devicePath.c_str(),
+                header.width, header.height, fourCCToString(header.fourcc).c_str());
+            close();
+            return false;
+        }
+        m_fmt.fmt.pix.bytesperline = header.bytesPerLine;
+        m_fmt.fmt.pix.sizeimage    = header.slotBytes;
+    }
+
+    m_owner  = owner;
+    m_frames = 0;
+    m_width  = width;
+    m_height = height;
+    m_fps    = fps;
+
+    if (!allocateOutputBuffers())
+    {
+        close();
+        return false;
+    }
+
+    LOG(LOG_INFO, "Replaying %d frames of %s (%dx%d %s) at %d fps\n", m_spans.size(),
+        dinfo->m_devicePath.c_str(), width, height, fourCCToString(fourCC).c_str(), fps);
+
+    m_isOpen = true;
+    m_quitThread = false;
+    m_replayThread = std::thread(&ReplayStream::replayFunction, this);
+    return true;
+}
+
+bool ReplayStream::loadFrames(const std::string &path, uint32_t fourCC)
+{
+    m_data.clear();
+    m_spans.clear();
+
+    if (FrameRingReader::isFrameRing(path))
+    {
+        if (!m_ring.open(path))
+        {
+            return false;
+        }
+        for(uint32_t i=0; i<m_ring.getFrameCount(); i++)
+        {
+            const FrameRingSlot *slot = m_ring.getFrame(i);
+            if (slot != nullptr)
+            {
+                m_spans.push_back(FrameSpan{0, slot->bytes, slot});
+            }
+        }
+        if (m_spans.empty())
+        {
+            LOG(LOG_ERR, "ReplayStream: no frames found in %s\n", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // a directory holds one frame per file
+    std::vector<std::string> files;
+    DIR *dir = opendir(path.c_str());
+    if (dir != nullptr)
+    {
+        dirent *entry;
+        while((entry = readdir(dir)) != nullptr)
+        {
+            std::string fname = path + "/" + entry->d_name;
+            struct stat st;
+            if ((stat(fname.c_str(), &st) == 0) && S_ISREG(st.st_mode))
+            {
+                files.push_back(fname);
+            }
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+    }
+    else
+    {
+        files.push_back(path);
+    }
+
+    for(auto const &fname : files)
+    {
+        FILE *fin = fopen(fname.c_str(), "rb");
+        if (fin == nullptr)
+        {
+            LOG(LOG_ERR, "ReplayStream: cannot open %s\n", fname.c_str());
+            continue;
+        }
+        fseek(fin, 0, SEEK_END);
+        const long bytes = ftell(fin);
+        fseek(fin, 0, SEEK_SET);
+
+        const size_t offset = m_data.size();
+        m_data.resize(offset + (bytes > 0 ? bytes : 0));
+        if ((bytes > 0) && (fread(&m_data[offset], 1, bytes, fin) == static_cast<size_t>(bytes)))
+        {
+            if (dir != nullptr)
+            {
+                m_spans.push_back(FrameSpan{offset, static_cast<size_t>(bytes), nullptr});
+            }
+            else
+            {
+                splitFrames(offset, bytes, fourCC);
+            }
+        }
+        fclose(fin);
+    }
+
+    if (m_spans.empty())
+    {
+        LOG(LOG_ERR, "ReplayStream: no frames found in %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ReplayStream::splitFrames(size_t offset, size_t bytes, uint32_t fourCC)
+{
+    const size_t end = offset + bytes;
+
+    if (fourCC == V4L2_PIX_FMT_MJPEG)
+    {
+        // walk the JPEG markers: SOI, segments, entropy coded data, EOI
+        size_t pos = offset;
+        while(pos + 2 <= end)
+        {
+            if ((m_data[pos] != 0xFF) || (m_data[pos+1] != 0xD8))
+            {
+                pos++;
+                continue;
+            }
+
+            const size_t start = pos;
+            pos += 2;
+            bool done = false;
+            while(!done && (pos + 2 <= end))
+            {
+                if (m_data[pos] != 0xFF)
+                {
+                    pos++;  // entropy coded data
+                    continue;
+                }
+                const uint8_t marker = m_data[pos+1];
+                if ((marker == 0x00) || (marker == 0xFF) || ((marker >= 0xD0) && (marker <= 0xD7)))
+                {
+                    pos++;  // stuffed byte, fill byte or restart marker
+                }
+                else if (marker == 0xD9)
+                {
+                    pos += 2;
+                    m_spans.push_back(FrameSpan{start, pos - start, nullptr});
+                    done = true;
+                }
+                else if (pos + 4 <= end)
+                {
+                    // a segment with a length; skip it
+                    pos += 2 + ((m_data[pos+2] << 8) | m_data[pos+3]);
+                }
+                else
+                {
+                    break;  // truncated
+                }
+            }
+        }
+        return;
+    }
+
+    size_t frameBytes = 0;
+    switch(fourCC)
+    {
+    case V4L2_PIX_FMT_RGB24:
+        frameBytes = m_fmt.fmt.pix.width*m_fmt.fmt.pix.height*3;
+        break;
+    case V4L2_PIX_FMT_YUYV:
+        frameBytes = m_fmt.fmt.pix.width*m_fmt.fmt.pix.height*2;
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YVU420:
+        frameBytes = m_fmt.fmt.pix.width*m_fmt.fmt.pix.height*3/2;
+        break;
+    default:
+        LOG(LOG_ERR, "ReplayStream: cannot split %s dumps\n", fourCCToString(fourCC).c_str());
+        return;
+    }
+
+    for(size_t pos = offset; pos + frameBytes <= end; pos += frameBytes)
+    {
+        m_spans.push_back(FrameSpan{pos, frameBytes, nullptr});
+    }
+}
+
+void ReplayStream::replayFunction()
+{
+    auto next = std::chrono::steady_clock::now();
+    size_t index = 0;
+    while(!m_quitThread)
+    {
+        if (m_fps != 0)
+        {
+            next += std::chrono::microseconds(1000000 / m_fps);
+            std::this_thread::sleep_until(next);
+        }
+
+        const FrameSpan &span = m_spans[index];
+        if (span.slot != nullptr)
+        {
+            if (m_fps == 0)
+            {
+                // hand over every recorded frame: wait until
+                // the consumer has picked up the previous one
+                while(!m_quitThread && !waitForPickup(100, m_quitThread))
+                {
+                    // woken up by lockFrame, or by close()
+                }
+            }
+            setFrameMetadata(span.slot->timestampUs, span.slot->sequence);
+            threadSubmitBuffer((void*)(span.slot + 1), span.bytes);
+        }
+        else
+        {
+            threadSubmitBuffer(&m_data[span.offset], span.bytes);
+        }
+        index = (index + 1) % m_spans.size();
+    }
+}
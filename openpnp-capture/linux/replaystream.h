@@ -0,0 +1,110 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    File-backed replay capture device
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    
+*/
+
+#ifndef linux_replaystream_h
+#define linux_replaystream_h
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include "platformstream.h"
+#include "platformdeviceinfo.h"
+#include "framering.h"
+
+/** A virtual capture device that replays recorded frames.
+
+    m_devicePath is either a directory holding one frame per
+    file (replayed in file name order, e.g. the frame_N.dat files
+    written with FRAMEDUMP) or a single raw dump of concatenated
+    frames. Raw dumps are split on frame size for the uncompressed
+    formats and on JPEG markers for MJPG. It can also be a ring file
+    written by Cap_startRecording, which is memory mapped instead of
+    being loaded.
+
+    Replay devices are listed by the OPENPNP_CAPTURE_REPLAY
+    environment variable, see PlatformContext::addReplayDevices.
+*/
+class replayDeviceInfo : public platformDeviceInfo
+{
+public:
+    virtual Stream* createStream() const override;
+
+protected:
+    /** the format is given when the device is added */
+    virtual void loadFormats() override {}
+};
+
+/** Stream of a replayDeviceInfo. Frames are loaded into memory
+    when the stream is opened and fed to the regular conversion
+    code (threadSubmitBuffer) at the frame rate of the format,
+    looping at the end. A frame rate of 0 replays as fast as
+    frames can be converted, for throughput measurements.
+
+    Ring files keep their recorded timestamps and sequence numbers.
+    At a frame rate of 0 they are replayed as fast as the consumer
+    picks them up, so offline processing sees every frame.
+*/
+class ReplayStream : public PlatformStream
+{
+public:
+    ReplayStream();
+    virtual ~ReplayStream();
+
+    virtual bool open(Context *owner, deviceInfo *device, uint32_t width, uint32_t height, 
+        uint32_t fourCC, uint32_t fps) override;
+
+    virtual void close() override;
+
+    virtual bool setFrameRate(uint32_t fps) override;
+
+protected:
+    /** load all frames of a directory or dump file into m_data */
+    bool loadFrames(const std::string &path, uint32_t fourCC);
+
+    /** split a dump of concatenated frames */
+    void splitFrames(size_t offset, size_t bytes, uint32_t fourCC);
+
+    void replayFunction();
+
+    struct FrameSpan
+    {
+        size_t offset;
+        size_t bytes;
+        const FrameRingSlot *slot;  ///< frame of m_ring, or nullptr for frames in m_data
+    };
+
+    std::vector<uint8_t>    m_data;         ///< all frames, back to back
+    std::vector<FrameSpan>  m_spans;        ///< location of each frame in m_data
+    FrameRingReader         m_ring;         ///< mapped ring file, if replaying one
+    uint32_t                m_fps;          ///< replay rate, 0 = unthrottled
+    std::thread             m_replayThread;
+};
+
+#endif
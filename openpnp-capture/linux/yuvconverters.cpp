@@ -29,48 +29,651 @@
 */
 
 #include "yuvconverters.h"
+#include <vector>
 
-static inline uint8_t clamp(int16_t v)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_SSE2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define YUV_AVX2
+#endif
+#endif
+
+/*
+    BT.601 limited range:
+
+    R = 1.164(Y - 16)                  + 1.596(V - 128)
+    G = 1.164(Y - 16) - 0.391(U - 128) - 0.813(V - 128)
+    B = 1.164(Y - 16) + 2.018(U - 128)
+
+    All paths use the same 16-bit fixed point arithmetic:
+    inputs are scaled by 128, multiplied with a high-half
+    multiply (>> 16) and the result keeps 2 fractional bits.
+*/
+
+static const int16_t c_yScale = 2384;   // 1.164 * 2048
+static const int16_t c_vToR   = 3269;   // 1.596 * 2048
+static const int16_t c_uToG   = 801;    // 0.391 * 2048
+static const int16_t c_vToG   = 1665;   // 0.813 * 2048
+static const int16_t c_uToB   = 4133;   // 2.018 * 2048
+
+static const float c_byteToFloat = 1.0f / 255.0f;
+
+static inline int32_t mulhi(int32_t a, int32_t b)
+{
+    return (a * b) >> 16;
+}
+
+static inline uint8_t clamp(int32_t v)
 {
     v =  (v > 255) ? 255 : v;
     v =  (v < 0) ? 0 : v;
     return v;
 }
 
-/*
-    In the YUYV2/YUV2 pixel, the order of the fields is:
-    Y0 | Cr | Y1 | Cb ... repeating, which encode two 24-bit pixels.
+static inline void yuvPixel(int32_t y, int32_t u, int32_t v, uint8_t *rgb)
+{
+    int32_t yy = mulhi((y - 16) * 128, c_yScale);
+    int32_t uu = (u - 128) * 128;
+    int32_t vv = (v - 128) * 128;
+    rgb[0] = clamp((yy + mulhi(vv, c_vToR) + 2) >> 2);
+    rgb[1] = clamp((yy - mulhi(uu, c_uToG) - mulhi(vv, c_vToG) + 2) >> 2);
+    rgb[2] = clamp((yy + mulhi(uu, c_uToB) + 2) >> 2);
+}
 
-    perfect:
+static inline uint8_t lumaPixel(int32_t y)
+{
+    return clamp((mulhi((y - 16) * 128, c_yScale) + 2) >> 2);
+}
 
-    B = 1.164(Y - 16)                  + 2.018(U - 128)
-    G = 1.164(Y - 16) - 0.813(V - 128) - 0.391(U - 128)
-    R = 1.164(Y - 16) + 1.596(V - 128)
+// **********************************************************************
+//   Per-layout sample access
+// **********************************************************************
 
-    or:
+struct RowPointers
+{
+    const uint8_t *y;
+    const uint8_t *u;
+    const uint8_t *v;
+};
 
-    R = Y + 1.403V'
-    G = Y - 0.344U' - 0.714V'
-    B = Y + 1.770U'
+static inline RowPointers rowPointers(const YUVFrame &frame, uint32_t row)
+{
+    RowPointers r;
+    r.y = frame.planes[0] + row * frame.strides[0];
+    switch(frame.layout)
+    {
+    case YUVLayout::YUYV:
+        r.u = r.y + 1;
+        r.v = r.y + 3;
+        break;
+    case YUVLayout::NV12:
+        r.u = frame.planes[1] + (row >> 1) * frame.strides[1];
+        r.v = r.u + 1;
+        break;
+    default:
+        r.u = frame.planes[1] + (row >> 1) * frame.strides[1];
+        r.v = frame.planes[2] + (row >> 1) * frame.strides[2];
+        break;
+    }
+    return r;
+}
 
-*/
-void YUYV2RGB(const uint8_t *yuv, uint8_t *rgb, uint32_t bytes)
+/** move the row pointers to pixel x, which must be even */
+template<YUVLayout layout>
+static inline RowPointers offsetRow(RowPointers r, uint32_t x)
 {
-    while(bytes > 3)
+    switch(layout)
     {
-        int16_t y0 = *yuv++;    // Y0
-        int16_t cr = *yuv++;    // Cr (aka U)
-        int16_t y1 = *yuv++;    // Y1
-        int16_t cb = *yuv++;    // Cb (aka V)
+    case YUVLayout::YUYV:
+        r.y += x * 2;
+        r.u += x * 2;
+        r.v += x * 2;
+        break;
+    case YUVLayout::NV12:
+        r.y += x;
+        r.u += x;
+        r.v += x;
+        break;
+    default:
+        r.y += x;
+        r.u += x / 2;
+        r.v += x / 2;
+        break;
+    }
+    return r;
+}
+
+/** the luma and chroma samples of pixel x */
+template<YUVLayout layout>
+static inline void samplePixel(const RowPointers &row, uint32_t x, uint8_t &y, uint8_t &u, uint8_t &v)
+{
+    uint32_t c = x >> 1;
+    switch(layout)
+    {
+    case YUVLayout::YUYV:
+        y = row.y[x * 2];
+        u = row.u[c * 4];
+        v = row.v[c * 4];
+        break;
+    case YUVLayout::NV12:
+        y = row.y[x];
+        u = row.u[c * 2];
+        v = row.v[c * 2];
+        break;
+    default:
+        y = row.y[x];
+        u = row.u[c];
+        v = row.v[c];
+        break;
+    }
+}
+
+template<YUVLayout layout>
+static inline void scalarPixel(const RowPointers &row, uint32_t x, uint8_t *rgb)
+{
+    uint8_t y, u, v;
+    samplePixel<layout>(row, x, y, u, v);
+    yuvPixel(y, u, v, rgb);
+}
+
+// **********************************************************************
+//   SSE2 / AVX2 kernels, 16 pixels at a time
+// **********************************************************************
 
-        int16_t yy0 = 19*(y0 - 16); 
-        int16_t yy1 = 19*(y1 - 16); 
-        *rgb++ = clamp((yy0                 + 32*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy0 - 13*(cr - 128) -  6*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy0 + 26*(cr - 128)                ) >> 4);
-        *rgb++ = clamp((yy1                 + 32*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy1 - 13*(cr - 128) -  6*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy1 + 26*(cr - 128)                ) >> 4);
-        bytes -= 4;
+#ifdef YUV_SSE2
+
+/** load 16 luma samples and the 8 chroma pairs that go with them */
+template<YUVLayout layout>
+static inline void loadBlock(const RowPointers &row, uint32_t x, __m128i &y, __m128i &u, __m128i &v)
+{
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    const __m128i zero = _mm_setzero_si128();
+    switch(layout)
+    {
+    case YUVLayout::YUYV:
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(row.y + x * 2));
+            __m128i b = _mm_loadu_si128((const __m128i*)(row.y + x * 2 + 16));
+            y = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+            __m128i uv = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            u = _mm_packus_epi16(_mm_and_si128(uv, lowBytes), zero);
+            v = _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero);
+        }
+        break;
+    case YUVLayout::NV12:
+        {
+            y = _mm_loadu_si128((const __m128i*)(row.y + x));
+            __m128i uv = _mm_loadu_si128((const __m128i*)(row.u + x));
+            u = _mm_packus_epi16(_mm_and_si128(uv, lowBytes), zero);
+            v = _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero);
+        }
+        break;
+    default:
+        y = _mm_loadu_si128((const __m128i*)(row.y + x));
+        u = _mm_loadl_epi64((const __m128i*)(row.u + x / 2));
+        v = _mm_loadl_epi64((const __m128i*)(row.v + x / 2));
+        break;
     }
 }
+
+/** 8 pixels: 16-bit luma and (duplicated) 16-bit chroma to 16-bit RGB */
+static inline void convert8(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i round = _mm_set1_epi16(2);
+    __m128i yy = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), 7), _mm_set1_epi16(c_yScale));
+    __m128i uu = _mm_slli_epi16(_mm_sub_epi16(u, _mm_set1_epi16(128)), 7);
+    __m128i vv = _mm_slli_epi16(_mm_sub_epi16(v, _mm_set1_epi16(128)), 7);
+    yy = _mm_add_epi16(yy, round);
+    r = _mm_srai_epi16(_mm_add_epi16(yy, _mm_mulhi_epi16(vv, _mm_set1_epi16(c_vToR))), 2);
+    g = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(yy, _mm_mulhi_epi16(uu, _mm_set1_epi16(c_uToG))),
+        _mm_mulhi_epi16(vv, _mm_set1_epi16(c_vToG))), 2);
+    b = _mm_srai_epi16(_mm_add_epi16(yy, _mm_mulhi_epi16(uu, _mm_set1_epi16(c_uToB))), 2);
+}
+
+/** 16 pixels of 8-bit Y and 8 8-bit U/V to 8-bit (saturated) R, G and B */
+static inline void convert16_sse2(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i u16 = _mm_unpacklo_epi8(u, zero);
+    __m128i v16 = _mm_unpacklo_epi8(v, zero);
+    __m128i r0, g0, b0, r1, g1, b1;
+    convert8(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi16(u16, u16), _mm_unpacklo_epi16(v16, v16), r0, g0, b0);
+    convert8(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi16(u16, u16), _mm_unpackhi_epi16(v16, v16), r1, g1, b1);
+    r = _mm_packus_epi16(r0, r1);
+    g = _mm_packus_epi16(g0, g1);
+    b = _mm_packus_epi16(b0, b1);
+}
+
+#ifdef YUV_AVX2
+__attribute__((target("avx2")))
+static inline __m128i packLanes(__m256i v)
+{
+    // packus works per 128-bit lane; gather the two valid quadwords
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08));
+}
+
+__attribute__((target("avx2")))
+static inline void convert16_avx2(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i u16 = _mm_unpacklo_epi8(u, zero);
+    __m128i v16 = _mm_unpacklo_epi8(v, zero);
+    __m256i uu = _mm256_set_m128i(_mm_unpackhi_epi16(u16, u16), _mm_unpacklo_epi16(u16, u16));
+    __m256i vv = _mm256_set_m128i(_mm_unpackhi_epi16(v16, v16), _mm_unpacklo_epi16(v16, v16));
+    __m256i yy = _mm256_cvtepu8_epi16(y);
+
+    yy = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(yy, _mm256_set1_epi16(16)), 7), _mm256_set1_epi16(c_yScale));
+    uu = _mm256_slli_epi16(_mm256_sub_epi16(uu, _mm256_set1_epi16(128)), 7);
+    vv = _mm256_slli_epi16(_mm256_sub_epi16(vv, _mm256_set1_epi16(128)), 7);
+    yy = _mm256_add_epi16(yy, _mm256_set1_epi16(2));
+
+    r = packLanes(_mm256_srai_epi16(_mm256_add_epi16(yy, _mm256_mulhi_epi16(vv, _mm256_set1_epi16(c_vToR))), 2));
+    g = packLanes(_mm256_srai_epi16(_mm256_sub_epi16(_mm256_sub_epi16(yy, _mm256_mulhi_epi16(uu, _mm256_set1_epi16(c_uToG))),
+        _mm256_mulhi_epi16(vv, _mm256_set1_epi16(c_vToG))), 2));
+    b = packLanes(_mm256_srai_epi16(_mm256_add_epi16(yy, _mm256_mulhi_epi16(uu, _mm256_set1_epi16(c_uToB))), 2));
+}
+#endif
+
+/** 16 limited range luma samples to full range, as lumaPixel */
+static inline __m128i expandLuma16(__m128i y)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi16(16);
+    const __m128i scale = _mm_set1_epi16(c_yScale);
+    const __m128i round = _mm_set1_epi16(2);
+    __m128i lo = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), offset), 7), scale);
+    __m128i hi = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), offset), 7), scale);
+    lo = _mm_srai_epi16(_mm_add_epi16(lo, round), 2);
+    hi = _mm_srai_epi16(_mm_add_epi16(hi, round), 2);
+    return _mm_packus_epi16(lo, hi);
+}
+
+static inline void storeRGB(uint8_t *rgb, __m128i r, __m128i g, __m128i b)
+{
+    // SSE2 has no byte shuffle, interleave through the cache
+    uint8_t rr[16], gg[16], bb[16];
+    _mm_storeu_si128((__m128i*)rr, r);
+    _mm_storeu_si128((__m128i*)gg, g);
+    _mm_storeu_si128((__m128i*)bb, b);
+    for(uint32_t i=0; i<16; i++)
+    {
+        *rgb++ = rr[i];
+        *rgb++ = gg[i];
+        *rgb++ = bb[i];
+    }
+}
+
+static inline void storeRGBAF(float *rgba, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(c_byteToFloat);
+    __m128i rw[2] = { _mm_unpacklo_epi8(r, zero), _mm_unpackhi_epi8(r, zero) };
+    __m128i gw[2] = { _mm_unpacklo_epi8(g, zero), _mm_unpackhi_epi8(g, zero) };
+    __m128i bw[2] = { _mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero) };
+    for(uint32_t h=0; h<2; h++)
+    {
+        for(uint32_t q=0; q<2; q++)
+        {
+            __m128i r32 = q ? _mm_unpackhi_epi16(rw[h], zero) : _mm_unpacklo_epi16(rw[h], zero);
+            __m128i g32 = q ? _mm_unpackhi_epi16(gw[h], zero) : _mm_unpacklo_epi16(gw[h], zero);
+            __m128i b32 = q ? _mm_unpackhi_epi16(bw[h], zero) : _mm_unpacklo_epi16(bw[h], zero);
+            __m128 rf = _mm_mul_ps(_mm_cvtepi32_ps(r32), scale);
+            __m128 gf = _mm_mul_ps(_mm_cvtepi32_ps(g32), scale);
+            __m128 bf = _mm_mul_ps(_mm_cvtepi32_ps(b32), scale);
+            __m128 af = _mm_set1_ps(1.0f);
+            _MM_TRANSPOSE4_PS(rf, gf, bf, af);
+            _mm_storeu_ps(rgba + 0, rf);
+            _mm_storeu_ps(rgba + 4, gf);
+            _mm_storeu_ps(rgba + 8, bf);
+            _mm_storeu_ps(rgba + 12, af);
+            rgba += 16;
+        }
+    }
+}
+
+#endif
+
+// **********************************************************************
+//   Row converters
+// **********************************************************************
+
+static inline void writePixel(uint8_t *&out, const uint8_t *rgb)
+{
+    *out++ = rgb[0];
+    *out++ = rgb[1];
+    *out++ = rgb[2];
+}
+
+static inline void writePixel(float *&out, const uint8_t *rgb)
+{
+    *out++ = rgb[0] * c_byteToFloat;
+    *out++ = rgb[1] * c_byteToFloat;
+    *out++ = rgb[2] * c_byteToFloat;
+    *out++ = 1.0f;
+}
+
+#ifdef YUV_SSE2
+static inline void writeBlock(uint8_t *&out, __m128i r, __m128i g, __m128i b)
+{
+    storeRGB(out, r, g, b);
+    out += 16 * 3;
+}
+
+static inline void writeBlock(float *&out, __m128i r, __m128i g, __m128i b)
+{
+    storeRGBAF(out, r, g, b);
+    out += 16 * 4;
+}
+#endif
+
+enum class Kernel
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+template<YUVLayout layout, Kernel kernel, typename T>
+static void convertRow(const RowPointers &row, uint32_t width, T *out)
+{
+    uint32_t x = 0;
+#ifdef YUV_SSE2
+    if (kernel == Kernel::SSE2)
+    {
+        for(; x + 16 <= width; x += 16)
+        {
+            __m128i y, u, v, r, g, b;
+            loadBlock<layout>(row, x, y, u, v);
+            convert16_sse2(y, u, v, r, g, b);
+            writeBlock(out, r, g, b);
+        }
+    }
+#endif
+    for(; x < width; x++)
+    {
+        uint8_t rgb[3];
+        scalarPixel<layout>(row, x, rgb);
+        writePixel(out, rgb);
+    }
+}
+
+#ifdef YUV_AVX2
+template<YUVLayout layout, Kernel kernel, typename T>
+__attribute__((target("avx2")))
+static void convertRowAVX2(const RowPointers &row, uint32_t width, T *out)
+{
+    uint32_t x = 0;
+    for(; x + 16 <= width; x += 16)
+    {
+        __m128i y, u, v, r, g, b;
+        loadBlock<layout>(row, x, y, u, v);
+        convert16_avx2(y, u, v, r, g, b);
+        writeBlock(out, r, g, b);
+    }
+    for(; x < width; x++)
+    {
+        uint8_t rgb[3];
+        scalarPixel<layout>(row, x, rgb);
+        writePixel(out, rgb);
+    }
+}
+#endif
+
+static Kernel bestKernel()
+{
+#if defined(YUV_AVX2)
+    static const Kernel k = __builtin_cpu_supports("avx2") ? Kernel::AVX2 : Kernel::SSE2;
+    return k;
+#elif defined(YUV_SSE2)
+    return Kernel::SSE2;
+#else
+    return Kernel::Scalar;
+#endif
+}
+
+template<YUVLayout layout, typename T>
+static inline void dispatchRow(Kernel kernel, const RowPointers &rp, uint32_t width, T *dst)
+{
+    switch(kernel)
+    {
+#ifdef YUV_AVX2
+    case Kernel::AVX2:
+        convertRowAVX2<layout, Kernel::AVX2>(rp, width, dst);
+        break;
+#endif
+    case Kernel::SSE2:
+        convertRow<layout, Kernel::SSE2>(rp, width, dst);
+        break;
+    default:
+        convertRow<layout, Kernel::Scalar>(rp, width, dst);
+        break;
+    }
+}
+
+template<YUVLayout layout, typename T>
+static void convertFrame(const YUVFrame &frame, const FrameGeometry &geometry, T *out, uint32_t channels)
+{
+    const Kernel kernel = bestKernel();
+    const uint32_t outWidth = geometry.outWidth;
+    const bool resampleX = (outWidth != geometry.cropWidth);
+
+    // Horizontally resampled rows are gathered into an I420 row first,
+    // taking the chroma of every even output pixel, so the conversion
+    // itself still runs 16 pixels at a time.
+    std::vector<uint32_t> columns;
+    std::vector<uint8_t> gathered;
+    if (resampleX)
+    {
+        columns.resize(outWidth);
+        for(uint32_t x=0; x<outWidth; x++)
+        {
+            columns[x] = sampleCoord(x, geometry.cropX, geometry.cropWidth, outWidth);
+        }
+        gathered.resize(outWidth + 2*((outWidth+1)/2));
+    }
+
+    for(uint32_t row=0; row<geometry.outHeight; row++)
+    {
+        RowPointers rp = rowPointers(frame, sampleCoord(row, geometry.cropY, geometry.cropHeight, geometry.outHeight));
+        T *dst = out + row * outWidth * channels;
+        if (!resampleX)
+        {
+            dispatchRow<layout>(kernel, offsetRow<layout>(rp, geometry.cropX), outWidth, dst);
+            continue;
+        }
+
+        uint8_t *y = &gathered[0];
+        uint8_t *u = y + outWidth;
+        uint8_t *v = u + (outWidth+1)/2;
+        for(uint32_t x=0; x<outWidth; x++)
+        {
+            uint8_t cu, cv;
+            samplePixel<layout>(rp, columns[x], y[x], cu, cv);
+            if ((x & 1) == 0)
+            {
+                u[x >> 1] = cu;
+                v[x >> 1] = cv;
+            }
+        }
+        RowPointers gr = {y, u, v};
+        dispatchRow<YUVLayout::I420>(kernel, gr, outWidth, dst);
+    }
+}
+
+/** luma of one row, 'y' points at the first luma sample of the row */
+template<YUVLayout layout>
+static void lumaRow(const uint8_t *y, uint32_t width, uint8_t *out)
+{
+    const uint32_t step = (layout == YUVLayout::YUYV) ? 2 : 1;
+    uint32_t x = 0;
+#ifdef YUV_SSE2
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for(; x + 16 <= width; x += 16)
+    {
+        __m128i l;
+        if (layout == YUVLayout::YUYV)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(y + x * 2));
+            __m128i b = _mm_loadu_si128((const __m128i*)(y + x * 2 + 16));
+            l = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+        }
+        else
+        {
+            l = _mm_loadu_si128((const __m128i*)(y + x));
+        }
+        _mm_storeu_si128((__m128i*)(out + x), expandLuma16(l));
+    }
+#endif
+    for(; x < width; x++)
+    {
+        out[x] = lumaPixel(y[x * step]);
+    }
+}
+
+template<YUVLayout layout>
+static void lumaFrame(const YUVFrame &frame, const FrameGeometry &geometry, uint8_t *out)
+{
+    const uint32_t step = (layout == YUVLayout::YUYV) ? 2 : 1;
+    const uint32_t outWidth = geometry.outWidth;
+    const bool resampleX = (outWidth != geometry.cropWidth);
+
+    std::vector<uint32_t> columns;
+    std::vector<uint8_t> gathered;
+    if (resampleX)
+    {
+        columns.resize(outWidth);
+        for(uint32_t x=0; x<outWidth; x++)
+        {
+            columns[x] = step * sampleCoord(x, geometry.cropX, geometry.cropWidth, outWidth);
+        }
+        gathered.resize(outWidth);
+    }
+
+    for(uint32_t row=0; row<geometry.outHeight; row++)
+    {
+        const uint32_t srcRow = sampleCoord(row, geometry.cropY, geometry.cropHeight, geometry.outHeight);
+        const uint8_t *y = frame.planes[0] + srcRow * frame.strides[0];
+        uint8_t *dst = out + row * outWidth;
+        if (!resampleX)
+        {
+            lumaRow<layout>(y + geometry.cropX * step, outWidth, dst);
+            continue;
+        }
+        for(uint32_t x=0; x<outWidth; x++)
+        {
+            gathered[x] = y[columns[x]];
+        }
+        lumaRow<YUVLayout::I420>(&gathered[0], outWidth, dst);
+    }
+}
+
+template<typename T, typename Write>
+static void resampleRGB(const uint8_t *rgb, uint32_t stride, const FrameGeometry &geometry, T *out, Write write)
+{
+    std::vector<uint32_t> columns(geometry.outWidth);
+    for(uint32_t x=0; x<geometry.outWidth; x++)
+    {
+        columns[x] = 3*sampleCoord(x, geometry.cropX, geometry.cropWidth, geometry.outWidth);
+    }
+
+    for(uint32_t row=0; row<geometry.outHeight; row++)
+    {
+        const uint8_t *src = rgb + sampleCoord(row, geometry.cropY, geometry.cropHeight, geometry.outHeight) * stride;
+        for(uint32_t x=0; x<geometry.outWidth; x++)
+        {
+            write(out, src + columns[x]);
+        }
+    }
+}
+
+template<typename T>
+static void convertFrame(const YUVFrame &frame, const FrameGeometry &geometry, T *out, uint32_t channels)
+{
+    switch(frame.layout)
+    {
+    case YUVLayout::YUYV:
+        convertFrame<YUVLayout::YUYV>(frame, geometry, out, channels);
+        break;
+    case YUVLayout::NV12:
+        convertFrame<YUVLayout::NV12>(frame, geometry, out, channels);
+        break;
+    case YUVLayout::I420:
+        convertFrame<YUVLayout::I420>(frame, geometry, out, channels);
+        break;
+    }
+}
+
+void YUV2RGB(const YUVFrame &frame, uint8_t *rgb)
+{
+    convertFrame(frame, FrameGeometry::full(frame.width, frame.height), rgb, 3);
+}
+
+void YUV2RGB(const YUVFrame &frame, const FrameGeometry &geometry, uint8_t *rgb)
+{
+    convertFrame(frame, geometry, rgb, 3);
+}
+
+void YUV2RGBAF(const YUVFrame &frame, float *rgba)
+{
+    convertFrame(frame, FrameGeometry::full(frame.width, frame.height), rgba, 4);
+}
+
+void YUV2RGBAF(const YUVFrame &frame, const FrameGeometry &geometry, float *rgba)
+{
+    convertFrame(frame, geometry, rgba, 4);
+}
+
+void YUV2Y(const YUVFrame &frame, const FrameGeometry &geometry, uint8_t *luma)
+{
+    switch(frame.layout)
+    {
+    case YUVLayout::YUYV:
+        lumaFrame<YUVLayout::YUYV>(frame, geometry, luma);
+        break;
+    default:
+        lumaFrame<YUVLayout::I420>(frame, geometry, luma);
+        break;
+    }
+}
+
+void RGB2RGB(const uint8_t *rgb, uint32_t stride, const FrameGeometry &geometry, uint8_t *out)
+{
+    resampleRGB(rgb, stride, geometry, out, [](uint8_t *&o, const uint8_t *p) { writePixel(o, p); });
+}
+
+void RGB2RGBAF(const uint8_t *rgb, uint32_t stride, const FrameGeometry &geometry, float *rgba)
+{
+    resampleRGB(rgb, stride, geometry, rgba, [](float *&o, const uint8_t *p) { writePixel(o, p); });
+}
+
+void RGB2Y(const uint8_t *rgb, uint32_t stride, const FrameGeometry &geometry, uint8_t *luma)
+{
+    // BT.601 weights in 8-bit fixed point
+    resampleRGB(rgb, stride, geometry, luma, [](uint8_t *&o, const uint8_t *p)
+    {
+        *o++ = static_cast<uint8_t>((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+    });
+}
+
+void RGB2RGBAF(const uint8_t *rgb, float *rgba, uint32_t pixels)
+{
+    for(uint32_t i=0; i<pixels; i++)
+    {
+        writePixel(rgba, rgb);
+        rgb += 3;
+    }
+}
+
+void YUYV2RGB(const uint8_t *yuv, uint8_t *rgb, uint32_t bytes)
+{
+    YUVFrame frame;
+    frame.layout = YUVLayout::YUYV;
+    frame.planes[0] = yuv;
+    frame.strides[0] = bytes & ~3u;
+    frame.width = bytes / 2;
+    frame.width &= ~1u;
+    frame.height = 1;
+    YUV2RGB(frame, rgb);
+}
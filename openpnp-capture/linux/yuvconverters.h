@@ -33,6 +33,106 @@
 
 #include <stdint.h>
 
+/** Memory layouts of the YUV frames we can convert.
+    All of them subsample the chroma 2x horizontally. */
+enum class YUVLayout
+{
+    YUYV,   ///< packed 4:2:2, Y0 U Y1 V
+    NV12,   ///< 4:2:0, Y plane followed by an interleaved UV plane
+    I420    ///< 4:2:0, separate Y, U and V planes (YU12; YV12 with U/V swapped)
+};
+
+/** Describes a YUV frame in memory.
+    For YUYV only planes[0]/strides[0] are used, NV12 uses
+    planes[0..1] and I420 uses all three planes.
+    Strides are in bytes.
+*/
+struct YUVFrame
+{
+    YUVLayout       layout;
+    const uint8_t*  planes[3];
+    uint32_t        strides[3];
+    uint32_t        width;
+    uint32_t        height;
+};
+
+/** The region of a frame to convert and the size to convert it to.
+
+    Every output pixel takes the source pixel nearest to its centre,
+    so source pixels outside the region or between the samples are
+    never read, let alone converted.
+*/
+struct FrameGeometry
+{
+    uint32_t cropX;         ///< left edge of the region, even for the YUV layouts
+    uint32_t cropY;         ///< top edge of the region
+    uint32_t cropWidth;     ///< width of the region
+    uint32_t cropHeight;    ///< height of the region
+    uint32_t outWidth;      ///< width of the converted frame
+    uint32_t outHeight;     ///< height of the converted frame
+
+    /** The whole frame, unscaled */
+    static FrameGeometry full(uint32_t width, uint32_t height)
+    {
+        FrameGeometry g = {0, 0, width, height, width, height};
+        return g;
+    }
+
+    /** true if the region is resampled, rather than only cropped */
+    bool isScaled() const
+    {
+        return (outWidth != cropWidth) || (outHeight != cropHeight);
+    }
+};
+
+/** Convert a YUV frame to 24-bit RGB (BT.601, limited range).
+    Uses SSE2 or AVX2 when available; all paths give
+    bit-identical results.
+*/
+void YUV2RGB(const YUVFrame &frame, uint8_t *rgb);
+
+/** Convert the region 'geometry' of a YUV frame to 24-bit RGB of
+    geometry.outWidth x geometry.outHeight pixels. Cropping costs
+    nothing; when resampling, the sampled luma and chroma of each
+    output row are gathered first and converted by the same SIMD
+    kernels, with one chroma pair per two output pixels.
+*/
+void YUV2RGB(const YUVFrame &frame, const FrameGeometry &geometry, uint8_t *rgb);
+
+/** Convert a YUV frame to 32-bit float RGBA in [0..1], alpha = 1,
+    in a single pass (no intermediate RGB24 frame).
+*/
+void YUV2RGBAF(const YUVFrame &frame, float *rgba);
+
+/** Float RGBA version of YUV2RGB with a geometry */
+void YUV2RGBAF(const YUVFrame &frame, const FrameGeometry &geometry, float *rgba);
+
+/** Extract the luma of a YUV frame region as 8-bit full range gray,
+    the value YUV2RGB gives R, G and B for neutral chroma. Only the
+    Y samples are read; the chroma is never touched.
+*/
+void YUV2Y(const YUVFrame &frame, const FrameGeometry &geometry, uint8_t *luma);
+
+/** Expand 24-bit RGB to 32-bit float RGBA in [0..1], alpha = 1 */
+void RGB2RGBAF(const uint8_t *rgb, float *rgba, uint32_t pixels);
+
+/** Crop/resample a 24-bit RGB frame with 'stride' bytes per row */
+void RGB2RGB(const uint8_t *rgb, uint32_t stride, const FrameGeometry &geometry, uint8_t *out);
+
+/** Crop/resample a 24-bit RGB frame to 32-bit float RGBA */
+void RGB2RGBAF(const uint8_t *rgb, uint32_t stride, const FrameGeometry &geometry, float *rgba);
+
+/** Crop/resample a 24-bit RGB frame to 8-bit BT.601 luma */
+void RGB2Y(const uint8_t *rgb, uint32_t stride, const FrameGeometry &geometry, uint8_t *luma);
+
+/** Source coordinate sampled by output coordinate 'o' when 'srcSize'
+    pixels starting at 'srcStart' are resampled to 'outSize' pixels */
+static inline uint32_t sampleCoord(uint32_t o, uint32_t srcStart, uint32_t srcSize, uint32_t outSize)
+{
+    return srcStart + static_cast<uint32_t>((static_cast<uint64_t>(2*o + 1) * srcSize) / (2 * static_cast<uint64_t>(outSize)));
+}
+
+/** Convert a packed YUYV buffer of 'bytes' bytes to 24-bit RGB */
 void YUYV2RGB(const uint8_t *yuv, uint8_t *rgb, uint32_t bytes);
 
-#endif
\ No newline at end of file
+#endif
@@ -136,6 +136,7 @@ void PlatformStream::close()
 
     m_fourCC = 0;
     m_isOpen = false;
+    notifyFrameWaiters();
     m_device = nullptr; // note: we don't own the device object!
 }
 
@@ -223,7 +224,7 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
     m_width = width;
     m_height = height;
     m_owner = owner;
-    m_frameBuffer.resize(m_width*m_height*3);
+    allocateFrameBuffers(m_width*m_height*3);
     m_tmpBuffer.resize(m_width*m_height*3);
 
     AVCaptureVideoDataOutput* output = [AVCaptureVideoDataOutput new];
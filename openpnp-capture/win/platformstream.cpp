@@ -163,8 +163,9 @@ void PlatformStream::close()
     m_owner = nullptr;
     m_width = 0;
     m_height = 0;
-    m_frameBuffer.resize(0);
+    allocateFrameBuffers(0);
     m_isOpen = false;
+    notifyFrameWaiters();
 }
 
 
@@ -477,7 +478,7 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
 
             //FIXME: for now, just set the frame buffer size to
             //       width*height*3 for 24 RGB raw images
-            m_frameBuffer.resize(m_width*m_height*3);
+            allocateFrameBuffers(m_width*m_height*3);
         }
         CoTaskMemFree( info->pbFormat );
     }
@@ -849,11 +850,9 @@ bool PlatformStream::getAutoProperty(uint32_t propID, bool &enabled)
 
 void PlatformStream::submitBuffer(const uint8_t *ptr, size_t bytes)
 {
-    m_bufferMutex.lock();
-
-    if (m_frameBuffer.size() == 0)
+    if (frameBufferSize() == 0)
     {
-        LOG(LOG_ERR,"Stream::m_frameBuffer size is 0 - cant store frame buffers!\n");
+        LOG(LOG_ERR,"Stream::m_frameBuffers size is 0 - cant store frame buffers!\n");
     }
 
     // Generate warning every 100 frames if the frame buffer is not
@@ -865,7 +864,7 @@ void PlatformStream::submitBuffer(const uint8_t *ptr, size_t bytes)
         LOG(LOG_WARNING, "Warning: captureFrame received incorrect buffer size (got %d want %d)\n", bytes, wantSize);
     }
 
-    if (bytes <= m_frameBuffer.size())
+    if (bytes <= frameBufferSize())
     {
         // The Win32 API delivers upside-down BGR frames.
         // Conversion to regular RGB frames is done by
@@ -873,7 +872,7 @@ void PlatformStream::submitBuffer(const uint8_t *ptr, size_t bytes)
 
         for(size_t y=0; y<m_height; y++)
         {
-            uint8_t *dst = &m_frameBuffer[(y*m_width)*3];
+            uint8_t *dst = backBuffer() + (y*m_width)*3;
             const uint8_t *src = ptr + (m_width*3)*(m_height-y-1);
             for(uint32_t x=0; x<m_width; x++)
             {
@@ -886,11 +885,8 @@ void PlatformStream::submitBuffer(const uint8_t *ptr, size_t bytes)
             }
         }
 
-        m_newFrame = true;
-        m_frames++;
+        publishFrame();
     }
-
-    m_bufferMutex.unlock();
 }
 
 
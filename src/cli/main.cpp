@@ -0,0 +1,415 @@
+// imgstudio-cli: renders .isp projects without the editor.
+//
+//   imgstudio-cli project.isp -o out.png [-s WxH]
+//   imgstudio-cli project.isp -b <input dir> -i <image node> -o <output dir> [-s WxH] [-j threads]
+//   imgstudio-cli project.isp -q <frame_%05d.png | dir> -i <image node> -o <out_%05d.png | dir> [-d decoders] [-j graphs] [-e encoders]
+//
+// In batch mode every image of the input directory is put into the given
+// ImageNode (its id or the name of the file it was saved with) and the
+// result is written as a PNG of the same name to the output directory.
+// Without a size, batch results have the size of their input.
+//
+// Results are PNGs unless -f picks a faster format for handing them to
+// another tool (QOI, PPM, PAM or TGA) or one that keeps the float output
+// (PFM, 16 bit PNG); single renders go by the extension. PFMs can be fed
+// back in as inputs without losing precision.
+//
+// Sequence mode does the same for a sequence of frames, as a pipeline:
+// decoding, graph evaluation and encoding run on their own threads and hand
+// the frames over through bounded queues, so the disk and the codecs work
+// while the graph does. Each stage gets as many workers as it needs to keep
+// up, the summary at the end shows which one limits the frame rate.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <chrono>
+
+#include <omp.h>
+
+#include "image.h"
+#include "../nodes/node_logic.h"
+#include "../nodes/nodes.hpp"
+#include "../nodes/image_export.h"
+#include "pipeline.h"
+
+struct Options {
+	std::string project, output, batch, sequence, input;
+	int width{ 0 }, height{ 0 };
+	int threads{ 0 };
+	int decoders{ 0 }, encoders{ 0 };	// sequence mode
+	std::string format;
+	int compression{ 6 };
+};
+
+static void usage() {
+	std::cerr <<
+		"usage: imgstudio-cli <project.isp> -o <out.png> [-s WxH]\n"
+		"       imgstudio-cli <project.isp> -b <input dir> -i <image node> -o <output dir> [-s WxH] [-j threads]\n"
+		"       imgstudio-cli <project.isp> -q <frame_%05d.png | dir> -i <image node> -o <out_%05d.png | dir>\n"
+		"                     [-s WxH] [-d decoders] [-j graphs] [-e encoders]\n"
+		"\n"
+		"  -o  output file, or directory (or numbered pattern) in batch and sequence mode\n"
+		"  -s  render size, default 320x240 (batch, sequence: the input size)\n"
+		"  -b  render every image of a directory\n"
+		"  -q  render a frame sequence: a numbered pattern or a directory, in order\n"
+		"  -i  ImageNode the batch images go into: its id or the name of its file\n"
+		"  -j  images rendered at once, default one per core (sequence: 1 graph using all cores)\n"
+		"  -d  sequence decoding threads, default a quarter of the cores\n"
+		"  -e  sequence encoding threads, default half of the cores\n"
+		"  -f  output format: png, png16, pfm, qoi, ppm, pam or tga (default: the extension of -o, or png)\n"
+		"  -z  PNG compression, 0 (fastest) to 9 (smallest), default 6\n";
+}
+
+static bool parseArgs(int argc, char** argv, Options& opts) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-o" && hasValue) opts.output = argv[++i];
+		else if (arg == "-b" && hasValue) opts.batch = argv[++i];
+		else if (arg == "-q" && hasValue) opts.sequence = argv[++i];
+		else if (arg == "-i" && hasValue) opts.input = argv[++i];
+		else if (arg == "-j" && hasValue) opts.threads = std::atoi(argv[++i]);
+		else if (arg == "-d" && hasValue) opts.decoders = std::atoi(argv[++i]);
+		else if (arg == "-e" && hasValue) opts.encoders = std::atoi(argv[++i]);
+		else if (arg == "-f" && hasValue) opts.format = argv[++i];
+		else if (arg == "-z" && hasValue) opts.compression = std::atoi(argv[++i]);
+		else if (arg == "-s" && hasValue) {
+			if (std::sscanf(argv[++i], "%dx%d", &opts.width, &opts.height) != 2 || opts.width <= 0 || opts.height <= 0) {
+				std::cerr << "Invalid size: " << argv[i] << std::endl;
+				return false;
+			}
+		}
+		else if (!arg.empty() && arg[0] != '-' && opts.project.empty()) opts.project = arg;
+		else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return false;
+		}
+	}
+	if (opts.project.empty() || opts.output.empty()) return false;
+	if (!opts.format.empty() && exportFormat("." + opts.format) == ExportFormat::PNG && opts.format != "png" && opts.format != "png16") {
+		std::cerr << "Unknown format: " << opts.format << std::endl;
+		return false;
+	}
+	if (!opts.batch.empty() && !opts.sequence.empty()) {
+		std::cerr << "Batch and sequence mode can't be combined" << std::endl;
+		return false;
+	}
+	if ((!opts.batch.empty() || !opts.sequence.empty()) && opts.input.empty()) {
+		std::cerr << "Batch and sequence mode need the ImageNode to substitute (-i)" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+static bool loadProject(const std::string& path, Json& json) {
+	std::ifstream fp(path);
+	if (!fp) return false;
+	try {
+		fp >> json;
+	} catch (const std::exception& e) {
+		std::cerr << path << ": " << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Image nodes are referred to by id or by the file they were saved with
+static ImageNode* findImageNode(NodeSystem& sys, const std::string& name) {
+	for (unsigned int id : sys.nodes()) {
+		ImageNode* node = sys.get<ImageNode>(id);
+		if (!node) continue;
+
+		fs::path file(node->fileName);
+		if (name == std::to_string(id) || name == node->fileName ||
+			name == file.filename().string() || name == file.stem().string())
+		{
+			return node;
+		}
+	}
+	return nullptr;
+}
+
+static ExportOptions exportOptions(const Options& opts, const std::string& path) {
+	ExportOptions ret;
+	ret.format = exportFormat(opts.format.empty() ? path : "." + opts.format);
+	ret.compression = opts.compression;
+	if (opts.format == "png16") ret.depth = 16;
+	return ret;
+}
+
+static bool isImage(const fs::path& path) {
+	static const std::vector<std::string> exts = {
+		".jpg", ".jpeg", ".png", ".bmp", ".tga", ".psd", ".hdr", ".gif", ".pic", ".pgm", ".ppm", ".pfm"
+	};
+	std::string ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+	return std::find(exts.begin(), exts.end(), ext) != exts.end();
+}
+
+static bool listImages(const std::string& dir, std::vector<fs::path>& files) {
+	std::error_code ec;
+	for (auto&& entry : fs::directory_iterator(dir, ec)) {
+		if (entry.is_regular_file() && isImage(entry.path())) files.push_back(entry.path());
+	}
+	if (ec) {
+		std::cerr << "Could not read " << dir << ": " << ec.message() << std::endl;
+		return false;
+	}
+	std::sort(files.begin(), files.end());
+	return true;
+}
+
+static std::string formatIndex(const std::string& pattern, int index) {
+	std::vector<char> buf(pattern.size() + 32);
+	std::snprintf(buf.data(), buf.size(), pattern.c_str(), index);
+	return buf.data();
+}
+
+static int render(const Json& project, const Options& opts) {
+	NodeSystem sys;
+	sys.load(project);
+
+	const int w = opts.width > 0 ? opts.width : 320;
+	const int h = opts.height > 0 ? opts.height : 240;
+	if (!exportImage(opts.output, sys.process(PixelData(w, h)), exportOptions(opts, opts.output))) {
+		std::cerr << "Could not write " << opts.output << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+static int batch(const Json& project, const Options& opts) {
+	std::vector<fs::path> files;
+	if (!listImages(opts.batch, files)) return 1;
+
+	std::error_code ec;
+	fs::create_directories(opts.output, ec);
+
+	// Loading is deterministic, so the node has the same id in every copy
+	auto first = std::make_unique<NodeSystem>();
+	first->load(project);
+	ImageNode* input = findImageNode(*first, opts.input);
+	if (!input) {
+		std::cerr << "No image node " << opts.input << " in " << opts.project << std::endl;
+		return 1;
+	}
+	const unsigned int inputId = input->id();
+
+	// One graph per thread, images are spread over the threads. The nodes'
+	// own parallel loops run serially inside, which avoids oversubscription.
+	const int threads = opts.threads > 0 ? opts.threads : omp_get_max_threads();
+	std::vector<std::unique_ptr<NodeSystem>> systems(threads);
+	systems[0] = std::move(first);
+	std::atomic<int> failed{ 0 }, done{ 0 };
+	const ExportOptions format = exportOptions(opts, "");
+
+	#pragma omp parallel for schedule(dynamic) num_threads(threads)
+	for (int i = 0; i < int(files.size()); i++) {
+		auto&& sys = systems[omp_get_thread_num()];
+		if (!sys) {
+			sys = std::make_unique<NodeSystem>();
+			sys->load(project);
+		}
+
+		ImageNode* node = sys->get<ImageNode>(inputId);
+		bool byteExact = false;
+		PixelData image = ImageNode::open(files[i].string(), false, &byteExact);
+		if (image.width() <= 0 || image.height() <= 0) {
+			#pragma omp critical
+			std::cerr << "Could not load " << files[i].string() << std::endl;
+			failed++;
+			continue;
+		}
+		node->setImage(image, byteExact);
+		node->fileName = files[i].string();
+
+		const int w = opts.width > 0 ? opts.width : image.width();
+		const int h = opts.height > 0 ? opts.height : image.height();
+		fs::path out = fs::path(opts.output) / files[i].filename();
+		out.replace_extension(exportExtension(format.format));
+		if (!exportImage(out.string(), sys->process(PixelData(w, h)), format)) {
+			#pragma omp critical
+			std::cerr << "Could not write " << out.string() << std::endl;
+			failed++;
+			continue;
+		}
+
+		int n = ++done;
+		#pragma omp critical
+		std::cout << "[" << n << "/" << files.size() << "] " << out.string() << std::endl;
+	}
+	return failed > 0 ? 1 : 0;
+}
+
+struct Frame {
+	int number{ 0 };
+	fs::path in{}, out{};
+	PixelData image{};
+	bool byteExact{ false };
+};
+
+static int sequence(const Json& project, const Options& opts) {
+	// Numbered patterns start at 0 or 1 and end at the first missing frame
+	std::vector<Frame> frames;
+	if (opts.sequence.find('%') != std::string::npos) {
+		for (int i = 0;; i++) {
+			fs::path file = formatIndex(opts.sequence, i);
+			if (fs::exists(file)) frames.push_back({ i, file });
+			else if (i > 0 || !frames.empty()) break;
+		}
+	} else {
+		std::vector<fs::path> files;
+		if (!listImages(opts.sequence, files)) return 1;
+		for (auto&& file : files) frames.push_back({ int(frames.size()), file });
+	}
+	if (frames.empty()) {
+		std::cerr << "No frames in " << opts.sequence << std::endl;
+		return 1;
+	}
+
+	// Results go to the same number of an output pattern, or by name into a directory
+	const bool outPattern = opts.output.find('%') != std::string::npos;
+	ExportOptions format = exportOptions(opts, outPattern ? opts.output : "");
+	std::error_code ec;
+	fs::create_directories(outPattern ? fs::path(opts.output).parent_path() : fs::path(opts.output), ec);
+	for (auto&& frame : frames) {
+		if (outPattern) {
+			frame.out = formatIndex(opts.output, frame.number);
+		} else {
+			frame.out = fs::path(opts.output) / frame.in.filename();
+			frame.out.replace_extension(exportExtension(format.format));
+		}
+	}
+
+	// By default a single graph uses all cores through its own parallel loops,
+	// and the codecs get workers of their own. PNG strips are spread over the
+	// cores left to each encoder.
+	const int cores = std::max(omp_get_max_threads(), 1);
+	const int graphs = opts.threads > 0 ? opts.threads : 1;
+	const int decoders = opts.decoders > 0 ? opts.decoders : std::max(cores / 4, 1);
+	const int encoders = opts.encoders > 0 ? opts.encoders : std::max(cores / 2, 1);
+	format.threads = std::max(cores / encoders, 1);
+
+	std::vector<std::unique_ptr<NodeSystem>> systems;
+	for (int i = 0; i < graphs; i++) {
+		systems.push_back(std::make_unique<NodeSystem>());
+		systems.back()->load(project);
+	}
+	ImageNode* input = findImageNode(*systems[0], opts.input);
+	if (!input) {
+		std::cerr << "No image node " << opts.input << " in " << opts.project << std::endl;
+		return 1;
+	}
+	const unsigned int inputId = input->id();
+
+	// A couple of frames per consumer keeps everyone busy without
+	// holding more than a handful of decoded frames in memory
+	BoundedQueue<Frame> decoded(graphs * 2), processed(encoders * 2);
+	std::atomic<size_t> next{ 0 };
+	std::atomic<int> failed{ 0 }, done{ 0 };
+	std::mutex printLock;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	Stage decode(decoders), process(graphs), encode(encoders);
+	decode.start([&](int) {
+		for (size_t i = next++; i < frames.size(); i = next++) {
+			Frame frame = std::move(frames[i]);
+			{
+				Stage::Timer timer(decode);
+				frame.image = ImageNode::open(frame.in.string(), false, &frame.byteExact);
+			}
+			if (frame.image.width() <= 0 || frame.image.height() <= 0) {
+				std::lock_guard<std::mutex> lock(printLock);
+				std::cerr << "Could not load " << frame.in.string() << std::endl;
+				failed++;
+				continue;
+			}
+			decoded.push(std::move(frame));
+		}
+	}, [&]() { decoded.close(); });
+
+	process.start([&](int worker) {
+		// The graphs share the cores
+		omp_set_num_threads(std::max(cores / graphs, 1));
+
+		auto&& sys = systems[worker];
+		ImageNode* node = sys->get<ImageNode>(inputId);
+		while (auto frame = decoded.pop()) {
+			{
+				Stage::Timer timer(process);
+				node->setImage(frame->image, frame->byteExact);
+				node->fileName = frame->in.string();
+
+				const int w = opts.width > 0 ? opts.width : frame->image.width();
+				const int h = opts.height > 0 ? opts.height : frame->image.height();
+				frame->image = sys->process(PixelData(w, h));
+			}
+			processed.push(std::move(*frame));
+		}
+	}, [&]() { processed.close(); });
+
+	encode.start([&](int) {
+		while (auto frame = processed.pop()) {
+			bool ok;
+			{
+				Stage::Timer timer(encode);
+				ok = exportImage(frame->out.string(), frame->image, format);
+			}
+
+			std::lock_guard<std::mutex> lock(printLock);
+			if (!ok) {
+				std::cerr << "Could not write " << frame->out.string() << std::endl;
+				failed++;
+				continue;
+			}
+			std::cout << "[" << ++done << "/" << frames.size() << "] " << frame->out.string() << std::endl;
+		}
+	}, nullptr);
+
+	encode.join();
+	process.join();
+	decode.join();
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << done << " frames in " << seconds << "s (" << (seconds > 0.0 ? done / seconds : 0.0) << " fps)" << std::endl;
+
+	// Time a frame spends in each stage, and divided by the stage's workers:
+	// the stage with the highest of the latter sets the pace
+	const int count = std::max(int(done), 1);
+	auto report = [&](const char* name, const Stage& stage) {
+		const double ms = stage.busyMs() / count;
+		std::cout << "  " << name << ": " << ms << " ms/frame, "
+				  << ms / stage.workers() << " ms with " << stage.workers() << " workers" << std::endl;
+	};
+	report("decode ", decode);
+	report("process", process);
+	report("encode ", encode);
+
+	return failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+	Options opts;
+	if (!parseArgs(argc, argv, opts)) {
+		usage();
+		return 2;
+	}
+
+	Json project;
+	if (!loadProject(opts.project, project)) {
+		std::cerr << "Could not open " << opts.project << std::endl;
+		return 1;
+	}
+
+	if (!opts.sequence.empty()) return sequence(project, opts);
+	return opts.batch.empty() ? render(project, opts) : batch(project, opts);
+}
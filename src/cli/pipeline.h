@@ -0,0 +1,104 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+// FIFO between two pipeline stages. push() waits while it is full, so a
+// fast stage can't run ahead of a slow one by more than 'capacity' items;
+// pop() waits while it is empty. Once closed, pop() drains what is left
+// and then returns nothing.
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : m_capacity(std::max<size_t>(capacity, 1)) {}
+
+	void push(T&& item) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_notFull.wait(lock, [this]() { return m_items.size() < m_capacity; });
+		m_items.push_back(std::move(item));
+		m_notEmpty.notify_one();
+	}
+
+	std::optional<T> pop() {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_notEmpty.wait(lock, [this]() { return !m_items.empty() || m_closed; });
+		if (m_items.empty()) return std::nullopt;
+
+		T item = std::move(m_items.front());
+		m_items.pop_front();
+		m_notFull.notify_one();
+		return item;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_closed = true;
+		m_notEmpty.notify_all();
+	}
+
+private:
+	std::mutex m_lock;
+	std::condition_variable m_notEmpty, m_notFull;
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_closed{ false };
+};
+
+// A group of worker threads running the same function. 'finished' runs once,
+// on the last worker to return, which is where the next queue gets closed.
+class Stage {
+public:
+	explicit Stage(int workers) : m_workers(std::max(workers, 1)) {}
+
+	void start(const std::function<void(int)>& work, const std::function<void()>& finished) {
+		auto remaining = std::make_shared<std::atomic<int>>(m_workers);
+		for (int i = 0; i < m_workers; i++) {
+			m_threads.emplace_back([=]() {
+				work(i);
+				if (--(*remaining) == 0 && finished) finished();
+			});
+		}
+	}
+
+	~Stage() { join(); }
+
+	void join() {
+		for (auto&& t : m_threads) {
+			if (t.joinable()) t.join();
+		}
+	}
+
+	// Accumulates the time a worker spends on an item, for the stage summary
+	class Timer {
+	public:
+		explicit Timer(Stage& stage) : m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+		~Timer() {
+			auto d = std::chrono::steady_clock::now() - m_start;
+			m_stage.m_busyUs += std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+		}
+	private:
+		Stage& m_stage;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	// Total time the workers were busy, in milliseconds
+	double busyMs() const { return double(m_busyUs) / 1000.0; }
+	int workers() const { return m_workers; }
+
+private:
+	int m_workers;
+	std::vector<std::thread> m_threads;
+	std::atomic<int64_t> m_busyUs{ 0 };
+};
+
+#endif // PIPELINE_H
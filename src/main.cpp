@@ -1,5 +1,6 @@
 #include <iostream>
 #include <memory>
+#include <cstdio>
 
 #include "widgets/list.h"
 #include "widgets/check.h"
@@ -9,14 +10,13 @@
 #include "widgets/spinner.h"
 #include "widgets/colorpicker.h"
 
-#include "stb_image_write.h"
-
 #include "osdialog/OsDialog.hpp"
 
 #include "image.h"
 #include "application.h"
 #include "nodes/node_logic.h"
 #include "nodes/nodes.hpp"
+#include "nodes/image_export.h"
 #include "node_canvas.h"
 
 #include "filesystem.hpp"
@@ -45,12 +45,22 @@ public:
 
 		spnWidth = gui->get<Spinner>("spnWidth");
 		spnHeight = gui->get<Spinner>("spnHeight");
+		Spinner* spnCompression = gui->get<Spinner>("spnCompression");
+
+		// PNGs keep more of the float output at 16 bits per channel
+		Check* chk16Bit = gui->create<Check>();
+		chk16Bit->text(LL("16 bit PNG"));
+		chk16Bit->bounds().height = 20;
+		chk16Bit->onChecked([=](bool v) { export16Bit = v; });
+		gui->get<Panel>("pnlImage")->add(chk16Bit);
 
 		imgResult = gui->get<ImageView>("imgResult");
 
 		gui->get<Panel>("pnlView")->add(cnv);
 
 		NodeSystem* sys = cnv->system();
+		sys->realTime(true, NodeSystem::Degrade::Resolution);
+		CameraStream::prefetch();
 
 		auto onChange = [=](){ saved = false; };
 
@@ -118,8 +128,219 @@ public:
 						pnlParams->add(sv);
 					} break;
 					case NodeType::WebCam: {
-						spnWidth->value(320);
-						spnHeight->value(240);
+						WebCamNode* n = (WebCamNode*) node;
+
+						// Recordings are not enumerated, list the one the node is using
+						const std::string replay = "replay:";
+						std::vector<std::string> recordings;
+						if (n->format.device.compare(0, replay.size(), replay) == 0) {
+							recordings.push_back(n->format.device.substr(replay.size()));
+						}
+						auto devices = std::make_shared<std::vector<CameraDevice>>(CameraStream::devices(recordings));
+
+						List* dl = gui->create<List>();
+						List* fl = gui->create<List>();
+
+						auto listFormats = [=](int dev) {
+							std::vector<std::string> items;
+							int sel = -1;
+							auto&& fmts = (*devices)[dev].formats;
+							for (size_t i = 0; i < fmts.size(); i++) {
+								auto&& f = fmts[i];
+								items.push_back(
+									std::to_string(f.width) + "x" + std::to_string(f.height) + " " +
+									fourccString(f.fourcc) + " " + std::to_string(f.fps) + "fps"
+								);
+								if (sel == -1 && f.width == n->format.width && f.height == n->format.height &&
+									(n->format.fourcc == 0 || f.fourcc == n->format.fourcc))
+								{
+									sel = int(i);
+								}
+							}
+							fl->list(items);
+							if (sel != -1) fl->selected(sel);
+						};
+
+						auto listDevices = [=]() {
+							std::vector<std::string> names;
+							int dev = 0;
+							for (size_t i = 0; i < devices->size(); i++) {
+								names.push_back((*devices)[i].name);
+								if ((*devices)[i].id == n->format.device) dev = int(i);
+							}
+							dl->list(names);
+							if (!devices->empty()) {
+								dl->selected(dev);
+								listFormats(dev);
+							}
+						};
+						listDevices();
+
+						dl->onSelected([=](int s) {
+							n->format.device = (*devices)[s].id;
+							listFormats(s);
+							process(imgResult, gui, w, h);
+							onChange();
+						});
+						// Switching formats keeps the region and scale
+						auto selectFormat = [=](const CameraFormat& f) {
+							CameraFormat fmt = f;
+							fmt.cropX = n->format.cropX;
+							fmt.cropY = n->format.cropY;
+							fmt.cropWidth = n->format.cropWidth;
+							fmt.cropHeight = n->format.cropHeight;
+							fmt.scale = n->format.scale;
+							fmt.gray = n->format.gray;
+							n->format = fmt;
+						};
+
+						fl->onSelected([=](int s) {
+							selectFormat((*devices)[dl->selected()].formats[s]);
+							spnWidth->value(n->format.width);
+							spnHeight->value(n->format.height);
+							process(imgResult, gui, n->format.width, n->format.height);
+							onChange();
+						});
+						pnlParams->add(dl);
+						pnlParams->add(fl);
+
+						// Cropped and scaled down by the capture library, zero size = up to the edge
+						auto region = std::make_shared<std::array<float, 5>>(std::array<float, 5>{
+							float(n->format.cropX), float(n->format.cropY),
+							float(n->format.cropWidth), float(n->format.cropHeight),
+							n->format.scale
+						});
+						auto regionChanged = [=]() {
+							n->format.cropX = int((*region)[0]);
+							n->format.cropY = int((*region)[1]);
+							n->format.cropWidth = int((*region)[2]);
+							n->format.cropHeight = int((*region)[3]);
+							n->format.scale = (*region)[4];
+							onChange();
+						};
+						const char* regionNames[] = { " Crop X", " Crop Y", " Crop W", " Crop H" };
+						for (int i = 0; i < 4; i++) {
+							Spinner* cs = gui->spinner(
+								&(*region)[i],
+								0.0f, 8192.0f, LL(regionNames[i]), true, regionChanged, 2
+							);
+							Proc(cs);
+							cs->bounds().height = 20;
+							pnlParams->add(cs);
+						}
+						Spinner* ss = gui->spinner(
+							&(*region)[4],
+							0.05f, 1.0f, LL(" Scale"), true, regionChanged, 0.05f
+						);
+						Proc(ss);
+						ss->bounds().height = 20;
+						pnlParams->add(ss);
+
+						// Luma only, for graphs that start with Grayscale/Threshold
+						Check* gc = gui->create<Check>();
+						gc->text(LL("Grayscale"));
+						gc->checked(n->format.gray);
+						gc->bounds().height = 20;
+						gc->onChecked([=](bool v) {
+							n->format.gray = v;
+							process(imgResult, gui, w, h);
+							onChange();
+						});
+						pnlParams->add(gc);
+
+						// Raw frames go to a ring file holding the last 10 seconds
+						Button* btnRecord = gui->create<Button>();
+						btnRecord->text(n->stream() && n->stream()->recording() ? LL("Stop") : LL("Record"));
+						btnRecord->bounds().height = 20;
+						btnRecord->onClick([=](int b, int x, int y) {
+							CameraStream* stream = n->stream();
+							if (!stream) return;
+							if (stream->recording()) {
+								stream->stopRecording();
+								btnRecord->text(LL("Record"));
+								return;
+							}
+
+							auto ret = osd::Dialog::file(
+										osd::DialogAction::SaveFile,
+										".",
+										osd::Filters("Frame Ring:ring")
+							);
+							if (ret.has_value()) {
+								fs::path fp(ret.value());
+								fp.replace_extension(".ring");
+								if (stream->record(fp.string(), 10)) btnRecord->text(LL("Stop"));
+							}
+						});
+						pnlParams->add(btnRecord);
+
+						// The format actually captured, when the stream is open
+						if (CameraStream* stream = n->stream()) {
+							auto&& f = stream->format();
+							char cost[32] = "";
+							if (stream->frameCostMs() > 0.0f) std::snprintf(cost, sizeof(cost), ", %.2fms", stream->frameCostMs());
+
+							Label* lblFormat = gui->create<Label>();
+							lblFormat->text(
+								LL("Capturing") + ": " + std::to_string(f.width) + "x" + std::to_string(f.height) + " " +
+								fourccString(f.fourcc) + " " + std::to_string(f.fps) + "fps" + cost
+							);
+							lblFormat->bounds().height = 20;
+							pnlParams->add(lblFormat);
+						}
+
+						// Recordings replay as fast as the graph processes them
+						Button* btnReplay = gui->create<Button>();
+						btnReplay->text(LL("Open Recording") + "...");
+						btnReplay->bounds().height = 20;
+						btnReplay->onClick([=](int b, int x, int y) {
+							auto ret = osd::Dialog::file(
+										osd::DialogAction::OpenFile,
+										".",
+										osd::Filters("Frame Ring:ring")
+							);
+							if (!ret.has_value() || !fs::exists(fs::path(ret.value()))) return;
+
+							*devices = CameraStream::devices({ ret.value() });
+							auto rec = std::find_if(devices->begin(), devices->end(), [&](const CameraDevice& d) {
+								return d.id == replay + ret.value();
+							});
+							if (rec == devices->end() || rec->formats.empty()) return;
+
+							selectFormat(rec->formats[0]);
+							listDevices();
+							spnWidth->value(n->format.width);
+							spnHeight->value(n->format.height);
+							process(imgResult, gui, n->format.width, n->format.height);
+							onChange();
+						});
+						pnlParams->add(btnReplay);
+
+						// Keeps the preview up with the camera when the graph is too slow
+						Check* rt = gui->create<Check>();
+						rt->text(LL("Real-time"));
+						rt->checked(sys->realTime());
+						rt->bounds().height = 20;
+
+						List* rp = gui->create<List>();
+						rp->list({
+									 LL("Lower Resolution"),
+									 LL("Skip Slow Nodes"),
+									 LL("Reduce Frame Rate")
+						});
+						rp->selected(std::max(int(sys->degrade()) - 1, 0));
+
+						rt->onChecked([=](bool v) {
+							sys->realTime(v, NodeSystem::Degrade(rp->selected() + 1));
+						});
+						rp->onSelected([=](int s) {
+							sys->realTime(sys->realTime(), NodeSystem::Degrade(s + 1));
+						});
+						pnlParams->add(rt);
+						pnlParams->add(rp);
+
+						spnWidth->value(n->format.width);
+						spnHeight->value(n->format.height);
 						process(imgResult, gui, int(spnWidth->value()), int(spnHeight->value()));
 						onChange();
 					} break;
@@ -138,19 +359,20 @@ public:
 							auto ret = osd::Dialog::file(
 										osd::DialogAction::OpenFile,
 										".",
-										osd::Filters("Images:jpg,png,bmp,tga,psd,hdr,gif,pic,pgm,ppm")
+										osd::Filters("Images:jpg,png,bmp,tga,psd,hdr,gif,pic,pgm,ppm,pfm")
 							);
 
 							if (ret.has_value() && fs::exists(fs::path(ret.value()))) {
-								n->image = PixelData(ret.value());
+								bool exact = false;
+								PixelData img = ImageNode::open(ret.value(), true, &exact);
+								n->setImage(img, exact);
+								n->fileName = fs::relative(fs::path(ret.value())).string();
+								lblInfo->text(LL("File") + ": " + (n->fileName.empty() ? LL("<empty>") : n->fileName));
+
 								spnWidth->value(n->image.width());
 								spnHeight->value(n->image.height());
 								process(imgResult, gui, int(spnWidth->value()), int(spnHeight->value()));
 								onChange();
-
-								fs::path rel = fs::relative(fs::path(ret.value()));
-								n->fileName = rel.string();
-								lblInfo->text(LL("File") + ": " + (n->fileName.empty() ? LL("<empty>") : n->fileName));
 							}
 						});
 						pnlParams->add(loadImg);
@@ -190,21 +412,48 @@ public:
 					case NodeType::Convolute: {
 						ConvoluteNode* n = (ConvoluteNode*) node;
 						List* rs = gui->create<List>();
-						rs->list({
-									 LL("Blur (Gaussian)"),
-									 LL("Blur (Box)"),
-									 LL("Sharpen"),
-									 LL("Edges (Gauss)"),
-									 LL("Edges (Laplace)"),
-									 LL("Emboss"),
-									 LL("Emboss (Edges)")
-						});
-						rs->selected(int(n->filter) - 1);
+
+						// "Custom" is only offered once there is a kernel to use
+						auto listFilters = [=]() {
+							std::vector<std::string> items = {
+								LL("Blur (Gaussian)"),
+								LL("Blur (Box)"),
+								LL("Sharpen"),
+								LL("Edges (Gauss)"),
+								LL("Edges (Laplace)"),
+								LL("Emboss"),
+								LL("Emboss (Edges)")
+							};
+							if (n->hasCustomKernel() || n->filter == ConvoluteNode::Filter::Custom) {
+								items.push_back(LL("Custom"));
+							}
+							rs->list(items);
+							rs->selected(int(n->filter) - 1);
+						};
+						listFilters();
+
 						rs->onSelected([=](int s) {
 							n->filter = ConvoluteNode::Filter(s + 1);
 							process(imgResult, gui, w, h);
 						});
 						pnlParams->add(rs);
+
+						Button* btnKernel = gui->create<Button>();
+						btnKernel->text(LL("Load Kernel") + "...");
+						btnKernel->bounds().height = 20;
+						btnKernel->onClick([=](int b, int x, int y) {
+							auto ret = osd::Dialog::file(
+										osd::DialogAction::OpenFile,
+										".",
+										osd::Filters("Kernel:txt,csv")
+							);
+							if (!ret.has_value() || !n->loadKernel(ret.value())) return;
+
+							listFilters();
+							process(imgResult, gui, w, h);
+							onChange();
+						});
+						pnlParams->add(btnKernel);
 					} break;
 					case NodeType::Median: {
 						MedianNode* n = (MedianNode*) node;
@@ -307,6 +556,38 @@ public:
 						rs->bounds().height = 20;
 						pnlParams->add(rs);
 					} break;
+					case NodeType::Equalize: {
+						EqualizeNode* n = (EqualizeNode*) node;
+						List* md = gui->create<List>();
+						md->list({
+									 LL("Equalize"),
+									 LL("Auto Levels")
+						});
+						md->selected(int(n->mode));
+						md->onSelected([=](int s) {
+							n->mode = EqualizeNode::Mode(s);
+							process(imgResult, gui, w, h);
+						});
+						pnlParams->add(md);
+
+						Check* pc = gui->create<Check>();
+						pc->text(LL("Per Channel"));
+						pc->checked(n->perChannel);
+						pc->onChecked([=](bool v) {
+							n->perChannel = v;
+							process(imgResult, gui, w, h);
+						});
+						pc->bounds().height = 20;
+						pnlParams->add(pc);
+
+						Spinner* cl = gui->spinner(
+							&n->clip,
+							0.0f, 0.25f, LL(" Clip"), true, onChange, 0.001f
+						);
+						Proc(cl);
+						cl->bounds().height = 20;
+						pnlParams->add(cl);
+					} break;
 					default: break;
 				}
 			} else {
@@ -336,6 +617,7 @@ public:
 				case 15: cnv->create<DistortNode>(); break;
 				case 16: cnv->create<NormalMapNode>(); break;
 				case 17: cnv->create<GrayscaleNode>(); break;
+				case 18: cnv->create<EqualizeNode>(); break;
 				default: break;
 			}
 			onChange();
@@ -426,24 +708,32 @@ public:
 			auto ret = osd::Dialog::file(
 						osd::DialogAction::SaveFile,
 						".",
-						osd::Filters("PNG Image:png")
+						osd::Filters("PNG Image:png;PFM Image:pfm;QOI Image:qoi;Netpbm Image:ppm,pam;TGA Image:tga")
 			);
 
 			if (ret.has_value()) {
+				// The extension picks the format, PNG if there is none
+				ExportOptions opts;
+				opts.format = exportFormat(ret.value());
+				opts.compression = int(spnCompression->value());
+				opts.depth = export16Bit ? 16 : 8;
+
 				fs::path fp(ret.value());
-				fp.replace_extension(".png");
+				fp.replace_extension(exportExtension(opts.format));
 
 				int w = int(spnWidth->value());
 				int h = int(spnHeight->value());
-				PixelData img = cnv->system()->process(PixelData(w, h));
-				stbi_write_png(fp.string().c_str(), w, h, 4, img.dataCopy().data(), img.width() * 4);
+				exportImage(fp.string(), cnv->system()->process(PixelData(w, h)), opts);
 			}
 		});
 
 	}
 
 	inline void process(ImageView* res, GUI* gui, int w, int h) {
-		PixelData img = cnv->system()->process(PixelData(w, h));
+		show(res, gui, cnv->system()->process(PixelData(w, h)));
+	}
+
+	inline void show(ImageView* res, GUI* gui, const PixelData& img) {
 		if (result) {
 			result.reset();
 		}
@@ -453,10 +743,11 @@ public:
 	}
 
 	inline virtual void onTick(GUI* gui, float dt) override {
-		if (cnv->system()->capturing() && cnv->system()->hasFrame()) {
+		// Only the newest camera frame is processed, whatever came before it is dropped
+		if (cnv->system()->frameDue()) {
 			int w = int(spnWidth->value());
 			int h = int(spnHeight->value());
-			process(imgResult, gui, w, h);
+			show(imgResult, gui, cnv->system()->processFrame(PixelData(w, h)));
 		}
 	}
 
@@ -470,6 +761,7 @@ public:
 
 	std::string currentFileName;
 	bool saved{ false };
+	bool export16Bit{ false };
 };
 
 int main(int argc, char** argv) {
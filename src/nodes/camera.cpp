@@ -0,0 +1,301 @@
+#include "camera.h"
+
+#include <tuple>
+#include <cstdlib>
+#include <algorithm>
+
+std::string fourccString(uint32_t fourcc) {
+	std::string str{};
+	for (uint32_t i = 0; i < 4; i++) {
+		str += (char)(fourcc & 0xFF);
+		fourcc >>= 8;
+	}
+	return str;
+}
+
+static const std::string ReplayPrefix = "replay:";
+
+uint32_t fourccValue(const std::string& str) {
+	if (str.size() != 4) return 0;
+	uint32_t v = 0;
+	for (int i = 3; i >= 0; i--) {
+		v = (v << 8) | uint8_t(str[i]);
+	}
+	return v;
+}
+
+CameraStream::CameraStream(const CameraFormat& format) {
+	// Contexts are not thread safe, so every stream gets its own
+	m_ctx = Cap_createContext();
+	if (!m_ctx) return;
+
+	m_format.cropX = std::max(format.cropX, 0);
+	m_format.cropY = std::max(format.cropY, 0);
+	m_format.cropWidth = std::max(format.cropWidth, 0);
+	m_format.cropHeight = std::max(format.cropHeight, 0);
+	m_format.scale = std::clamp(format.scale, 0.01f, 1.0f);
+	m_format.gray = format.gray;
+
+	if (format.device.compare(0, ReplayPrefix.size(), ReplayPrefix) == 0) {
+		Cap_addReplayDevice(m_ctx, format.device.substr(ReplayPrefix.size()).c_str());
+		m_lossless = true;
+	}
+
+	for (int device = 0; device < int(Cap_getDeviceCount(m_ctx)); device++) {
+		if (format.device.empty() || format.device == Cap_getDeviceUniqueID(m_ctx, device)) {
+			m_device = device;
+			break;
+		}
+	}
+	if (m_device < 0) return;
+
+	// Without a fourcc the library picks the format that is cheapest to convert
+	CapFormatChoice choice;
+	if (format.fourcc == 0 &&
+		Cap_chooseFormat(m_ctx, m_device, format.width, format.height, format.fps,
+						 format.gray ? CAPOUTPUT_Y8 : CAPOUTPUT_RGBAF32, &choice) == CAPRESULT_OK)
+	{
+		m_formatID = choice.formatID;
+		m_format.width = choice.info.width;
+		m_format.height = choice.info.height;
+		m_format.fourcc = choice.info.fourcc;
+		m_format.fps = choice.info.fps;
+		m_format.device = Cap_getDeviceUniqueID(m_ctx, m_device);
+		m_frameCostMs = choice.frameCostMs;
+		return;
+	}
+
+	// Closest size first, then the requested fourcc and frame rate
+	using Score = std::tuple<int64_t, int, int>;
+	Score best{};
+	for (int fid = 0; fid < Cap_getNumFormats(m_ctx, m_device); fid++) {
+		CapFormatInfo finfo;
+		if (Cap_getFormatInfo(m_ctx, m_device, fid, &finfo) != CAPRESULT_OK) continue;
+
+		Score score{
+			std::abs(int64_t(finfo.width) * finfo.height - int64_t(format.width) * format.height),
+			(format.fourcc == 0 || format.fourcc == finfo.fourcc) ? 0 : 1,
+			format.fps == 0 ? 0 : std::abs(int(finfo.fps) - format.fps)
+		};
+		if (m_formatID < 0 || score < best) {
+			best = score;
+			m_formatID = fid;
+			m_format.width = finfo.width;
+			m_format.height = finfo.height;
+			m_format.fourcc = finfo.fourcc;
+			m_format.fps = finfo.fps;
+		}
+	}
+	m_format.device = Cap_getDeviceUniqueID(m_ctx, m_device);
+}
+
+CameraStream::~CameraStream() {
+	stop();
+	if (m_ctx) Cap_releaseContext(m_ctx);
+}
+
+std::string CameraStream::key(const CameraFormat& format) {
+	// Same limits as the constructor, so equivalent requests get the same key
+	return format.device + "/" + std::to_string(format.width) + "x" + std::to_string(format.height) + "/" +
+		std::to_string(format.fourcc) + "/" + std::to_string(format.fps) + "/" +
+		std::to_string(std::max(format.cropX, 0)) + "," + std::to_string(std::max(format.cropY, 0)) + "," +
+		std::to_string(std::max(format.cropWidth, 0)) + "," + std::to_string(std::max(format.cropHeight, 0)) + "@" +
+		std::to_string(std::clamp(format.scale, 0.01f, 1.0f)) + (format.gray ? "/gray" : "");
+}
+
+bool CameraStream::start() {
+	if (!valid() || m_capturing) return m_capturing;
+
+	// Let the capture thread produce float RGBA (or luma) when the platform can.
+	// All cameras share one capture thread and conversion pool where supported.
+	// The crop and scale are applied in the same pass.
+	const int cropX = std::min(m_format.cropX, m_format.width - 1) & ~1;
+	const int cropY = std::min(m_format.cropY, m_format.height - 1);
+	const int cropWidth = m_format.cropWidth > 0 ? std::min(m_format.cropWidth, m_format.width - cropX) : m_format.width - cropX;
+	const int cropHeight = m_format.cropHeight > 0 ? std::min(m_format.cropHeight, m_format.height - cropY) : m_format.height - cropY;
+	CapStreamOptions options{};
+	options.outputFormat = CapOutputFormat(m_format.gray ? CAPOUTPUT_Y8 : CAPOUTPUT_RGBAF32);
+	options.scaleDenom = 1;
+	options.flags = CAPSTREAM_SHAREDTHREAD;
+	options.cropX = uint32_t(cropX);
+	options.cropY = uint32_t(cropY);
+	options.cropWidth = uint32_t(cropWidth);
+	options.cropHeight = uint32_t(cropHeight);
+	options.outputWidth = uint32_t(std::max(int(cropWidth * m_format.scale + 0.5f), 1));
+	options.outputHeight = uint32_t(std::max(int(cropHeight * m_format.scale + 0.5f), 1));
+	m_output = options.outputFormat;
+	m_stream = Cap_openStreamEx(m_ctx, m_device, m_formatID, &options);
+	if (m_stream == -1) {
+		// Platforms without cropping or luma output deliver the whole RGB frame
+		m_output = CAPOUTPUT_RGB24;
+		m_stream = Cap_openStream(m_ctx, m_device, m_formatID);
+	}
+	if (m_stream == -1) return false;
+
+	uint32_t width = m_format.width, height = m_format.height;
+	Cap_getStreamOutputSize(m_ctx, m_stream, &width, &height);
+	m_width = int(width);
+	m_height = int(height);
+	if (!m_format.gray) {
+		m_back.image = PixelData(m_width, m_height);
+		m_ready.image = PixelData(m_width, m_height);
+		m_front.image = PixelData(m_width, m_height);
+	}
+
+	m_capturing = true;
+	m_thread = std::thread(&CameraStream::run, this);
+	return true;
+}
+
+void CameraStream::stop() {
+	stopRecording();
+	{
+		std::lock_guard<std::mutex> lock(m_frameLock);
+		m_capturing = false;
+	}
+	m_acquired.notify_all();
+	if (m_thread.joinable()) m_thread.join();
+	if (m_stream != -1) {
+		Cap_closeStream(m_ctx, m_stream);
+		m_stream = -1;
+	}
+}
+
+bool CameraStream::record(const std::string& path, int seconds) {
+	if (m_stream == -1) return false;
+	const int fps = m_format.fps > 0 ? m_format.fps : 30;
+	m_recording = Cap_startRecording(m_ctx, m_stream, path.c_str(), uint32_t(std::max(seconds, 1) * fps)) == CAPRESULT_OK;
+	return m_recording;
+}
+
+void CameraStream::stopRecording() {
+	if (!m_recording) return;
+	Cap_stopRecording(m_ctx, m_stream);
+	m_recording = false;
+}
+
+void CameraStream::run() {
+	while (m_capturing) {
+		// Leave the library holding the next recorded frame until the graph took this one
+		if (m_lossless) {
+			std::unique_lock<std::mutex> lock(m_frameLock);
+			m_acquired.wait(lock, [this]() { return !m_hasNewFrame || !m_capturing; });
+			if (!m_capturing) break;
+		}
+
+		// Wakes up as soon as the camera delivers a frame, the timeout
+		// only bounds how long stop() waits for this thread
+		const void* frame = nullptr;
+		uint32_t frameBytes = 0;
+		if (Cap_waitForNewFrame(m_ctx, m_stream, 100) != 1 ||
+			Cap_lockFrame(m_ctx, m_stream, &frame, &frameBytes) != CAPRESULT_OK)
+		{
+			continue;
+		}
+
+		// Convert straight out of the borrowed capture buffer, row by row in
+		// parallel, into the back frame nobody else can see until it is published
+		auto&& img = m_back.image;
+		const int w = img.width();
+		if (m_output == CAPOUTPUT_RGBAF32) {
+			const float* pixels = (const float*) frame;
+			const int rows = w > 0 ? std::min(int(frameBytes / 16 / w), img.height()) : 0;
+			#pragma omp parallel for schedule(static)
+			for (int y = 0; y < rows; y++) {
+				const float* row = &pixels[size_t(y) * w * 4];
+				for (int x = 0; x < w; x++) {
+					const float* p = &row[x * 4];
+					img.set(x, y, p[0], p[1], p[2], p[3]);
+				}
+			}
+		} else if (m_output == CAPOUTPUT_Y8) {
+			// The Y plane is kept as it is, one byte per pixel
+			const int count = m_width * m_height;
+			if (int(frameBytes) >= count) {
+				m_back.luma.assign((const unsigned char*) frame, m_width, m_height, m_frames + 1);
+			}
+		} else if (m_format.gray) {
+			const unsigned char* pixels = (const unsigned char*) frame;
+			const int count = std::min(int(frameBytes / 3), m_width * m_height);
+			m_gray.resize(m_width * m_height);
+			#pragma omp parallel for schedule(static)
+			for (int k = 0; k < count; k++) {
+				const unsigned char* p = &pixels[k * 3];
+				m_gray[k] = (unsigned char)(std::min(p[0] * 0.299f + p[1] * 0.587f + p[2] * 0.114f + 0.5f, 255.0f));
+			}
+			m_back.luma.assign(m_gray.data(), m_width, m_height, m_frames + 1);
+		} else {
+			const unsigned char* pixels = (const unsigned char*) frame;
+			const int rows = w > 0 ? std::min(int(frameBytes / 3 / w), img.height()) : 0;
+			#pragma omp parallel for schedule(static)
+			for (int y = 0; y < rows; y++) {
+				const unsigned char* row = &pixels[size_t(y) * w * 3];
+				for (int x = 0; x < w; x++) {
+					const unsigned char* p = &row[x * 3];
+					img.set(x, y, p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f, 1.0f);
+				}
+			}
+		}
+		Cap_getFrameInfo(m_ctx, m_stream, &m_back.info);
+		Cap_releaseFrame(m_ctx, m_stream);
+
+		m_back.number = ++m_frames;
+		{
+			std::lock_guard<std::mutex> lock(m_frameLock);
+			std::swap(m_back, m_ready);
+			m_hasNewFrame = true;
+		}
+	}
+}
+
+bool CameraStream::acquire() {
+	std::lock_guard<std::mutex> lock(m_frameLock);
+	if (m_ready.number <= m_front.number) return false;
+	std::swap(m_ready, m_front);
+	m_hasNewFrame = false;
+	m_acquired.notify_one();
+	return true;
+}
+
+void CameraStream::prefetch() {
+	struct Worker {
+		std::thread thread;
+		~Worker() { if (thread.joinable()) thread.join(); }
+	};
+	static Worker worker;
+	if (!worker.thread.joinable()) {
+		worker.thread = std::thread([]() { devices(); });
+	}
+}
+
+std::vector<CameraDevice> CameraStream::devices(const std::vector<std::string>& recordings) {
+	std::vector<CameraDevice> res;
+	CapContext ctx = Cap_createContext();
+	if (!ctx) return res;
+
+	for (auto&& path : recordings) {
+		Cap_addReplayDevice(ctx, path.c_str());
+	}
+
+	for (int device = 0; device < int(Cap_getDeviceCount(ctx)); device++) {
+		CameraDevice dev{};
+		dev.name = Cap_getDeviceName(ctx, device);
+		dev.id = Cap_getDeviceUniqueID(ctx, device);
+		for (int fid = 0; fid < Cap_getNumFormats(ctx, device); fid++) {
+			CapFormatInfo finfo;
+			if (Cap_getFormatInfo(ctx, device, fid, &finfo) != CAPRESULT_OK) continue;
+
+			CameraFormat fmt{};
+			fmt.device = dev.id;
+			fmt.width = finfo.width;
+			fmt.height = finfo.height;
+			fmt.fourcc = finfo.fourcc;
+			fmt.fps = finfo.fps;
+			dev.formats.push_back(fmt);
+		}
+		res.push_back(dev);
+	}
+
+	Cap_releaseContext(ctx);
+	return res;
+}
@@ -0,0 +1,153 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "image.h"
+#include "luma_plane.h"
+
+extern "C" {
+	#include "../openpnp-capture/include/openpnp-capture.h"
+}
+
+// What a WebCam node asks for. Zero fields are "don't care".
+struct CameraFormat {
+	std::string device{};	// unique ID of the device, empty for the first one
+	int width{ 320 }, height{ 240 };
+	uint32_t fourcc{ 0 };
+	int fps{ 0 };
+
+	// Part of the camera frame that is delivered (0 size = up to the edge) and
+	// the fraction of its size that is kept. Both are applied while the capture
+	// library converts the frame, so the dropped pixels are never converted.
+	int cropX{ 0 }, cropY{ 0 }, cropWidth{ 0 }, cropHeight{ 0 };
+	float scale{ 1.0f };
+
+	// Only the luma is captured, read straight from the camera's Y plane
+	bool gray{ false };
+
+	bool operator==(const CameraFormat& o) const {
+		return device == o.device && width == o.width && height == o.height &&
+				fourcc == o.fourcc && fps == o.fps &&
+				cropX == o.cropX && cropY == o.cropY && cropWidth == o.cropWidth && cropHeight == o.cropHeight &&
+				scale == o.scale && gray == o.gray;
+	}
+	bool operator!=(const CameraFormat& o) const { return !(*this == o); }
+};
+
+struct CameraDevice {
+	std::string name, id;
+	std::vector<CameraFormat> formats;
+};
+
+std::string fourccString(uint32_t fourcc);
+uint32_t fourccValue(const std::string& str);
+
+// One open capture stream and the thread converting its frames.
+// Streams are shared through NodeSystem::camera, so every WebCam node
+// using the same device and format reads the same frame.
+class CameraStream {
+public:
+	// Picks the closest format of the requested device, see valid()
+	explicit CameraStream(const CameraFormat& format);
+	~CameraStream();
+
+	// A device and format matching the request were found
+	bool valid() const { return m_device >= 0 && m_formatID >= 0; }
+
+	// Identifies a device, format and region. The static one works on a request
+	// without opening anything, the other on what this stream actually captures.
+	static std::string key(const CameraFormat& format);
+	std::string key() const { return key(m_format); }
+	// What is captured, which may differ from the request, and the estimated
+	// cost in ms of converting one frame (0 when the fourcc was requested)
+	const CameraFormat& format() const { return m_format; }
+	float frameCostMs() const { return m_frameCostMs; }
+
+	bool start();
+	void stop();
+
+	bool capturing() const { return m_capturing; }
+	// A frame was published that acquire() didn't take yet
+	bool hasFrame() const { return m_hasNewFrame; }
+
+	// Takes the latest frame the capture thread published, if it is newer than
+	// the one being read. frame() and frameInfo() don't change until the next
+	// call, so they must only be used by the thread calling acquire().
+	// Frames published after this call stay pending for the next one.
+	bool acquire();
+
+	// Color frame, empty for gray() streams
+	PixelData& frame() { return m_front.image; }
+
+	// Luma frame of gray() streams, captured without expanding it to RGBA
+	const LumaPlane& luma() const { return m_front.luma; }
+	bool gray() const { return m_format.gray; }
+
+	const CapFrameInfo& frameInfo() const { return m_front.info; }
+	uint64_t frameNumber() const { return m_front.number; }
+
+	// Frames captured so far, including the ones not acquired yet
+	uint64_t frameCount() const { return m_frames; }
+
+	// Records the raw camera frames into a ring file holding the last 'seconds'
+	bool record(const std::string& path, int seconds);
+	void stopRecording();
+	bool recording() const { return m_recording; }
+
+	// The frames only hold k / 255 values, true for 8 bit RGB and luma output
+	bool byteExact() const { return m_output != CAPOUTPUT_RGBAF32; }
+
+	// Every frame is handed over instead of the latest one (replayed recordings)
+	bool lossless() const { return m_lossless; }
+
+	// Recordings replay through the capture library as "replay:<path>" devices,
+	// listed along with the cameras when passed in 'recordings'
+	static std::vector<CameraDevice> devices(const std::vector<std::string>& recordings = {});
+
+	// Enumerates the devices and their formats on a background thread. The
+	// capture library caches them, so later calls to devices() and new
+	// streams don't stall the caller.
+	static void prefetch();
+
+private:
+	void run();
+
+	CapContext m_ctx{ nullptr };
+	CapStream m_stream{ -1 };
+	int m_device{ -1 }, m_formatID{ -1 };
+	CameraFormat m_format;
+	CapOutputFormat m_output{ CAPOUTPUT_RGB24 };
+	float m_frameCostMs{ 0.0f };
+	bool m_recording{ false };
+
+	// Replayed recordings hand over every frame, so the graph
+	// gets to process all of them instead of the latest one
+	bool m_lossless{ false };
+
+	// The capture thread converts into m_back and swaps it with m_ready,
+	// acquire() swaps m_ready with m_front. Only the swaps take m_frameLock.
+	struct Frame {
+		PixelData image;
+		LumaPlane luma;
+		CapFrameInfo info{};
+		uint64_t number{ 0 };
+	};
+	Frame m_back, m_ready, m_front;
+	std::mutex m_frameLock;
+	std::condition_variable m_acquired;	// lossless streams wait on it for the graph
+	std::vector<uint8_t> m_gray;	// luma of RGB frames, for platforms without luma output
+	int m_width{ 0 }, m_height{ 0 };
+
+	std::thread m_thread;
+	std::atomic<bool> m_capturing{ false }, m_hasNewFrame{ false };
+	std::atomic<uint64_t> m_frames{ 0 };
+};
+
+#endif // CAMERA_H
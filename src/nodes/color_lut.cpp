@@ -0,0 +1,102 @@
+#include "color_lut.h"
+
+#include <algorithm>
+
+#include "node_logic.h"
+
+static bool inRange(float v) {
+	return v >= 0.0f && v <= 1.0f;
+}
+
+Color ColorLUT::evaluate(const std::vector<Node*>& stages, Color col) {
+	for (Node* node : stages) col = node->transform(col);
+	return col;
+}
+
+float ColorLUT::sample(const std::vector<float>& lut, float v) {
+	const int last = int(lut.size()) - 1;
+	float f = v * float(last);
+	int i = std::min(int(f), last - 1);
+	float t = f - float(i);
+	return lut[i] + (lut[i + 1] - lut[i]) * t;
+}
+
+void ColorLUT::compile(const std::vector<Node*>& stages, bool byteInput) {
+	auto split = std::find_if(stages.begin(), stages.end(), [](Node* n) {
+		return n->pointwise() == Node::Pointwise::Luma;
+	});
+	std::vector<Node*> pre(stages.begin(), split);
+	std::vector<Node*> post(split, stages.end());
+
+	m_byteInput = byteInput;
+	m_luma = !post.empty();
+
+	// Per-channel stages treat each channel independently, so one gray
+	// sample yields all three tables at once.
+	const int size = byteInput ? ByteSize : FloatSize;
+	for (auto&& lut : m_pre) lut.resize(size);
+	for (int i = 0; i < size; i++) {
+		float v = float(i) / float(size - 1);
+		Color col = evaluate(pre, { v, v, v, 1.0f });
+		m_pre[0][i] = col.r;
+		m_pre[1][i] = col.g;
+		m_pre[2][i] = col.b;
+	}
+
+	for (auto&& lut : m_post) lut.resize(m_luma ? FloatSize : 0);
+	if (m_luma) {
+		for (int i = 0; i < FloatSize; i++) {
+			float v = float(i) / float(FloatSize - 1);
+			Color col = evaluate(post, { v, v, v, 1.0f });
+			m_post[0][i] = col.r;
+			m_post[1][i] = col.g;
+			m_post[2][i] = col.b;
+		}
+	}
+
+	// Stages either pass alpha through or set it to a constant
+	Color probe = evaluate(stages, { 0.5f, 0.5f, 0.5f, 0.5f });
+	m_keepAlpha = probe.a == 0.5f;
+	m_alpha = probe.a;
+}
+
+Color ColorLUT::apply(const std::vector<Node*>& stages, Color col) const {
+	if (!inRange(col.r) || !inRange(col.g) || !inRange(col.b)) {
+		return evaluate(stages, col);
+	}
+
+	float r, g, b;
+	if (m_byteInput) {
+		r = m_pre[0][int(col.r * 255.0f + 0.5f)];
+		g = m_pre[1][int(col.g * 255.0f + 0.5f)];
+		b = m_pre[2][int(col.b * 255.0f + 0.5f)];
+	} else {
+		r = sample(m_pre[0], col.r);
+		g = sample(m_pre[1], col.g);
+		b = sample(m_pre[2], col.b);
+	}
+
+	if (m_luma) {
+		float lm = luma({ r, g, b, 1.0f });
+		if (!inRange(lm)) return evaluate(stages, col);
+		r = sample(m_post[0], lm);
+		g = sample(m_post[1], lm);
+		b = sample(m_post[2], lm);
+	}
+
+	return { r, g, b, m_keepAlpha ? col.a : m_alpha };
+}
+
+PixelData ColorLUT::apply(const std::vector<Node*>& stages, const PixelData& src, int width, int height) const {
+	PixelData out(width, height);
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < width * height; k++) {
+		int x = k % width;
+		int y = k / width;
+		int ix = int((src.width()+0.5f) * (float(x) / width));
+		int iy = int((src.height()+0.5f) * (float(y) / height));
+		Color c = apply(stages, src.get(ix, iy));
+		out.set(x, y, c.r, c.g, c.b, c.a);
+	}
+	return out;
+}
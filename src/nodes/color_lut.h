@@ -0,0 +1,41 @@
+#ifndef COLOR_LUT_H
+#define COLOR_LUT_H
+
+#include <array>
+#include <vector>
+
+#include "image.h"
+
+class Node;
+
+// A run of pointwise nodes compiled into per-channel 1D lookup tables.
+//
+// Per-channel stages before the first luma stage become one table per channel.
+// A luma stage collapses the pixel to a scalar, so every stage after it becomes
+// a second set of tables indexed by that scalar.
+class ColorLUT {
+public:
+	static constexpr int FloatSize = 4096;
+	static constexpr int ByteSize = 256;
+
+	// 'byteInput' means the run is fed with 8-bit values (k / 255), which
+	// allows exact 256 entry tables instead of interpolated ones.
+	void compile(const std::vector<Node*>& stages, bool byteInput);
+
+	// Values outside [0, 1] fall back to evaluating the stages directly.
+	Color apply(const std::vector<Node*>& stages, Color col) const;
+
+	// Samples 'src' the same way a node does and maps it through the tables in one pass.
+	PixelData apply(const std::vector<Node*>& stages, const PixelData& src, int width, int height) const;
+
+	static Color evaluate(const std::vector<Node*>& stages, Color col);
+
+private:
+	static float sample(const std::vector<float>& lut, float v);
+
+	std::array<std::vector<float>, 3> m_pre, m_post;
+	bool m_luma{ false }, m_byteInput{ false }, m_keepAlpha{ true };
+	float m_alpha{ 1.0f };
+};
+
+#endif // COLOR_LUT_H
@@ -0,0 +1,261 @@
+#include "fft.h"
+
+#include <cmath>
+#include <algorithm>
+
+constexpr float Pi = 3.14159265358979323846f;
+
+FFT::FFT(int size) : m_size(size) {
+	int bits = 0;
+	while ((1 << bits) < size) bits++;
+
+	m_reverse.resize(size);
+	for (int i = 0; i < size; i++) {
+		int r = 0;
+		for (int b = 0; b < bits; b++) {
+			if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+		}
+		m_reverse[i] = r;
+	}
+
+	m_twiddles.resize(size / 2);
+	for (int k = 0; k < size / 2; k++) {
+		float a = -2.0f * Pi * float(k) / float(size);
+		m_twiddles[k] = Complex(std::cos(a), std::sin(a));
+	}
+}
+
+void FFT::transform(Complex* data, bool inverse) const {
+	for (int i = 0; i < m_size; i++) {
+		int r = m_reverse[i];
+		if (i < r) std::swap(data[i], data[r]);
+	}
+
+	for (int len = 2; len <= m_size; len <<= 1) {
+		const int half = len / 2;
+		const int step = m_size / len;
+		for (int i = 0; i < m_size; i += len) {
+			for (int j = 0; j < half; j++) {
+				Complex w = m_twiddles[j * step];
+				if (inverse) w = std::conj(w);
+				Complex u = data[i + j];
+				Complex v = data[i + j + half] * w;
+				data[i + j] = u + v;
+				data[i + j + half] = u - v;
+			}
+		}
+	}
+}
+
+RealFFT2D::RealFFT2D(int size)
+	: m_size(size), m_rows(size / 2), m_cols(size)
+{
+	m_split.resize(size / 2 + 1);
+	for (int k = 0; k <= size / 2; k++) {
+		float a = -2.0f * Pi * float(k) / float(size);
+		m_split[k] = Complex(std::cos(a), std::sin(a));
+	}
+}
+
+// Packs even/odd samples into a half-size complex FFT and splits the result
+void RealFFT2D::forwardRow(const float* in, Complex* out, Complex* tmp) const {
+	const int h = m_size / 2;
+	for (int n = 0; n < h; n++) tmp[n] = Complex(in[n * 2], in[n * 2 + 1]);
+	m_rows.transform(tmp, false);
+
+	const Complex mi(0.0f, -0.5f);
+	for (int k = 0; k <= h; k++) {
+		Complex zk = tmp[k % h];
+		Complex zc = std::conj(tmp[(h - k) % h]);
+		Complex even = (zk + zc) * 0.5f;
+		Complex odd = (zk - zc) * mi;
+		out[k] = even + m_split[k] * odd;
+	}
+}
+
+void RealFFT2D::inverseRow(const Complex* in, float* out, Complex* tmp) const {
+	const int h = m_size / 2;
+	const Complex i(0.0f, 1.0f);
+	for (int k = 0; k < h; k++) {
+		Complex xk = in[k];
+		Complex xc = std::conj(in[h - k]);
+		Complex even = (xk + xc) * 0.5f;
+		Complex odd = (xk - xc) * 0.5f * std::conj(m_split[k]);
+		tmp[k] = even + i * odd;
+	}
+	m_rows.transform(tmp, true);
+
+	for (int n = 0; n < h; n++) {
+		out[n * 2] = tmp[n].real();
+		out[n * 2 + 1] = tmp[n].imag();
+	}
+}
+
+void RealFFT2D::columns(Complex* data, bool inverse) const {
+	const int nb = bins();
+	std::vector<Complex> col(m_size);
+	for (int c = 0; c < nb; c++) {
+		for (int r = 0; r < m_size; r++) col[r] = data[r * nb + c];
+		m_cols.transform(col.data(), inverse);
+		for (int r = 0; r < m_size; r++) data[r * nb + c] = col[r];
+	}
+}
+
+void RealFFT2D::forward(const float* in, Complex* out) const {
+	std::vector<Complex> tmp(m_size / 2);
+	for (int y = 0; y < m_size; y++) {
+		forwardRow(in + y * m_size, out + y * bins(), tmp.data());
+	}
+	columns(out, false);
+}
+
+void RealFFT2D::inverse(Complex* in, float* out) const {
+	columns(in, true);
+
+	std::vector<Complex> tmp(m_size / 2);
+	for (int y = 0; y < m_size; y++) {
+		inverseRow(in + y * bins(), out + y * m_size, tmp.data());
+	}
+
+	const float scale = 2.0f / float(m_size * m_size);
+	for (int i = 0; i < m_size * m_size; i++) out[i] *= scale;
+}
+
+int FFTConvolver::plan(int width, int height, int kernelSize) {
+	if (kernelSize <= 1 || width <= 0 || height <= 0) return 0;
+
+	const int pw = width + kernelSize - 1;
+	const int ph = height + kernelSize - 1;
+
+	float best = float(width) * float(height) * float(kernelSize * kernelSize) * SpatialCost;
+	int bestSize = 0;
+	for (int n = 16; n <= 1024; n <<= 1) {
+		// Blocks must be at least as wide as the tile overhang so that
+		// tiles two steps apart never overlap (see convolve).
+		const int block = n - kernelSize + 1;
+		if (block < kernelSize - 1 || block <= 0) continue;
+
+		const float tiles = float((pw + block - 1) / block) * float((ph + block - 1) / block);
+		const float transform = float(n * n) * std::log2(float(n)) * TransformCost;
+		const float cost = tiles * (2.0f * transform + float(n * (n / 2 + 1)));
+		if (cost < best) {
+			best = cost;
+			bestSize = n;
+		}
+	}
+	return bestSize;
+}
+
+void FFTConvolver::kernel(const std::vector<float>& kernel, int kernelSize) {
+	if (kernelSize == m_kernelSize && kernel == m_kernel) return;
+	m_kernel = kernel;
+	m_kernelSize = kernelSize;
+	m_spectra.clear();
+}
+
+const RealFFT2D& FFTConvolver::transform(int fftSize) {
+	auto it = m_transforms.find(fftSize);
+	if (it == m_transforms.end()) {
+		it = m_transforms.emplace(fftSize, RealFFT2D(fftSize)).first;
+	}
+	return it->second;
+}
+
+const std::vector<Complex>& FFTConvolver::spectrum(const RealFFT2D& fft) {
+	auto it = m_spectra.find(fft.size());
+	if (it != m_spectra.end()) return it->second;
+
+	const int n = fft.size();
+	const int k = m_kernelSize;
+
+	// Flip the kernel so the convolution matches the spatial correlation
+	std::vector<float> plane(n * n, 0.0f);
+	for (int y = 0; y < k; y++) {
+		for (int x = 0; x < k; x++) {
+			plane[x + y * n] = m_kernel[(k - 1 - x) + (k - 1 - y) * k];
+		}
+	}
+
+	std::vector<Complex> spec(fft.spectrumSize());
+	fft.forward(plane.data(), spec.data());
+	return m_spectra.emplace(n, std::move(spec)).first->second;
+}
+
+void FFTConvolver::convolve(const float* src, float* dst, int width, int height, int fftSize) {
+	const RealFFT2D& fft = transform(fftSize);
+	const std::vector<Complex>& kspec = spectrum(fft);
+
+	const int n = fftSize;
+	const int k = m_kernelSize;
+	const int m = k / 2;
+	const int block = n - k + 1;
+
+	// Edge-clamped source, padded by the kernel radius
+	const int pw = width + k - 1;
+	const int ph = height + k - 1;
+	std::vector<float> padded(pw * ph);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < ph; y++) {
+		int sy = std::clamp(y - m, 0, height - 1);
+		for (int x = 0; x < pw; x++) {
+			int sx = std::clamp(x - m, 0, width - 1);
+			padded[x + y * pw] = src[sx + sy * width];
+		}
+	}
+
+	// Full linear convolution accumulator
+	const int fw = pw + k - 1;
+	const int fh = ph + k - 1;
+	std::vector<float> acc(fw * fh, 0.0f);
+
+	const int tilesX = (pw + block - 1) / block;
+	const int tilesY = (ph + block - 1) / block;
+
+	// Tile outputs span 'n' pixels but tiles are placed every 'block' pixels,
+	// so only direct neighbours overlap. Processing the four parity classes
+	// one after another lets each class accumulate without locking.
+	for (int phase = 0; phase < 4; phase++) {
+		std::vector<int> tiles;
+		for (int ty = phase / 2; ty < tilesY; ty += 2) {
+			for (int tx = phase % 2; tx < tilesX; tx += 2) {
+				tiles.push_back(tx + ty * tilesX);
+			}
+		}
+
+		#pragma omp parallel
+		{
+			std::vector<float> plane(n * n);
+			std::vector<Complex> spec(fft.spectrumSize());
+
+			#pragma omp for schedule(dynamic)
+			for (int t = 0; t < int(tiles.size()); t++) {
+				const int ox = (tiles[t] % tilesX) * block;
+				const int oy = (tiles[t] / tilesX) * block;
+				const int bw = std::min(block, pw - ox);
+				const int bh = std::min(block, ph - oy);
+
+				std::fill(plane.begin(), plane.end(), 0.0f);
+				for (int y = 0; y < bh; y++) {
+					std::copy_n(&padded[ox + (oy + y) * pw], bw, &plane[y * n]);
+				}
+
+				fft.forward(plane.data(), spec.data());
+				for (int i = 0; i < int(spec.size()); i++) spec[i] *= kspec[i];
+				fft.inverse(spec.data(), plane.data());
+
+				const int ow = std::min(n, fw - ox);
+				const int oh = std::min(n, fh - oy);
+				for (int y = 0; y < oh; y++) {
+					float* row = &acc[ox + (oy + y) * fw];
+					const float* res = &plane[y * n];
+					for (int x = 0; x < ow; x++) row[x] += res[x];
+				}
+			}
+		}
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		std::copy_n(&acc[(k - 1) + (y + k - 1) * fw], width, &dst[y * width]);
+	}
+}
@@ -0,0 +1,83 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include <complex>
+#include <map>
+#include <cstdint>
+
+using Complex = std::complex<float>;
+
+// Radix-2 complex FFT of a fixed power-of-two size (unnormalized)
+class FFT {
+public:
+	FFT() = default;
+	explicit FFT(int size);
+
+	void transform(Complex* data, bool inverse) const;
+
+	int size() const { return m_size; }
+
+private:
+	int m_size{ 0 };
+	std::vector<int> m_reverse;
+	std::vector<Complex> m_twiddles;
+};
+
+// Real-to-complex 2D FFT of a square NxN plane.
+// The spectrum is stored row-major as N rows of (N/2 + 1) bins.
+class RealFFT2D {
+public:
+	RealFFT2D() = default;
+	explicit RealFFT2D(int size);
+
+	void forward(const float* in, Complex* out) const;
+
+	// Destroys the contents of 'in'. The result is normalized.
+	void inverse(Complex* in, float* out) const;
+
+	int size() const { return m_size; }
+	int bins() const { return m_size / 2 + 1; }
+	int spectrumSize() const { return m_size * bins(); }
+
+private:
+	void forwardRow(const float* in, Complex* out, Complex* tmp) const;
+	void inverseRow(const Complex* in, float* out, Complex* tmp) const;
+	void columns(Complex* data, bool inverse) const;
+
+	int m_size{ 0 };
+	FFT m_rows, m_cols;
+	std::vector<Complex> m_split;
+};
+
+// Overlap-add FFT convolution of planar float images with a square kernel.
+// Kernel spectra are cached per transform size and dropped when the kernel changes.
+class FFTConvolver {
+public:
+	// Relative cost of one spatial multiply-add vs one FFT butterfly element.
+	static constexpr float SpatialCost = 1.0f;
+	static constexpr float TransformCost = 2.5f;
+
+	// Picks the FFT size with the lowest estimated cost, or 0 if direct
+	// spatial convolution is estimated to be cheaper.
+	static int plan(int width, int height, int kernelSize);
+
+	// 'kernel' is row-major, kernelSize x kernelSize, applied as a correlation
+	// (same orientation the spatial path uses).
+	void kernel(const std::vector<float>& kernel, int kernelSize);
+
+	// Convolves one channel plane. Samples outside the image are clamped to the edge.
+	void convolve(const float* src, float* dst, int width, int height, int fftSize);
+
+private:
+	const std::vector<Complex>& spectrum(const RealFFT2D& fft);
+	const RealFFT2D& transform(int fftSize);
+
+	std::vector<float> m_kernel;
+	int m_kernelSize{ 0 };
+
+	std::map<int, RealFFT2D> m_transforms;
+	std::map<int, std::vector<Complex>> m_spectra;
+};
+
+#endif // FFT_H
@@ -0,0 +1,72 @@
+#include "histogram.h"
+
+#include <algorithm>
+
+#include "node_logic.h"
+
+int Histogram::bin(float v) {
+	return std::clamp(int(v * float(Bins - 1) + 0.5f), 0, Bins - 1);
+}
+
+void Histogram::compute(const PixelData& img, bool perChannel) {
+	for (auto&& c : m_counts) c.fill(0);
+
+	const int w = img.width();
+	const int h = img.height();
+	m_total = uint64_t(w) * uint64_t(h);
+
+	const int channels = perChannel ? int(ChannelCount) : 1;
+
+	// Each thread fills private bins over whole rows, then merges once
+	#pragma omp parallel
+	{
+		std::array<Counts, ChannelCount> local{};
+
+		#pragma omp for schedule(static) nowait
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				Color col = img.get(x, y);
+				local[Luma][bin(luma(col))]++;
+				if (perChannel) {
+					local[Red][bin(col.r)]++;
+					local[Green][bin(col.g)]++;
+					local[Blue][bin(col.b)]++;
+				}
+			}
+		}
+
+		#pragma omp critical
+		for (int c = 0; c < channels; c++) {
+			for (int i = 0; i < Bins; i++) m_counts[c][i] += local[c][i];
+		}
+	}
+}
+
+std::vector<float> Histogram::normalized(Channel ch) const {
+	std::vector<float> ret(Bins, 0.0f);
+	if (m_total == 0) return ret;
+	for (int i = 0; i < Bins; i++) ret[i] = float(m_counts[ch][i]) / float(m_total);
+	return ret;
+}
+
+std::vector<float> Histogram::cdf(Channel ch) const {
+	std::vector<float> ret(Bins, 0.0f);
+	if (m_total == 0) return ret;
+
+	uint64_t sum = 0;
+	for (int i = 0; i < Bins; i++) {
+		sum += m_counts[ch][i];
+		ret[i] = float(double(sum) / double(m_total));
+	}
+	return ret;
+}
+
+int Histogram::percentile(Channel ch, float fraction) const {
+	const double target = double(fraction) * double(m_total);
+	uint64_t sum = 0;
+	for (int i = 0; i < Bins; i++) {
+		sum += m_counts[ch][i];
+		if (double(sum) >= target && sum > 0) return i;
+	}
+	return Bins - 1;
+}
@@ -0,0 +1,46 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "image.h"
+
+class Histogram {
+public:
+	enum Channel {
+		Luma = 0,
+		Red,
+		Green,
+		Blue,
+		ChannelCount
+	};
+
+	static constexpr int Bins = 256;
+	using Counts = std::array<uint32_t, Bins>;
+
+	// Bins every pixel of 'img' in parallel. The RGB channels are only
+	// binned when 'perChannel' is set, luma is always binned.
+	void compute(const PixelData& img, bool perChannel = false);
+
+	const Counts& counts(Channel ch) const { return m_counts[ch]; }
+	uint64_t total() const { return m_total; }
+
+	// Bin frequencies, normalized by the pixel count
+	std::vector<float> normalized(Channel ch) const;
+
+	// Cumulative distribution, the last bin is 1
+	std::vector<float> cdf(Channel ch) const;
+
+	// First bin at which the cumulative count reaches 'fraction' of the pixels
+	int percentile(Channel ch, float fraction) const;
+
+	static int bin(float v);
+
+private:
+	std::array<Counts, ChannelCount> m_counts{};
+	uint64_t m_total{ 0 };
+};
+
+#endif // HISTOGRAM_H
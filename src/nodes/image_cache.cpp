@@ -0,0 +1,438 @@
+#include "image_cache.h"
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+#include "node_logic.h"
+#include "filesystem.hpp"
+
+namespace fs = ghc::filesystem;
+
+constexpr uint64_t DefaultCacheMB = 1024;
+
+// Entry file: this header, then the pixels row by row as 8 bit RGBA when the
+// image has no more precision than that (most sources), float RGBA otherwise.
+// The header is 32 bytes so the pixels are aligned when the file is mapped.
+struct EntryHeader {
+	char magic[4];
+	uint16_t version;
+	uint16_t depth;		// bytes per channel, 1 or 4
+	uint32_t width, height;
+	uint64_t sourceSize;	// size and content hash of the source file,
+	uint64_t hash;			// checked before the entry is used
+};
+static_assert(sizeof(EntryHeader) == 32, "EntryHeader must stay 32 bytes");
+
+static const char EntryMagic[4] = { 'I', 'S', 'P', 'X' };
+constexpr uint16_t EntryVersion = 2;
+
+// Read-only view of a whole file, mapped where the platform allows it
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path) {
+#ifndef _WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* ptr = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED) {
+				::madvise(ptr, size_t(st.st_size), MADV_SEQUENTIAL);
+				m_data = (const uint8_t*) ptr;
+				m_size = size_t(st.st_size);
+			}
+		}
+		::close(fd);
+#else
+		std::ifstream fp(path, std::ios::binary | std::ios::ate);
+		if (!fp) return;
+		m_copy.resize(size_t(fp.tellg()));
+		fp.seekg(0);
+		if (!fp.read((char*) m_copy.data(), std::streamsize(m_copy.size()))) m_copy.clear();
+		m_data = m_copy.data();
+		m_size = m_copy.size();
+#endif
+	}
+
+	~MappedFile() {
+#ifndef _WIN32
+		if (m_data) ::munmap((void*) m_data, m_size);
+#endif
+	}
+
+	const uint8_t* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	const uint8_t* m_data{ nullptr };
+	size_t m_size{ 0 };
+#ifdef _WIN32
+	std::vector<uint8_t> m_copy;
+#endif
+};
+
+// XXH64 (xxhash.com), a 64 bit hash of the whole content running at memory speed
+namespace xxh64 {
+	constexpr uint64_t P1 = 0x9E3779B185EBCA87ull;
+	constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr uint64_t P3 = 0x165667B19E3779F9ull;
+	constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+	constexpr uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+	static inline uint64_t rotl(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+
+	static inline uint64_t read64(const uint8_t* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+	static inline uint32_t read32(const uint8_t* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+	static inline uint64_t round(uint64_t acc, uint64_t v) {
+		return rotl(acc + v * P2, 31) * P1;
+	}
+
+	static inline uint64_t merge(uint64_t acc, uint64_t v) {
+		return (acc ^ round(0, v)) * P1 + P4;
+	}
+
+	static uint64_t hash(const uint8_t* p, size_t len, uint64_t seed = 0) {
+		const uint8_t* end = p + len;
+		uint64_t h;
+		if (len >= 32) {
+			uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+			for (; p + 32 <= end; p += 32) {
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+			}
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+		} else {
+			h = seed + P5;
+		}
+		h += uint64_t(len);
+
+		for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+		if (p + 4 <= end) {
+			h = rotl(h ^ (uint64_t(read32(p)) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+		for (; p < end; p++) h = rotl(h ^ (*p * P5), 11) * P1;
+
+		h ^= h >> 33; h *= P2;
+		h ^= h >> 29; h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+}
+
+// Hash of the file's bytes, reading it is much cheaper than decoding it
+static bool hashFile(const std::string& path, uint64_t& hash) {
+	MappedFile file(path);
+	if (!file.data()) return false;
+	hash = xxh64::hash(file.data(), file.size());
+	return true;
+}
+
+// Unique to the process and thread, as several instances may share the cache
+static std::string tempPath(const std::string& path) {
+#ifdef _WIN32
+	const long pid = long(_getpid());
+#else
+	const long pid = long(::getpid());
+#endif
+	return path + "." + std::to_string(pid) + "-" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+}
+
+static std::string defaultDirectory() {
+	if (const char* dir = std::getenv("IMGSTUDIO_CACHE_DIR")) return dir;
+#ifdef _WIN32
+	if (const char* dir = std::getenv("LOCALAPPDATA")) return (fs::path(dir) / "imgstudio" / "cache").string();
+#else
+	if (const char* dir = std::getenv("XDG_CACHE_HOME")) return (fs::path(dir) / "imgstudio").string();
+	if (const char* dir = std::getenv("HOME")) return (fs::path(dir) / ".cache" / "imgstudio").string();
+#endif
+	std::error_code ec;
+	fs::path tmp = fs::temp_directory_path(ec);
+	return ec ? std::string() : (tmp / "imgstudio-cache").string();
+}
+
+ImageCache& ImageCache::shared() {
+	static ImageCache cache(defaultDirectory(), [] {
+		const char* mb = std::getenv("IMGSTUDIO_CACHE_MB");
+		return (mb ? uint64_t(std::strtoull(mb, nullptr, 10)) : DefaultCacheMB) * 1024 * 1024;
+	}());
+	return cache;
+}
+
+ImageCache::ImageCache(const std::string& dir, uint64_t maxBytes)
+	: m_dir(dir), m_maxBytes(maxBytes)
+{}
+
+ImageCache::~ImageCache() {
+	flush();
+}
+
+void ImageCache::flush() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_indexDirty) saveIndex();
+}
+
+std::string ImageCache::entryPath(uint64_t hash) const {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.pix", (unsigned long long) hash);
+	return (fs::path(m_dir) / name).string();
+}
+
+PixelData ImageCache::load(const std::string& path, const Decoder& decode, bool* byteExact) {
+	bool bytes = false;
+	auto decodeFile = [&]() {
+		PixelData img = decode(path);
+		bytes = ImageCache::byteExact(img);
+		if (byteExact) *byteExact = bytes;
+		return img;
+	};
+	if (!enabled()) return decodeFile();
+
+	std::error_code ec;
+	const std::string key = fs::absolute(fs::path(path), ec).string();
+	const uint64_t size = fs::file_size(key, ec);
+	if (ec) return decodeFile();
+	const int64_t mtime = int64_t(fs::last_write_time(key, ec).time_since_epoch().count());
+	if (ec) return decodeFile();
+
+	// Unchanged files keep their hash, anything else is hashed again
+	uint64_t hash = 0;
+	bool known = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		loadIndex();
+		auto it = m_index.find(key);
+		if (it != m_index.end() && it->second.size == size && it->second.mtime == mtime) {
+			hash = it->second.hash;
+			known = true;
+		}
+	}
+	if (!known) {
+		if (!hashFile(key, hash)) return decodeFile();
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_index[key] = Source{ size, mtime, hash };
+		m_indexDirty = true;
+	}
+
+	PixelData img{};
+	const std::string entry = entryPath(hash);
+	if (read(entry, img, bytes, hash, size)) {
+		// The modification time of an entry is when it was last used
+		fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+		if (byteExact) *byteExact = bytes;
+		return img;
+	}
+
+	img = decodeFile();
+	if (img.width() > 0 && img.height() > 0 && write(entry, img, hash, size, bytes)) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		evict();
+	}
+	return img;
+}
+
+bool ImageCache::read(const std::string& entry, PixelData& img, bool& bytes, uint64_t hash, uint64_t sourceSize) {
+	MappedFile file(entry);
+	if (file.size() < sizeof(EntryHeader)) return false;
+
+	EntryHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, EntryMagic, 4) != 0 || header.version != EntryVersion ||
+		(header.depth != 1 && header.depth != 4) || header.width == 0 || header.height == 0 ||
+		header.hash != hash || header.sourceSize != sourceSize)
+	{
+		return false;
+	}
+
+	const int w = int(header.width), h = int(header.height);
+	const size_t rowSize = size_t(w) * 4 * header.depth;
+	if (file.size() != sizeof(EntryHeader) + rowSize * h) return false;
+
+	const uint8_t* pixels = file.data() + sizeof(EntryHeader);
+	bytes = header.depth == 1;
+	img = PixelData(w, h);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < h; y++) {
+		const uint8_t* row = pixels + rowSize * y;
+		for (int x = 0; x < w; x++) {
+			if (bytes) {
+				const uint8_t* p = &row[x * 4];
+				img.set(x, y, p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f, p[3] / 255.0f);
+			} else {
+				float p[4];
+				std::memcpy(p, &row[x * 16], sizeof(p));
+				img.set(x, y, p[0], p[1], p[2], p[3]);
+			}
+		}
+	}
+	return true;
+}
+
+bool ImageCache::byteExact(const PixelData& img) {
+	bool bytes = true;
+	#pragma omp parallel for schedule(static) reduction(&&:bytes)
+	for (int y = 0; y < img.height(); y++) {
+		for (int x = 0; x < img.width() && bytes; x++) {
+			Color col = img.get(x, y);
+			for (float v : { col.r, col.g, col.b, col.a }) {
+				if (v < 0.0f || v > 1.0f || std::round(v * 255.0f) / 255.0f != v) bytes = false;
+			}
+		}
+	}
+	return bytes;
+}
+
+bool ImageCache::write(const std::string& entry, const PixelData& img, uint64_t hash, uint64_t sourceSize, bool bytes) {
+	std::error_code ec;
+	fs::create_directories(m_dir, ec);
+
+	const int w = img.width(), h = img.height();
+
+	// 8 bit sources (nearly all) are stored as such, 4 times smaller
+	EntryHeader header{};
+	std::memcpy(header.magic, EntryMagic, 4);
+	header.version = EntryVersion;
+	header.width = uint32_t(w);
+	header.height = uint32_t(h);
+	header.depth = bytes ? 1 : 4;
+	header.sourceSize = sourceSize;
+	header.hash = hash;
+
+	// Written next to the entry and renamed, so readers never see half of it
+	const std::string tmp = tempPath(entry);
+	{
+		std::ofstream fp(tmp, std::ios::binary);
+		if (!fp) return false;
+		fp.write((const char*) &header, sizeof(header));
+
+		std::vector<uint8_t> row(size_t(w) * 4 * header.depth);
+		for (int y = 0; y < h && fp; y++) {
+			for (int x = 0; x < w; x++) {
+				Color col = img.get(x, y);
+				if (bytes) {
+					uint8_t* p = &row[x * 4];
+					p[0] = uint8_t(std::round(col.r * 255.0f));
+					p[1] = uint8_t(std::round(col.g * 255.0f));
+					p[2] = uint8_t(std::round(col.b * 255.0f));
+					p[3] = uint8_t(std::round(col.a * 255.0f));
+				} else {
+					const float p[4] = { col.r, col.g, col.b, col.a };
+					std::memcpy(&row[x * 16], p, sizeof(p));
+				}
+			}
+			fp.write((const char*) row.data(), std::streamsize(row.size()));
+		}
+		if (!fp) {
+			fp.close();
+			fs::remove(tmp, ec);
+			return false;
+		}
+	}
+
+	fs::rename(tmp, entry, ec);
+	if (ec) {
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+// Removes the least recently used entries until the cache fits its size
+void ImageCache::evict() {
+	struct Entry {
+		fs::path path;
+		uint64_t size;
+		fs::file_time_type used;
+	};
+
+	std::vector<Entry> entries;
+	uint64_t total = 0;
+	std::error_code ec;
+	for (auto&& it : fs::directory_iterator(m_dir, ec)) {
+		if (!it.is_regular_file(ec) || it.path().extension() != ".pix") continue;
+		Entry e{ it.path(), it.file_size(ec), it.last_write_time(ec) };
+		if (ec) continue;
+		total += e.size;
+		entries.push_back(e);
+	}
+	if (total <= m_maxBytes) return;
+
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+	for (auto&& e : entries) {
+		if (total <= m_maxBytes) break;
+		if (fs::remove(e.path, ec)) total -= e.size;
+	}
+}
+
+void ImageCache::loadIndex() {
+	if (m_indexLoaded) return;
+	m_indexLoaded = true;
+
+	std::ifstream fp((fs::path(m_dir) / "index.json").string());
+	if (!fp) return;
+
+	// Sources that are gone don't need to be remembered
+	try {
+		Json json;
+		fp >> json;
+		std::error_code ec;
+		for (auto it = json.begin(); it != json.end(); ++it) {
+			if (!fs::exists(it.key(), ec)) {
+				m_indexDirty = true;
+				continue;
+			}
+			auto&& src = it.value();
+			m_index[it.key()] = Source{
+				src.value("size", uint64_t(0)),
+				src.value("mtime", int64_t(0)),
+				std::strtoull(src.value("hash", std::string()).c_str(), nullptr, 16)
+			};
+		}
+	} catch (const std::exception&) {
+		m_index.clear();	// rebuilt as files are opened
+	}
+}
+
+void ImageCache::saveIndex() {
+	std::error_code ec;
+	fs::create_directories(m_dir, ec);
+
+	Json json = Json::object();
+	for (auto&& it : m_index) {
+		char hash[32];
+		std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) it.second.hash);
+		json[it.first] = { { "size", it.second.size }, { "mtime", it.second.mtime }, { "hash", hash } };
+	}
+
+	const std::string path = (fs::path(m_dir) / "index.json").string();
+	const std::string tmp = tempPath(path);
+	{
+		std::ofstream fp(tmp);
+		if (!fp) return;
+		fp << json;
+	}
+	fs::rename(tmp, path, ec);
+	if (ec) fs::remove(tmp, ec);
+	else m_indexDirty = false;
+}
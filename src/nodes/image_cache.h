@@ -0,0 +1,66 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+#include "image.h"
+
+// Decoded images on disk, so opening a project maps its images instead of
+// decoding them again. Entries are named by a hash of the source file's
+// content; an index of path, size and modification time finds the hash
+// without reading the file when it didn't change. The least recently used
+// entries are removed once the cache grows past its size.
+class ImageCache {
+public:
+	using Decoder = std::function<PixelData(const std::string&)>;
+
+	// Shared by all ImageNodes. The directory and size (in MB, 0 disables the
+	// cache) can be set with IMGSTUDIO_CACHE_DIR and IMGSTUDIO_CACHE_MB.
+	static ImageCache& shared();
+
+	ImageCache(const std::string& dir, uint64_t maxBytes);
+	~ImageCache();
+
+	// The cached pixels of 'path', decoded with 'decode' and stored on a miss.
+	// 'byteExact' is set to whether they only hold 8 bit values, see byteExact().
+	PixelData load(const std::string& path, const Decoder& decode, bool* byteExact = nullptr);
+
+	// Every channel of every pixel is one of the 256 values k / 255
+	static bool byteExact(const PixelData& img);
+
+	// Writes the index if sources were hashed since it was last written. Done
+	// after a project is loaded and when the cache is destroyed.
+	void flush();
+
+	bool enabled() const { return m_maxBytes > 0 && !m_dir.empty(); }
+	const std::string& directory() const { return m_dir; }
+
+private:
+	struct Source {
+		uint64_t size{ 0 };
+		int64_t mtime{ 0 };
+		uint64_t hash{ 0 };
+	};
+
+	std::string entryPath(uint64_t hash) const;
+	// Fails unless the entry was written for a source of that hash and size
+	bool read(const std::string& entry, PixelData& img, bool& bytes, uint64_t hash, uint64_t sourceSize);
+	bool write(const std::string& entry, const PixelData& img, uint64_t hash, uint64_t sourceSize, bool bytes);
+	void evict();
+
+	void loadIndex();
+	void saveIndex();
+
+	std::string m_dir;
+	uint64_t m_maxBytes;
+
+	std::mutex m_lock;
+	std::map<std::string, Source> m_index;	// by absolute source path
+	bool m_indexLoaded{ false }, m_indexDirty{ false };
+};
+
+#endif // IMAGE_CACHE_H
@@ -0,0 +1,493 @@
+#include "image_export.h"
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <utility>
+#include <initializer_list>
+#include <functional>
+#include <cmath>
+
+#include <zlib.h>
+#include <omp.h>
+
+// Uncompressed size of a PNG strip. Strips are deflated independently (the
+// previous 32K are still used as dictionary), so their size only decides how
+// many there are to spread over the threads. It doesn't depend on the thread
+// count, so the output doesn't either.
+constexpr size_t PngStripBytes = 256 * 1024;
+constexpr size_t DeflateWindow = 32768;
+
+// Buffers small writes into large ones
+class ByteWriter {
+public:
+	explicit ByteWriter(std::ofstream& fp) : m_fp(fp) { m_buf.reserve(Capacity); }
+	~ByteWriter() { flush(); }
+
+	inline void put(uint8_t v) {
+		m_buf.push_back(v);
+		if (m_buf.size() >= Capacity) flush();
+	}
+
+	void put(const void* data, size_t size) {
+		flush();
+		m_fp.write((const char*) data, std::streamsize(size));
+	}
+
+	void be32(uint32_t v) {
+		put(uint8_t(v >> 24)); put(uint8_t(v >> 16)); put(uint8_t(v >> 8)); put(uint8_t(v));
+	}
+
+	void le16(uint16_t v) {
+		put(uint8_t(v)); put(uint8_t(v >> 8));
+	}
+
+	void flush() {
+		if (m_buf.empty()) return;
+		m_fp.write((const char*) m_buf.data(), std::streamsize(m_buf.size()));
+		m_buf.clear();
+	}
+
+private:
+	static constexpr size_t Capacity = 1 << 20;
+	std::ofstream& m_fp;
+	std::vector<uint8_t> m_buf;
+};
+
+ExportFormat exportFormat(const std::string& path) {
+	std::string ext = path.substr(std::min(path.find_last_of('.'), path.size()));
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+	if (ext == ".qoi") return ExportFormat::QOI;
+	if (ext == ".ppm") return ExportFormat::PPM;
+	if (ext == ".pam") return ExportFormat::PAM;
+	if (ext == ".tga") return ExportFormat::TGA;
+	if (ext == ".pfm") return ExportFormat::PFM;
+	return ExportFormat::PNG;
+}
+
+std::string exportExtension(ExportFormat format) {
+	switch (format) {
+		case ExportFormat::QOI: return ".qoi";
+		case ExportFormat::PPM: return ".ppm";
+		case ExportFormat::PAM: return ".pam";
+		case ExportFormat::TGA: return ".tga";
+		case ExportFormat::PFM: return ".pfm";
+		default: return ".png";
+	}
+}
+
+static inline uint8_t paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return uint8_t(a);
+	return pb <= pc ? uint8_t(b) : uint8_t(c);
+}
+
+// Writes the filter byte and the filtered row to 'out'. Like stb, the filter
+// with the smallest sum of absolute (signed) differences is picked.
+static void filterRow(const uint8_t* row, const uint8_t* prev, size_t stride, size_t bpp, bool adaptive, uint8_t* out, std::vector<uint8_t>& scratch) {
+	if (!adaptive) {
+		out[0] = 0;
+		std::memcpy(out + 1, row, stride);
+		return;
+	}
+
+	scratch.resize(stride);
+	int64_t best = -1;
+	auto tryFilter = [&](uint8_t filter, auto&& predict) {
+		int64_t cost = 0;
+		for (size_t i = 0; i < stride; i++) {
+			const int a = i >= bpp ? row[i - bpp] : 0;
+			const int b = prev ? prev[i] : 0;
+			const int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+			const uint8_t v = uint8_t(row[i] - predict(a, b, c));
+			scratch[i] = v;
+			cost += std::abs(int(int8_t(v)));
+		}
+		if (best < 0 || cost < best) {
+			best = cost;
+			out[0] = filter;
+			std::memcpy(out + 1, scratch.data(), stride);
+		}
+	};
+	tryFilter(0, [](int, int, int) { return 0; });
+	tryFilter(1, [](int a, int, int) { return a; });
+	tryFilter(2, [](int, int b, int) { return b; });
+	tryFilter(3, [](int a, int b, int) { return (a + b) >> 1; });
+	tryFilter(4, [](int a, int b, int c) { return paeth(a, b, c); });
+}
+
+// Fills 'out' with row 'y' as PNG samples (big endian at 16 bits)
+using PngRows = std::function<void(int y, uint8_t* out)>;
+
+static void writeChunk(ByteWriter& out, const char* type, std::initializer_list<std::pair<const uint8_t*, size_t>> parts) {
+	size_t size = 0;
+	for (auto&& part : parts) size += part.second;
+
+	uLong crc = crc32(0, (const Bytef*) type, 4);
+	for (auto&& part : parts) crc = crc32(crc, part.first, uInt(part.second));
+
+	out.be32(uint32_t(size));
+	out.put(type, 4);
+	for (auto&& part : parts) out.put(part.first, part.second);
+	out.be32(uint32_t(crc));
+}
+
+// Rows are filtered and deflated in strips on all threads. Each strip but the
+// last ends with a sync flush, so the strips concatenate into one stream.
+// A strip only fetches its own rows (and the ones before it that make up its
+// dictionary), so the image is never held uncompressed as a whole.
+static bool writePNG(std::ofstream& fp, int width, int height, int depth, const PngRows& rows, const ExportOptions& opts) {
+	const int level = std::clamp(opts.compression, 0, 9);
+	const int threads = opts.threads > 0 ? opts.threads : omp_get_max_threads();
+	const size_t bpp = depth == 16 ? 8 : 4;
+	const size_t stride = size_t(width) * bpp;
+	const size_t rowBytes = stride + 1;
+	const int stripRows = int(std::max<size_t>(PngStripBytes / rowBytes, 1));
+	const int strips = (height + stripRows - 1) / stripRows;
+
+	// Stored blocks gain nothing from filtering or a dictionary
+	const int dictRows = level > 0 ? int((DeflateWindow + rowBytes - 1) / rowBytes) : 0;
+
+	std::vector<std::vector<uint8_t>> deflated(strips);
+	std::vector<uLong> adlers(strips);
+	std::vector<size_t> lengths(strips);
+	std::atomic<bool> ok{ true };
+
+	#pragma omp parallel num_threads(threads)
+	{
+		std::vector<uint8_t> raw, filtered, scratch;
+
+		#pragma omp for schedule(dynamic)
+		for (int s = 0; s < strips; s++) {
+			const int y0 = s * stripRows;
+			const int y1 = std::min(y0 + stripRows, height);
+			const int first = std::max(y0 - dictRows, 0);
+			const bool last = s == strips - 1;
+
+			// The row above 'first' is only needed as the filters' reference
+			const int fetched = first > 0 ? first - 1 : first;
+			raw.resize(stride * (y1 - fetched));
+			for (int y = fetched; y < y1; y++) rows(y, &raw[stride * (y - fetched)]);
+
+			filtered.resize(rowBytes * (y1 - first));
+			for (int y = first; y < y1; y++) {
+				const uint8_t* row = &raw[stride * (y - fetched)];
+				filterRow(row, y > 0 ? row - stride : nullptr, stride, bpp, level > 0, &filtered[rowBytes * (y - first)], scratch);
+			}
+
+			const size_t begin = rowBytes * (y0 - first);
+			const size_t size = filtered.size() - begin;
+
+			z_stream zs{};
+			if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+				ok = false;
+				continue;
+			}
+			if (begin > 0) {
+				const size_t dict = std::min(begin, DeflateWindow);
+				deflateSetDictionary(&zs, &filtered[begin - dict], uInt(dict));
+			}
+
+			auto&& out = deflated[s];
+			out.resize(deflateBound(&zs, uLong(size)) + 16);
+			zs.next_in = &filtered[begin];
+			zs.avail_in = uInt(size);
+			zs.next_out = out.data();
+			zs.avail_out = uInt(out.size());
+
+			const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+			if (ret != (last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0) ok = false;
+			out.resize(zs.total_out);
+			deflateEnd(&zs);
+
+			adlers[s] = adler32(adler32(0, Z_NULL, 0), &filtered[begin], uInt(size));
+			lengths[s] = size;
+		}
+	}
+	if (!ok) return false;
+
+	uLong adler = adler32(0, Z_NULL, 0);
+	for (int s = 0; s < strips; s++) adler = adler32_combine(adler, adlers[s], z_off_t(lengths[s]));
+
+	static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	static const uint8_t zlibHeaders[4][2] = { { 0x78, 0x01 }, { 0x78, 0x5E }, { 0x78, 0x9C }, { 0x78, 0xDA } };
+	const uint8_t* zlibHeader = zlibHeaders[level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3];
+	const uint8_t trailer[] = { uint8_t(adler >> 24), uint8_t(adler >> 16), uint8_t(adler >> 8), uint8_t(adler) };
+	const uint8_t header[] = {
+		uint8_t(width >> 24), uint8_t(width >> 16), uint8_t(width >> 8), uint8_t(width),
+		uint8_t(height >> 24), uint8_t(height >> 16), uint8_t(height >> 8), uint8_t(height),
+		uint8_t(depth), 6, 0, 0, 0	// RGBA, no interlacing
+	};
+
+	ByteWriter out(fp);
+	out.put(signature, sizeof(signature));
+	writeChunk(out, "IHDR", { { header, sizeof(header) } });
+	for (int s = 0; s < strips; s++) {
+		const bool first = s == 0, last = s == strips - 1;
+		writeChunk(out, "IDAT", {
+			{ zlibHeader, first ? 2 : 0 },
+			{ deflated[s].data(), deflated[s].size() },
+			{ trailer, last ? sizeof(trailer) : 0 }
+		});
+	}
+	writeChunk(out, "IEND", {});
+	return true;
+}
+
+// https://qoiformat.org/qoi-specification.pdf
+static bool writeQOI(std::ofstream& fp, const uint8_t* rgba, int width, int height) {
+	enum : uint8_t { OpIndex = 0x00, OpDiff = 0x40, OpLuma = 0x80, OpRun = 0xC0, OpRGB = 0xFE, OpRGBA = 0xFF };
+
+	ByteWriter out(fp);
+	out.put("qoif", 4);
+	out.be32(uint32_t(width));
+	out.be32(uint32_t(height));
+	out.put(4);	// channels
+	out.put(0);	// sRGB with linear alpha
+
+	uint8_t index[64][4] = {};
+	uint8_t prev[4] = { 0, 0, 0, 255 };
+	int run = 0;
+
+	const size_t count = size_t(width) * height;
+	for (size_t i = 0; i < count; i++) {
+		const uint8_t* px = &rgba[i * 4];
+		if (std::memcmp(px, prev, 4) == 0) {
+			run++;
+			if (run == 62 || i == count - 1) {
+				out.put(uint8_t(OpRun | (run - 1)));
+				run = 0;
+			}
+			continue;
+		}
+
+		if (run > 0) {
+			out.put(uint8_t(OpRun | (run - 1)));
+			run = 0;
+		}
+
+		const int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+		if (std::memcmp(index[hash], px, 4) == 0) {
+			out.put(uint8_t(OpIndex | hash));
+		} else {
+			std::memcpy(index[hash], px, 4);
+			if (px[3] == prev[3]) {
+				const int dr = int8_t(px[0] - prev[0]);
+				const int dg = int8_t(px[1] - prev[1]);
+				const int db = int8_t(px[2] - prev[2]);
+				const int drg = dr - dg, dbg = db - dg;
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+					out.put(uint8_t(OpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+				} else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+					out.put(uint8_t(OpLuma | (dg + 32)));
+					out.put(uint8_t((drg + 8) << 4 | (dbg + 8)));
+				} else {
+					out.put(OpRGB);
+					out.put(px[0]); out.put(px[1]); out.put(px[2]);
+				}
+			} else {
+				out.put(OpRGBA);
+				out.put(px[0]); out.put(px[1]); out.put(px[2]); out.put(px[3]);
+			}
+		}
+		std::memcpy(prev, px, 4);
+	}
+
+	static const uint8_t end[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	out.put(end, sizeof(end));
+	return true;
+}
+
+static bool writePPM(std::ofstream& fp, const uint8_t* rgba, int width, int height) {
+	const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+	ByteWriter out(fp);
+	out.put(header.data(), header.size());
+	const size_t count = size_t(width) * height;
+	for (size_t i = 0; i < count; i++) {
+		out.put(rgba[i * 4 + 0]);
+		out.put(rgba[i * 4 + 1]);
+		out.put(rgba[i * 4 + 2]);
+	}
+	return true;
+}
+
+static bool writePAM(std::ofstream& fp, const uint8_t* rgba, int width, int height) {
+	const std::string header =
+		"P7\nWIDTH " + std::to_string(width) + "\nHEIGHT " + std::to_string(height) +
+		"\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+
+	ByteWriter out(fp);
+	out.put(header.data(), header.size());
+	out.put(rgba, size_t(width) * height * 4);
+	return true;
+}
+
+static bool writeTGA(std::ofstream& fp, const uint8_t* rgba, int width, int height) {
+	if (width > 0xFFFF || height > 0xFFFF) return false;
+
+	ByteWriter out(fp);
+	out.put(0);		// no image ID
+	out.put(0);		// no color map
+	out.put(2);		// uncompressed true color
+	for (int i = 0; i < 5; i++) out.put(0);
+	out.le16(0); out.le16(0);
+	out.le16(uint16_t(width)); out.le16(uint16_t(height));
+	out.put(32);
+	out.put(0x28);	// top-left origin, 8 alpha bits
+
+	const size_t count = size_t(width) * height;
+	for (size_t i = 0; i < count; i++) {
+		out.put(rgba[i * 4 + 2]);
+		out.put(rgba[i * 4 + 1]);
+		out.put(rgba[i * 4 + 0]);
+		out.put(rgba[i * 4 + 3]);
+	}
+	return true;
+}
+
+static bool littleEndian() {
+	const uint16_t v = 1;
+	return *(const uint8_t*) &v == 1;
+}
+
+// Fills 'out' with row 'y' as float RGB
+using PfmRows = std::function<void(int y, float* out)>;
+
+// Rows are stored bottom to top, in the host's byte order (negative scale
+// for little endian)
+static bool writePFM(std::ofstream& fp, int width, int height, const PfmRows& rows) {
+	const std::string header =
+		"PF\n" + std::to_string(width) + " " + std::to_string(height) + (littleEndian() ? "\n-1.0\n" : "\n1.0\n");
+	fp.write(header.data(), std::streamsize(header.size()));
+
+	std::vector<float> row(size_t(width) * 3);
+	for (int y = height - 1; y >= 0 && fp; y--) {
+		rows(y, row.data());
+		fp.write((const char*) row.data(), std::streamsize(row.size() * sizeof(float)));
+	}
+	return true;
+}
+
+static inline uint16_t sample16(float v) {
+	return uint16_t(std::clamp(v, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+static inline void put16(uint8_t* out, uint16_t v) {
+	out[0] = uint8_t(v >> 8);
+	out[1] = uint8_t(v);
+}
+
+static bool exportRows(const std::string& path, int width, int height, const ExportOptions& opts,
+					   const PngRows& png16, const PfmRows& pfm, const uint8_t* rgba)
+{
+	std::ofstream fp(path, std::ios::binary);
+	if (!fp) return false;
+
+	bool ok = false;
+	switch (opts.format) {
+		case ExportFormat::PNG:
+			if (opts.depth == 16) {
+				ok = writePNG(fp, width, height, 16, png16, opts);
+			} else {
+				const size_t stride = size_t(width) * 4;
+				ok = writePNG(fp, width, height, 8, [=](int y, uint8_t* out) {
+					std::memcpy(out, rgba + stride * y, stride);
+				}, opts);
+			}
+			break;
+		case ExportFormat::PFM: ok = writePFM(fp, width, height, pfm); break;
+		case ExportFormat::QOI: ok = writeQOI(fp, rgba, width, height); break;
+		case ExportFormat::PPM: ok = writePPM(fp, rgba, width, height); break;
+		case ExportFormat::PAM: ok = writePAM(fp, rgba, width, height); break;
+		case ExportFormat::TGA: ok = writeTGA(fp, rgba, width, height); break;
+	}
+	fp.close();
+	return ok && !fp.fail();
+}
+
+bool exportImage(const std::string& path, const uint8_t* rgba, int width, int height, const ExportOptions& opts) {
+	if (!rgba || width <= 0 || height <= 0) return false;
+
+	auto png16 = [=](int y, uint8_t* out) {
+		const uint8_t* row = rgba + size_t(width) * 4 * y;
+		for (int i = 0; i < width * 4; i++) put16(&out[i * 2], uint16_t(row[i] * 257));
+	};
+	auto pfm = [=](int y, float* out) {
+		const uint8_t* row = rgba + size_t(width) * 4 * y;
+		for (int x = 0; x < width; x++) {
+			for (int c = 0; c < 3; c++) out[x * 3 + c] = float(row[x * 4 + c]) / 255.0f;
+		}
+	};
+	return exportRows(path, width, height, opts, png16, pfm, rgba);
+}
+
+bool exportImage(const std::string& path, const PixelData& img, const ExportOptions& opts) {
+	if (img.width() <= 0 || img.height() <= 0) return false;
+
+	// The float formats read the pixels row by row, the 8 bit ones get a copy
+	const bool precise = opts.format == ExportFormat::PFM || (opts.format == ExportFormat::PNG && opts.depth == 16);
+	if (!precise) return exportImage(path, img.dataCopy().data(), img.width(), img.height(), opts);
+
+	auto png16 = [&](int y, uint8_t* out) {
+		for (int x = 0; x < img.width(); x++) {
+			Color col = img.get(x, y);
+			put16(&out[x * 8 + 0], sample16(col.r));
+			put16(&out[x * 8 + 2], sample16(col.g));
+			put16(&out[x * 8 + 4], sample16(col.b));
+			put16(&out[x * 8 + 6], sample16(col.a));
+		}
+	};
+	auto pfm = [&](int y, float* out) {
+		for (int x = 0; x < img.width(); x++) {
+			Color col = img.get(x, y);
+			out[x * 3 + 0] = col.r;
+			out[x * 3 + 1] = col.g;
+			out[x * 3 + 2] = col.b;
+		}
+	};
+	return exportRows(path, img.width(), img.height(), opts, png16, pfm, nullptr);
+}
+
+bool loadPFM(const std::string& path, PixelData& img) {
+	std::ifstream fp(path, std::ios::binary);
+	if (!fp) return false;
+
+	std::string type;
+	int width = 0, height = 0;
+	float scale = 0.0f;
+	fp >> type >> width >> height >> scale;
+	if (!fp || (type != "PF" && type != "Pf") || width <= 0 || height <= 0 || scale == 0.0f) return false;
+	fp.get();	// the single whitespace before the samples
+
+	const int channels = type == "PF" ? 3 : 1;
+	const size_t rowSize = size_t(width) * channels;
+	std::vector<float> data(rowSize * height);
+	if (!fp.read((char*) data.data(), std::streamsize(data.size() * sizeof(float)))) return false;
+
+	// Samples are in the byte order of the writer, which the sign of the scale tells
+	if ((scale < 0.0f) != littleEndian()) {
+		for (float& v : data) {
+			uint8_t* b = (uint8_t*) &v;
+			std::swap(b[0], b[3]);
+			std::swap(b[1], b[2]);
+		}
+	}
+
+	img = PixelData(width, height);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		const float* row = &data[rowSize * (height - 1 - y)];
+		for (int x = 0; x < width; x++) {
+			const float* p = &row[x * channels];
+			if (channels == 3) img.set(x, y, p[0], p[1], p[2], 1.0f);
+			else img.set(x, y, p[0], p[0], p[0], 1.0f);
+		}
+	}
+	return true;
+}
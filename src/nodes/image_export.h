@@ -0,0 +1,44 @@
+#ifndef IMAGE_EXPORT_H
+#define IMAGE_EXPORT_H
+
+#include <string>
+#include <cstdint>
+
+#include "image.h"
+
+enum class ExportFormat {
+	PNG = 0,
+	QOI,	// lossless and much faster than PNG, for handing images to other tools
+	PPM,	// binary RGB (P6), no alpha
+	PAM,	// binary RGBA (P7)
+	TGA,	// uncompressed BGRA
+	PFM		// float RGB, exact copy of the engine's output (no alpha)
+};
+
+struct ExportOptions {
+	ExportFormat format{ ExportFormat::PNG };
+
+	// PNG deflate level, 0 (stored, fastest) to 9 (smallest)
+	int compression{ 6 };
+
+	// PNG bits per channel, 8 or 16. 16 bit PNGs and PFMs are written
+	// straight from the float pixels, a row at a time.
+	int depth{ 8 };
+
+	// PNG strips compressed at once, 0 = one per core
+	int threads{ 0 };
+};
+
+// Format by file extension, PNG for anything unknown
+ExportFormat exportFormat(const std::string& path);
+std::string exportExtension(ExportFormat format);
+
+bool exportImage(const std::string& path, const PixelData& img, const ExportOptions& opts = {});
+
+// 'rgba' is 'width' * 'height' tightly packed 8 bit RGBA pixels
+bool exportImage(const std::string& path, const uint8_t* rgba, int width, int height, const ExportOptions& opts = {});
+
+// Reads a color (PF) or grayscale (Pf) PFM, such as the ones exported here
+bool loadPFM(const std::string& path, PixelData& img);
+
+#endif // IMAGE_EXPORT_H
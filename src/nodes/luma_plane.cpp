@@ -0,0 +1,54 @@
+#include "luma_plane.h"
+
+#include "node_logic.h"
+
+void LumaPlane::update(const PixelData& img, uint64_t hash) {
+	if (hash != 0 && hash == m_hash &&
+		img.width() == m_width && img.height() == m_height)
+	{
+		return;
+	}
+
+	m_width = img.width();
+	m_height = img.height();
+	m_hash = hash;
+	m_data.resize(m_width * m_height);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < m_height; y++) {
+		for (int x = 0; x < m_width; x++) {
+			m_data[x + y * m_width] = luma(img.get(x, y));
+		}
+	}
+}
+
+void LumaPlane::assign(const uint8_t* luma, int width, int height, uint64_t hash) {
+	m_width = width;
+	m_height = height;
+	m_hash = hash;
+	m_data.resize(m_width * m_height);
+
+	for (int k = 0; k < m_width * m_height; k++) {
+		m_data[k] = float(luma[k]) / 255.0f;
+	}
+}
+
+void LumaPlane::resample(const LumaPlane& src, int width, int height, uint64_t hash) {
+	if (hash != 0 && hash == m_hash && width == m_width && height == m_height) {
+		return;
+	}
+
+	m_width = width;
+	m_height = height;
+	m_hash = hash;
+	m_data.resize(m_width * m_height);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < m_height; y++) {
+		int sy = int((src.height() + 0.5f) * (float(y) / m_height));
+		for (int x = 0; x < m_width; x++) {
+			int sx = int((src.width() + 0.5f) * (float(x) / m_width));
+			m_data[x + y * m_width] = src.get(sx, sy);
+		}
+	}
+}
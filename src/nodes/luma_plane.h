@@ -0,0 +1,43 @@
+#ifndef LUMA_PLANE_H
+#define LUMA_PLANE_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "image.h"
+
+// Single channel luma of an image. NodeSystem keeps one per node output that
+// feeds luma inputs, shared by all of them.
+class LumaPlane {
+public:
+	// Recomputes (in parallel) only when 'hash' differs from the one the plane
+	// was built for. A zero hash is unknown content and always recomputes.
+	void update(const PixelData& img, uint64_t hash);
+
+	// Takes 8 bit luma as is, e.g. a camera's Y plane ('width' * 'height' bytes)
+	void assign(const uint8_t* luma, int width, int height, uint64_t hash);
+
+	// Samples 'src' at 'width' x 'height' the way a node samples its inputs, so
+	// a luma source can fill its consumers' planes without going through RGBA
+	void resample(const LumaPlane& src, int width, int height, uint64_t hash);
+
+	// Same edge clamping as PixelData::get
+	inline float get(int x, int y) const {
+		if (m_data.empty()) return 0.0f;
+		x = std::clamp(x, 0, m_width - 1);
+		y = std::clamp(y, 0, m_height - 1);
+		return m_data[x + y * m_width];
+	}
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	const float* data() const { return m_data.data(); }
+
+private:
+	std::vector<float> m_data;
+	int m_width{ 0 }, m_height{ 0 };
+	uint64_t m_hash{ 0 };
+};
+
+#endif // LUMA_PLANE_H
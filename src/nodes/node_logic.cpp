@@ -5,9 +5,10 @@
 
 #include "nodes.hpp"
 
-void Node::addParam(const std::string& name) {
+void Node::addParam(const std::string& name, bool needsLuma) {
 	m_paramNames.push_back(name);
 	m_params.push_back(Param{});
+	m_params.back().needsLuma = needsLuma;
 }
 
 Node::Param& Node::param(unsigned int id) {
@@ -18,6 +19,20 @@ std::string Node::paramName(unsigned int id) {
 	return m_paramNames[id];
 }
 
+uint64_t Node::settingsHash() {
+	Json json;
+	save(json);
+	return hashCombine(std::hash<std::string>{}(json.dump()), uint64_t(type()));
+}
+
+uint64_t Node::hash() {
+	uint64_t h = settingsHash();
+	for (auto&& p : m_params) {
+		h = hashCombine(h, p.connected ? p.hash : 0);
+	}
+	return h;
+}
+
 PixelData Node::process(const PixelData& in) {
 	reset();
 
@@ -39,85 +54,50 @@ NodeSystem::NodeSystem() {
 }
 
 NodeSystem::~NodeSystem() {
-	if (m_ctx) {
-		m_timerThread.~thread();
-		Cap_releaseContext(m_ctx);
-	}
-}
-
-void NodeSystem::startCapture() {
-	// Initialize WebCam if available
-	m_ctx = Cap_createContext();
-	if (m_ctx) {
-		int dID = 0;
-		int fID = 0;
-		for(int device = 0; device < Cap_getDeviceCount(m_ctx); device++) {
-			std::string deviceName = Cap_getDeviceName(m_ctx, device);
-			std::cout << device << ") " << deviceName << std::endl;
-			for(int format = 0; format < Cap_getNumFormats(m_ctx, device); format++) {
-				CapFormatInfo finfo;
-				Cap_getFormatInfo(m_ctx, device, format, &finfo);
-
-				std::string fourcc{};
-				for(uint32_t i = 0; i < 4; i++) {
-					fourcc += (char)(finfo.fourcc & 0xFF);
-					finfo.fourcc >>= 8;
-				}
+	// Stops the capture threads before anything else goes away
+	for (auto&& ptr : m_nodes) ptr.reset();
+}
 
-				std::cout << "\t" << finfo.width << "x" << finfo.height << " " << fourcc << " " << finfo.fps << "fps" << std::endl;
+std::shared_ptr<CameraStream> NodeSystem::camera(const CameraFormat& format) {
+	auto running = [&](const std::string& key) -> std::shared_ptr<CameraStream> {
+		auto it = m_cameras.find(key);
+		return it != m_cameras.end() ? it->second.lock() : nullptr;
+	};
+
+	// Requests seen before find their stream without opening the device
+	const std::string requested = CameraStream::key(format);
+	auto alias = m_cameraKeys.find(requested);
+	if (alias != m_cameraKeys.end()) {
+		if (auto shared = running(alias->second)) return shared;
+	}
 
-				if (finfo.width == 320 && finfo.height == 240) {
-					dID = device;
-					fID = format;
-				}
-			}
-		}
+	auto cam = std::make_shared<CameraStream>(format);
+	if (!cam->valid()) return nullptr;
 
-		m_streamID = Cap_openStream(m_ctx, dID, fID);
-		if (m_streamID != -1) {
-			Cap_getFormatInfo(m_ctx, dID, fID, &m_capInfo);
-			m_lastCamFrame = PixelData(m_capInfo.width, m_capInfo.height);
-
-			// Start capturing frames
-			m_timerThread = std::thread([](CapContext ctx, int stream, NodeSystem* sys) {
-				while (true) {
-					if (!sys->capturing()) break;
-
-					if (Cap_hasNewFrame(ctx, stream) == 1) {
-						std::vector<unsigned char> pixels;
-						pixels.resize(sys->cameraFrame().width() * sys->cameraFrame().height() * 3);
-						Cap_captureFrame(ctx, stream, &pixels[0], pixels.size());
-
-						for (int k = 0; k < pixels.size() / 3; k++) {
-							int x = k % sys->cameraFrame().width();
-							int y = k / sys->cameraFrame().width();
-							int j = k * 3;
-							sys->cameraFrame().set(
-								x, y,
-								float(pixels[j + 0]) / 255.0f,
-								float(pixels[j + 1]) / 255.0f,
-								float(pixels[j + 2]) / 255.0f,
-								1.0f
-							);
-						}
-						sys->hasFrame(true);
-					}
-					std::this_thread::sleep_for(std::chrono::milliseconds(1000 / 10));
-				}
-			}, m_ctx, m_streamID, this);
-			m_timerThread.detach();
-			m_capturing = true;
-		}
+	// A different request may have resolved to the same format
+	const std::string key = cam->key();
+	m_cameraKeys[requested] = key;
+	if (auto shared = running(key)) return shared;
+
+	if (!cam->start()) return nullptr;
+	m_cameras[key] = cam;
+	return cam;
+}
+
+bool NodeSystem::capturing() {
+	for (auto it = m_cameras.begin(); it != m_cameras.end();) {
+		if (it->second.expired()) it = m_cameras.erase(it);
+		else ++it;
 	}
+	return !m_cameras.empty();
 }
 
-void NodeSystem::stopCapture() {
-	if (m_ctx) {
-		m_timerThread.~thread();
-		Cap_releaseContext(m_ctx);
-		m_ctx = nullptr;
-		m_capturing = false;
+bool NodeSystem::hasFrame() {
+	for (auto&& [key, cam] : m_cameras) {
+		auto shared = cam.lock();
+		if (shared && shared->hasFrame()) return true;
 	}
+	return false;
 }
 
 void NodeSystem::destroy(unsigned int id) {
@@ -130,18 +110,10 @@ void NodeSystem::destroy(unsigned int id) {
 	m_lock.lock();
 	m_usedNodes.erase(pos);
 	m_nodes[id].reset();
+	m_luts.erase(id);
+	m_lumaPlanes.erase(id);
+	m_nodeMs.erase(id);
 	m_lock.unlock();
-
-	int cnt = 0;
-	for (auto nid : m_usedNodes) {
-		if (get<Node>(nid)->type() == NodeType::WebCam) {
-			cnt++;
-		}
-	}
-
-	if (cnt == 0) {
-		stopCapture();
-	}
 }
 
 void NodeSystem::clear() {
@@ -151,10 +123,134 @@ void NodeSystem::clear() {
 
 	for (auto&& ptr : m_nodes) if (ptr) ptr.reset();
 	for (auto&& ptr : m_connections) if (ptr) ptr.reset();
+	m_luts.clear();
+	m_lumaPlanes.clear();
+	m_nodeMs.clear();
 	m_lock.unlock();
 	create<OutputNode>();
 }
 
+struct TypeMapEntry { std::string n; NodeType t; };
+
+#define TM(t) { #t, NodeType::t }
+static const TypeMapEntry TypeMap[] = {
+	TM(Add),
+	TM(Multiply),
+	TM(Mix),
+	TM(None),
+	TM(Color),
+	TM(Erode),
+	TM(Image),
+	TM(Dilate),
+	TM(Invert),
+	TM(Median),
+	TM(Mirror),
+	TM(Output),
+	TM(WebCam),
+	TM(Distort),
+	TM(FishEye),
+	TM(Convolute),
+	TM(Threshold),
+	TM(BrightnessContrast),
+	TM(NormalMap),
+	TM(Grayscale),
+	TM(Equalize)
+};
+#undef TM
+
+std::string NodeSystem::typeName(NodeType type) {
+	auto tp = std::find_if(std::begin(TypeMap), std::end(TypeMap), [type](const TypeMapEntry& e) {
+		return e.t == type;
+	});
+	return tp != std::end(TypeMap) ? tp->n : "None";
+}
+
+NodeType NodeSystem::typeFromName(const std::string& name) {
+	auto tp = std::find_if(std::begin(TypeMap), std::end(TypeMap), [&name](const TypeMapEntry& e) {
+		return e.n == name;
+	});
+	return tp != std::end(TypeMap) ? tp->t : NodeType::None;
+}
+
+unsigned int NodeSystem::create(NodeType type) {
+	switch (type) {
+		default: return UINT32_MAX;
+		case NodeType::Add: return create<AddNode>();
+		case NodeType::Multiply: return create<MultiplyNode>();
+		case NodeType::Mix: return create<MixNode>();
+		case NodeType::Color: return create<ColorNode>();
+		case NodeType::Erode: return create<ErodeNode>();
+		case NodeType::Image: return create<ImageNode>();
+		case NodeType::Dilate: return create<DilateNode>();
+		case NodeType::Invert: return create<InvertNode>();
+		case NodeType::Median: return create<MedianNode>();
+		case NodeType::Mirror: return create<MirrorNode>();
+		case NodeType::WebCam: return create<WebCamNode>();
+		case NodeType::Distort: return create<DistortNode>();
+		case NodeType::FishEye: return create<FishEyeNode>();
+		case NodeType::Convolute: return create<ConvoluteNode>();
+		case NodeType::Threshold: return create<ThresholdNode>();
+		case NodeType::BrightnessContrast: return create<BrightnessContrastNode>();
+		case NodeType::NormalMap: return create<NormalMapNode>();
+		case NodeType::Grayscale: return create<GrayscaleNode>();
+		case NodeType::Equalize: return create<EqualizeNode>();
+	}
+}
+
+void NodeSystem::load(const Json& json, const std::function<void(unsigned int, const Json&)>& loaded) {
+	clear();
+
+	Json nodes = json["nodes"];
+	Json conns = json["conns"];
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		Json nd = nodes[i];
+		unsigned int node = create(typeFromName(nd["type"]));
+		if (node == UINT32_MAX) continue;
+
+		m_nodes[node]->load(nd);
+		if (loaded) loaded(node, nd);
+	}
+
+	for (size_t i = 0; i < conns.size(); i++) {
+		Json cn = conns[i];
+		connect(cn["src"], cn["dest"], cn["destParam"]);
+	}
+
+	// Images were opened above, remember their hashes for next time
+	ImageCache::shared().flush();
+}
+
+void NodeSystem::save(Json& json, const std::function<void(unsigned int, Json&)>& saving) {
+	Json nodes = Json::array();
+	for (unsigned int nid : m_usedNodes) {
+		Node* node = m_nodes[nid].get();
+		switch (node->type()) {
+			case NodeType::None:
+			case NodeType::Output: continue;
+			default: break;
+		}
+
+		Json jnd; node->save(jnd);
+		if (saving) saving(nid, jnd);
+		jnd["type"] = typeName(node->type());
+		nodes.push_back(jnd);
+	}
+
+	Json conns = Json::array();
+	for (unsigned int cid : m_usedConnections) {
+		auto conn = m_connections[cid].get();
+		Json con;
+		con["src"] = conn->src;
+		con["dest"] = conn->dest;
+		con["destParam"] = conn->destParam;
+		conns.push_back(con);
+	}
+
+	json["nodes"] = nodes;
+	json["conns"] = conns;
+}
+
 unsigned int NodeSystem::connect(unsigned int src, unsigned int dest, unsigned int param) {
 	// is it full?
 	if (m_usedConnections.size() == MaxConnections-1) return UINT32_MAX;
@@ -261,10 +357,21 @@ PixelData NodeSystem::process(const PixelData& in) {
 	std::reverse(conns.begin(), conns.end());
 	m_imgIn = nullptr;
 
+	// The graph only reads the frames published before this point
+	for (auto&& [key, cam] : m_cameras) {
+		if (auto shared = cam.lock()) shared->acquire();
+	}
+
 	// Reset
 	for (auto&& nid : m_usedNodes) {
 		auto& node = m_nodes[nid];
 		node->m_solved = false;
+		for (auto&& p : node->m_params) p.lumaPlane = nullptr;
+	}
+
+	std::map<unsigned int, int> consumers;
+	for (auto&& cid : m_usedConnections) {
+		consumers[m_connections[cid]->src]++;
 	}
 
 	int i = 0;
@@ -284,9 +391,71 @@ PixelData NodeSystem::process(const PixelData& in) {
 		if (src->type() == NodeType::Image) {
 			m_imgIn = &((ImageNode*) src)->image;
 		} else if (src->type() == NodeType::WebCam) {
-			m_imgIn = &m_lastCamFrame;
+			CameraStream* cam = ((WebCamNode*) src)->stream();
+			m_imgIn = cam ? &cam->frame() : nullptr;
+		}
+
+		auto&& param = dest->param(conn->destParam);
+		const bool skip = std::find(m_skipped.begin(), m_skipped.end(), src->id()) != m_skipped.end();
+		auto start = std::chrono::steady_clock::now();
+		if (fusible(conn.get(), consumers)) {
+			// Intermediate stage of a pointwise run, evaluated by the last stage
+			param.value = PixelData();
+		} else if (skip) {
+			param.value = src->param(0).value;
+		} else if (src->pointwise() != Node::Pointwise::None) {
+			// Walk back to the first stage of the run
+			std::vector<Node*> stages{ src };
+			bool byteInput = false;
+			while (true) {
+				unsigned int pid = getConnection(stages.front()->id(), 0);
+				if (pid == UINT32_MAX) break;
+
+				Connection* prev = getConnection(pid);
+				Node* pn = get<Node>(prev->src);
+				if (pn == nullptr) break;
+				if (!fusible(prev, consumers)) {
+					if (pn->type() == NodeType::Image) {
+						byteInput = ((ImageNode*) pn)->byteExact;
+					} else if (pn->type() == NodeType::WebCam) {
+						CameraStream* cam = ((WebCamNode*) pn)->stream();
+						byteInput = cam && cam->byteExact();
+					}
+					break;
+				}
+				stages.insert(stages.begin(), pn);
+			}
+
+			if (stages.size() > 1) {
+				param.value = processFused(stages, in, byteInput);
+			} else {
+				param.value = src->process(in);
+			}
+		} else {
+			param.value = src->process(/*m_imgIn == nullptr ? in : *m_imgIn*/in);
+		}
+		param.hash = hashCombine(hashCombine(src->hash(), in.width()), in.height());
+
+		if (skip) {
+			param.hash = hashCombine(param.hash, 1);
+		} else {
+			float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			auto&& avg = m_nodeMs[src->id()];
+			avg = avg == 0.0f ? ms : avg * 0.8f + ms * 0.2f;
+		}
+
+		// One luma plane per source output, whatever the number of luma inputs reading it
+		if (param.needsLuma && param.value.width() > 0) {
+			auto&& plane = m_lumaPlanes[src->id()];
+			CameraStream* cam = src->type() == NodeType::WebCam ? ((WebCamNode*) src)->stream() : nullptr;
+			if (cam && cam->gray() && !skip) {
+				// Gray cameras hand over their luma without going through RGBA
+				plane.resample(cam->luma(), in.width(), in.height(), param.hash);
+			} else {
+				plane.update(param.value, param.hash);
+			}
+			param.lumaPlane = &plane;
 		}
-		dest->param(conn->destParam).value = src->process(/*m_imgIn == nullptr ? in : *m_imgIn*/in);
 
 		if (dest->type() == NodeType::Output) {
 			out = ((OutputNode*) dest)->param(0).value;
@@ -308,11 +477,183 @@ PixelData NodeSystem::process(const PixelData& in) {
 		}
 	}
 
-	m_hasNewFrame = false;
+	return out;
+}
+
+// Internal resolution of each Degrade::Resolution level
+static const float ResolutionScales[NodeSystem::MaxDegradeLevel + 1] = { 1.0f, 0.75f, 0.5f, 0.35f, 0.25f };
+
+static PixelData upscale(const PixelData& src, int width, int height) {
+	PixelData out(width, height);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		int sy = y * src.height() / height;
+		for (int x = 0; x < width; x++) {
+			Color c = src.get(x * src.width() / width, sy);
+			out.set(x, y, c.r, c.g, c.b, c.a);
+		}
+	}
+	return out;
+}
+
+void NodeSystem::realTime(bool enabled, Degrade policy) {
+	if (enabled != m_realTime || policy != m_degrade) {
+		m_stats.level = 0;
+		m_overBudget = m_underBudget = m_frameSkip = 0;
+	}
+	m_realTime = enabled;
+	m_degrade = policy;
+}
+
+bool NodeSystem::frameDue() {
+	if (!capturing() || !hasFrame()) return false;
+
+	// Reduced frame rate: let the skipped frames go right away
+	if (m_realTime && m_degrade == Degrade::FrameRate && m_frameSkip++ < m_stats.level) {
+		for (auto&& [key, cam] : m_cameras) {
+			if (auto shared = cam.lock()) shared->acquire();
+		}
+		return false;
+	}
+	m_frameSkip = 0;
+	return true;
+}
+
+PixelData NodeSystem::processFrame(const PixelData& in) {
+	capturing();
+
+	// Frames that arrived since the last call were never processed
+	auto now = std::chrono::steady_clock::now();
+	uint64_t newFrames = 0;
+	bool live = false;
+	std::map<std::string, uint64_t> lastFrames;
+	for (auto&& [key, cam] : m_cameras) {
+		auto shared = cam.lock();
+		if (!shared) continue;
+
+		uint64_t count = shared->frameCount();
+		auto it = m_lastFrames.find(key);
+		uint64_t last = it != m_lastFrames.end() ? it->second : count;
+		if (count > last + 1) m_stats.dropped += count - last - 1;
+		lastFrames[key] = count;
+
+		// Replayed recordings wait for us, so there is no deadline to meet
+		if (!shared->lossless()) {
+			live = true;
+			newFrames = std::max(newFrames, count - last);
+		}
+	}
+	m_lastFrames = std::move(lastFrames);
+
+	// The interval frames actually arrive at, which can be longer than the format says
+	if (newFrames > 0 && m_lastFrameTime.time_since_epoch().count() != 0) {
+		float ms = std::chrono::duration<float, std::milli>(now - m_lastFrameTime).count() / float(newFrames);
+		m_stats.frameMs = m_stats.frameMs == 0.0f ? ms : m_stats.frameMs * 0.9f + ms * 0.1f;
+	}
+	m_lastFrameTime = now;
+	m_stats.processed++;
 
+	if (!m_realTime || !live) {
+		return process(in);
+	}
+
+	const int level = m_stats.level;
+	PixelData work = in;
+	if (m_degrade == Degrade::Resolution && level > 0) {
+		work = PixelData(
+			std::max(1, int(float(in.width()) * ResolutionScales[level])),
+			std::max(1, int(float(in.height()) * ResolutionScales[level]))
+		);
+	} else if (m_degrade == Degrade::SkipNodes && level > 0) {
+		// Only nodes with an input to pass through. Pointwise nodes are cheap LUT passes.
+		std::vector<std::pair<float, unsigned int>> costs;
+		for (auto&& [id, ms] : m_nodeMs) {
+			Node* node = get<Node>(id);
+			if (node == nullptr || node->type() == NodeType::Output || node->pointwise() != Node::Pointwise::None) continue;
+			if (node->paramCount() == 0 || !node->param(0).connected) continue;
+			costs.push_back({ ms, id });
+		}
+		std::sort(costs.rbegin(), costs.rend());
+		for (int i = 0; i < std::min(level, int(costs.size())); i++) {
+			m_skipped.push_back(costs[i].second);
+		}
+	}
+
+	PixelData out = process(work);
+	if (out.width() > 0 && (out.width() != in.width() || out.height() != in.height())) {
+		out = upscale(out, in.width(), in.height());
+	}
+
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - now).count();
+	adapt(ms, m_stats.frameMs);
+	m_skipped.clear();
 	return out;
 }
 
+void NodeSystem::adapt(float processMs, float frameMs) {
+	m_stats.processMs = m_stats.processMs == 0.0f ? processMs : m_stats.processMs * 0.8f + processMs * 0.2f;
+	if (frameMs <= 0.0f) return;
+
+	int& level = m_stats.level;
+	const float budget = frameMs * (m_degrade == Degrade::FrameRate ? float(level + 1) : 1.0f);
+
+	// What the previous level would cost, to avoid bouncing between levels
+	float restored = processMs;
+	if (level > 0) {
+		switch (m_degrade) {
+			case Degrade::Resolution: {
+				float r = ResolutionScales[level - 1] / ResolutionScales[level];
+				restored = processMs * r * r;
+			} break;
+			case Degrade::SkipNodes:
+				if (!m_skipped.empty()) restored = processMs + m_nodeMs[m_skipped.back()];
+				break;
+			case Degrade::FrameRate:
+				restored = processMs * float(level + 1) / float(level);
+				break;
+			default: break;
+		}
+	}
+
+	if (processMs > budget) {
+		m_underBudget = 0;
+		if (++m_overBudget >= 3 && level < MaxDegradeLevel && m_degrade != Degrade::None) {
+			level++;
+			m_overBudget = 0;
+		}
+	} else if (level > 0 && restored < budget * 0.8f) {
+		m_overBudget = 0;
+		if (++m_underBudget >= 30) {
+			level--;
+			m_underBudget = 0;
+		}
+	} else {
+		m_overBudget = m_underBudget = 0;
+	}
+}
+
+bool NodeSystem::fusible(Connection* conn, const std::map<unsigned int, int>& consumers) {
+	Node* src = get<Node>(conn->src);
+	Node* dest = get<Node>(conn->dest);
+	if (src == nullptr || dest == nullptr || conn->destParam != 0) return false;
+	if (src->pointwise() == Node::Pointwise::None || dest->pointwise() == Node::Pointwise::None) return false;
+
+	auto it = consumers.find(conn->src);
+	return it != consumers.end() && it->second == 1;
+}
+
+PixelData NodeSystem::processFused(const std::vector<Node*>& stages, const PixelData& in, bool byteInput) {
+	uint64_t key = byteInput ? 1 : 0;
+	for (Node* node : stages) key = hashCombine(key, node->settingsHash());
+
+	auto&& entry = m_luts[stages.back()->id()];
+	if (entry.first != key) {
+		entry.second.compile(stages, byteInput);
+		entry.first = key;
+	}
+	return entry.second.apply(stages, stages.front()->param(0).value, in.width(), in.height());
+}
+
 std::vector<unsigned int> NodeSystem::getConnectionsLastToFirst(unsigned int start) {
 	std::vector<unsigned int> conns;
 	for (int i = 0; i < get<Node>(start)->paramCount(); i++) {
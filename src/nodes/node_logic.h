@@ -13,19 +13,28 @@
 #include <chrono>
 #include <thread>
 #include <functional>
+#include <map>
+#include <atomic>
 
 #include "image.h"
+#include "color_lut.h"
+#include "luma_plane.h"
+#include "camera.h"
 
 #include "../json.hpp"
 using Json = nlohmann::json;
 
-extern "C" {
-	#include "../openpnp-capture/include/openpnp-capture.h"
-}
-
 constexpr unsigned int MaxNodes = 128;
 constexpr unsigned int MaxConnections = MaxNodes * 2;
 
+inline static float luma(Color col) {
+	return col.r * 0.299f + col.g * 0.587f + col.b * 0.114f;
+}
+
+inline static uint64_t hashCombine(uint64_t seed, uint64_t v) {
+	return seed ^ (v + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+}
+
 enum class NodeType {
 	None = 0,
 	Color,
@@ -46,16 +55,35 @@ enum class NodeType {
 	Invert,
 	Distort,
 	NormalMap,
-	Grayscale
+	Grayscale,
+	Equalize
 };
 
 class NodeSystem;
 class Node {
 	friend class NodeSystem;
 public:
+	// How a node's output pixel depends on the same pixel of its first input
+	enum class Pointwise {
+		None = 0,
+		PerChannel,	// each channel is a function of the same input channel
+		Luma		// a function of the input luma
+	};
+
 	struct Param {
 		PixelData value;
 		bool connected{ false };
+		uint64_t hash{ 0 };
+
+		// Set by NodeSystem before the per-pixel pass when 'needsLuma' is set. The
+		// plane is owned by NodeSystem and shared by all luma inputs of the source.
+		bool needsLuma{ false };
+		const LumaPlane* lumaPlane{ nullptr };
+
+		const LumaPlane& luma() const {
+			static const LumaPlane none{};
+			return lumaPlane ? *lumaPlane : none;
+		}
 	};
 
 	virtual void load(const Json& json) {}
@@ -68,9 +96,20 @@ public:
 
 	virtual Color process(const PixelData& in, float x, float y) { return def; }
 
+	// Identifies the current output of this node (type, settings and inputs).
+	// Nodes that depend on external state must mix it in.
+	virtual uint64_t hash();
+
+	// Type and settings only
+	uint64_t settingsHash();
+
+	// Pointwise nodes can be fused by NodeSystem into a single LUT pass
+	virtual Pointwise pointwise() { return Pointwise::None; }
+	virtual Color transform(Color col) { return col; }
+
 	unsigned int id() const { return m_id; }
 
-	void addParam(const std::string& name);
+	void addParam(const std::string& name, bool needsLuma = false);
 	Param& param(unsigned int id);
 	std::string paramName(unsigned int id);
 
@@ -107,6 +146,23 @@ public:
 		~Connection() = default;
 	};
 
+	// What processFrame gives up when the graph is slower than the camera
+	enum class Degrade {
+		None = 0,
+		Resolution,	// process at a lower resolution and scale the result up
+		SkipNodes,	// pass the input of the slowest nodes through
+		FrameRate	// process only every n-th camera frame
+	};
+
+	struct RealTimeStats {
+		float processMs{ 0.0f };	// average time spent in processFrame
+		float frameMs{ 0.0f };		// average camera frame interval
+		int level{ 0 };				// how far the policy is applied, 0 = full quality
+		uint64_t processed{ 0 }, dropped{ 0 };
+	};
+
+	static constexpr int MaxDegradeLevel = 4;
+
 	NodeSystem();
 	~NodeSystem();
 
@@ -128,17 +184,25 @@ public:
 		node->m_system = this;
 		m_nodes[spot] = std::unique_ptr<T>(node);
 
-		if (node->type() == NodeType::WebCam) {
-			startCapture();
-		}
-
 		m_lock.unlock();
 		return spot;
 	}
 
+	// Creates a node of a type that can be stored in a project, UINT32_MAX otherwise
+	unsigned int create(NodeType type);
+
 	void destroy(unsigned int id);
 	void clear();
 
+	// Replaces the graph with the nodes and connections of a project (.isp).
+	// 'loaded' gets the id and the json of every node created, for the editor.
+	void load(const Json& json, const std::function<void(unsigned int, const Json&)>& loaded = nullptr);
+	void save(Json& json, const std::function<void(unsigned int, Json&)>& saving = nullptr);
+
+	// Node type names as stored in projects, NodeType::None if unknown
+	static std::string typeName(NodeType type);
+	static NodeType typeFromName(const std::string& name);
+
 	template <class T>
 	T* get(unsigned int id) {
 		auto pos = std::find(m_usedNodes.begin(), m_usedNodes.end(), id);
@@ -161,16 +225,34 @@ public:
 
 	PixelData process(const PixelData& in);
 
-	PixelData& cameraFrame() { return m_lastCamFrame; }
-	bool capturing() const { return m_capturing; }
-	bool hasFrame() const { return m_hasNewFrame; }
-	void hasFrame(bool v) { m_hasNewFrame = v; }
+	// Opens a capture stream, or shares the one already capturing the
+	// same device and format. Returns null if no camera matches.
+	std::shared_ptr<CameraStream> camera(const CameraFormat& format);
+
+	// Any camera is running / delivered a frame since the last process()
+	bool capturing();
+	bool hasFrame();
+
+	// Live preview. Always processes the newest camera frame; frames that
+	// arrived in the mean time are dropped. In real-time mode the processing
+	// time is kept within the camera frame interval by degrading the result
+	// as the policy says, and restored once there is time to spare.
+	PixelData processFrame(const PixelData& in);
+
+	// A camera frame is waiting and due for processFrame
+	bool frameDue();
+
+	void realTime(bool enabled, Degrade policy);
+	bool realTime() const { return m_realTime; }
+	Degrade degrade() const { return m_degrade; }
+	const RealTimeStats& realTimeStats() const { return m_stats; }
 
 private:
 	std::vector<unsigned int> getConnectionsLastToFirst(unsigned int start);
 
-	void startCapture();
-	void stopCapture();
+	bool fusible(Connection* conn, const std::map<unsigned int, int>& consumers);
+	void adapt(float processMs, float frameMs);
+	PixelData processFused(const std::vector<Node*>& stages, const PixelData& in, bool byteInput);
 
 	std::array<std::unique_ptr<Connection>, MaxConnections> m_connections;
 	std::vector<unsigned int> m_usedConnections;
@@ -181,13 +263,28 @@ private:
 	std::mutex m_lock;
 	PixelData* m_imgIn;
 
-	// WebCam Capture
-	CapContext m_ctx{ nullptr };
-	CapFormatInfo m_capInfo;
-	int m_streamID;
-	PixelData m_lastCamFrame;
-	std::thread m_timerThread;
-	bool m_capturing{ false }, m_hasNewFrame{ false };
+	// Compiled pointwise runs, keyed by the id of the last node of the run
+	std::map<unsigned int, std::pair<uint64_t, ColorLUT>> m_luts;
+
+	// Luma of each node output read by a luma input, keyed by the source node id
+	// and rebuilt when the output hash changes
+	std::map<unsigned int, LumaPlane> m_lumaPlanes;
+
+	// Open cameras by CameraStream::key, owned by the WebCam nodes using them
+	std::map<std::string, std::weak_ptr<CameraStream>> m_cameras;
+	std::map<std::string, std::string> m_cameraKeys;	// key of a request -> key of its stream
+
+	// Real-time mode
+	bool m_realTime{ false };
+	Degrade m_degrade{ Degrade::Resolution };
+	RealTimeStats m_stats;
+	int m_overBudget{ 0 }, m_underBudget{ 0 }, m_frameSkip{ 0 };
+	std::map<std::string, uint64_t> m_lastFrames;	// frame count of each camera at the last processFrame
+	std::chrono::steady_clock::time_point m_lastFrameTime;
+
+	// Average time spent in each node, and the nodes processFrame passes through
+	std::map<unsigned int, float> m_nodeMs;
+	std::vector<unsigned int> m_skipped;
 };
 
 #endif // NODE_H
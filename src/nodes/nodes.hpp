@@ -3,16 +3,20 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <fstream>
+#include <sstream>
 
 #include "node_logic.h"
+#include "fft.h"
+#include "histogram.h"
+#include "warp_map.h"
+#include "image_export.h"
+#include "image_cache.h"
 #include "filesystem.hpp"
 
 namespace fs = ghc::filesystem;
 
-inline static float luma(Color col) {
-	return col.r * 0.299f + col.g * 0.587f + col.b * 0.114f;
-}
-
 class ColorNode : public Node {
 public:
 	inline virtual Color process(const PixelData& in, float x, float y) override {
@@ -47,17 +51,61 @@ public:
 
 	inline virtual NodeType type() override { return NodeType::Image; }
 
+	// The file name alone doesn't tell images apart: the file may have
+	// changed since, and callers replace 'image' before renaming the node
+	inline virtual uint64_t hash() override {
+		return hashCombine(Node::hash(), m_generation);
+	}
+
 	virtual void load(const Json& json) override {
 		fileName = json["fileName"];
-		image = PixelData(fs::absolute(fs::path(fileName)).string());
+		bool exact = false;
+		PixelData img = open(fs::absolute(fs::path(fileName)).string(), true, &exact);
+		setImage(img, exact);
 	}
 
 	virtual void save(Json& json) override {
 		json["fileName"] = fileName;
 	}
 
+	// PFM exports are read back as they were written, in full float precision.
+	// Other files are decoded once and then mapped from the image cache, unless
+	// they are only read once anyway ('cached' = false).
+	// 'byteExact' is set to whether the pixels only hold 8 bit values.
+	static PixelData open(const std::string& path, bool cached = true, bool* byteExact = nullptr) {
+		std::string ext = fs::path(path).extension().string();
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+		PixelData img{};
+		if (ext == ".pfm" && loadPFM(path, img)) {
+			if (byteExact) *byteExact = false;
+			return img;
+		}
+		if (!cached) {
+			img = PixelData(path);
+			if (byteExact) *byteExact = ImageCache::byteExact(img);
+			return img;
+		}
+		return ImageCache::shared().load(path, [](const std::string& p) { return PixelData(p); }, byteExact);
+	}
+
+	// Every image set here gets a hash of its own, see hash()
+	void setImage(const PixelData& img, bool exact) {
+		static std::atomic<uint64_t> generations{ 0 };
+		image = img;
+		byteExact = exact;
+		m_generation = ++generations;
+	}
+
 	PixelData image{};
 	std::string fileName{};
+
+	// 'image' only holds k / 255 values (8 bit files), which lets pointwise
+	// runs fed by this node use the exact 8 bit tables
+	bool byteExact{ false };
+
+private:
+	uint64_t m_generation{ 0 };
 };
 
 class MultiplyNode : public Node {
@@ -65,7 +113,7 @@ public:
 	inline MultiplyNode() {
 		addParam("A");
 		addParam("B");
-		addParam("Fat.");
+		addParam("Fat.", true);
 	}
 
 	inline virtual Color process(const PixelData& in, float x, float y) override {
@@ -82,7 +130,7 @@ public:
 
 		Color na = pa.get(xa, ya);
 		Color nb = pb.get(xb, yb);
-		float fc = param(2).connected ? luma(fac.get(xf, yf)) : factor;
+		float fc = param(2).connected ? param(2).luma().get(xf, yf) : factor;
 		return Color{ na.r * nb.r * fc, na.g * nb.g * fc, na.b * nb.b * fc, na.a };
 	}
 
@@ -104,7 +152,7 @@ public:
 	inline AddNode() {
 		addParam("A");
 		addParam("B");
-		addParam("Fat.");
+		addParam("Fat.", true);
 	}
 
 	inline virtual Color process(const PixelData& in, float x, float y) override {
@@ -121,7 +169,7 @@ public:
 
 		Color na = pa.get(xa, ya);
 		Color nb = pb.get(xb, yb);
-		float fc = param(2).connected ? luma(fac.get(xf, yf)) : factor;
+		float fc = param(2).connected ? param(2).luma().get(xf, yf) : factor;
 		return Color{ na.r + nb.r * fc, na.g + nb.g * fc, na.b + nb.b * fc, na.a };
 	}
 
@@ -143,7 +191,7 @@ public:
 	inline MixNode() {
 		addParam("A");
 		addParam("B");
-		addParam("Fat.");
+		addParam("Fat.", true);
 	}
 
 	inline float lerp(float a, float b, float t) {
@@ -164,7 +212,7 @@ public:
 
 		Color na = pa.get(xa, ya);
 		Color nb = pb.get(xb, yb);
-		float fc = param(2).connected ? luma(fac.get(xf, yf)) : factor;
+		float fc = param(2).connected ? param(2).luma().get(xf, yf) : factor;
 		return Color{
 			lerp(na.r, nb.r, fc),
 			lerp(na.g, nb.g, fc),
@@ -189,15 +237,16 @@ public:
 class ThresholdNode : public Node {
 public:
 	inline ThresholdNode() {
-		addParam("A");
+		addParam("A", true);
 	}
 
 	inline virtual Color process(const PixelData& in, float x, float y) override {
 		auto&& pa = param(0).value;
+		auto&& lp = param(0).luma();
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 
-		float lm = luma(pa.get(ix, iy));
+		float lm = lp.get(ix, iy);
 		if (!locallyAdaptive) {
 			float g = lm >= threshold ? 1.0f : 0.0f;
 			return Color{ g, g, g, 1.0f };
@@ -207,8 +256,7 @@ public:
 			for (int ky = -m; ky <= m; ky++) {
 				for (int kx = -m; kx <= m; kx++) {
 					if (kx == 0 && ky == 0) continue;
-					Color col = in.get(kx + ix, ky + iy);
-					sum += luma(col);
+					sum += lp.get(kx + ix, ky + iy);
 				}
 			}
 			sum /= ((regionSize * regionSize) + 1);
@@ -236,28 +284,31 @@ public:
 class DilateNode : public Node {
 public:
 	inline DilateNode() {
-		addParam("A");
+		addParam("A", true);
 	}
 
 	inline virtual Color process(const PixelData& in, float x, float y) override {
 		auto&& pa = param(0).value;
+		auto&& lp = param(0).luma();
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 
-		Color cmax = { 0.0f, 0.0f, 0.0f, 1.0f };
 		float maxLuma = 0.0f;
+		int mx = 0, my = 0;
+		bool found = false;
 		const int m = int(size) / 2;
 		for (int i = -m; i <= m; i++) {
 			for (int j = -m; j <= m; j++) {
-				Color tmp = pa.get(ix + i, iy + j);
-				float l = luma(tmp);
+				float l = lp.get(ix + i, iy + j);
 				if (l > maxLuma) {
-					cmax = tmp;
+					mx = ix + i;
+					my = iy + j;
 					maxLuma = l;
+					found = true;
 				}
 			}
 		}
-		return cmax;
+		return found ? pa.get(mx, my) : Color{ 0.0f, 0.0f, 0.0f, 1.0f };
 	}
 
 	inline virtual NodeType type() override { return NodeType::Dilate; }
@@ -276,29 +327,32 @@ public:
 class ErodeNode : public Node {
 public:
 	inline ErodeNode() {
-		addParam("A");
+		addParam("A", true);
 	}
 
 	inline virtual Color process(const PixelData& in, float x, float y) override {
 		auto&& pa = param(0).value;
+		auto&& lp = param(0).luma();
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 
-		Color cmin = { 1.0f, 1.0f, 1.0f, 1.0f };
 		float minLuma = 1.0f;
+		int mx = 0, my = 0;
+		bool found = false;
 		const int m = int(size) / 2;
 
 		for (int i = -m; i <= m; i++) {
 			for (int j = -m; j <= m; j++) {
-				Color tmp = pa.get(ix + i, iy + j);
-				float l = luma(tmp);
+				float l = lp.get(ix + i, iy + j);
 				if (l < minLuma) {
-					cmin = tmp;
+					mx = ix + i;
+					my = iy + j;
 					minLuma = l;
+					found = true;
 				}
 			}
 		}
-		return cmin;
+		return found ? pa.get(mx, my) : Color{ 1.0f, 1.0f, 1.0f, 1.0f };
 	}
 
 	inline virtual NodeType type() override { return NodeType::Erode; }
@@ -333,26 +387,70 @@ public:
 		EdgeGauss,
 		EdgeLaplace,
 		Emboss,
-		EdgeEmboss
+		EdgeEmboss,
+		Custom
 	};
 
 	inline ConvoluteNode() {
 		addParam("A");
 	}
 
+	inline int kernelSize() const {
+		return filter == Filter::Custom ? customSize : 3;
+	}
+
+	inline const float* kernelData() const {
+		return filter == Filter::Custom ? customKernel.data() : KERNEL[int(filter) - 1];
+	}
+
+	inline bool hasCustomKernel() const {
+		return customSize % 2 == 1 && customKernel.size() == size_t(customSize * customSize);
+	}
+
+	inline bool validKernel() const {
+		return filter != Filter::Custom || hasCustomKernel();
+	}
+
+	// Reads a square kernel of odd size from a text file, its weights row by
+	// row, separated by spaces, commas or new lines
+	inline bool loadKernel(const std::string& path) {
+		std::ifstream fp(path);
+		if (!fp) return false;
+
+		std::string text((std::istreambuf_iterator<char>(fp)), std::istreambuf_iterator<char>());
+		std::replace(text.begin(), text.end(), ',', ' ');
+		std::istringstream values(text);
+
+		std::vector<float> kernel;
+		float v;
+		while (values >> v) kernel.push_back(v);
+		if (!values.eof()) return false;
+
+		const int size = int(std::lround(std::sqrt(double(kernel.size()))));
+		if (size % 2 == 0 || size_t(size * size) != kernel.size()) return false;
+
+		customKernel = kernel;
+		customSize = size;
+		filter = Filter::Custom;
+		return true;
+	}
+
 	inline virtual Color process(const PixelData& in, float x, float y) override {
 		auto&& pa = param(0).value;
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 
-		const int w = 3;
+		if (!validKernel()) return pa.get(ix, iy);
+
+		const int w = kernelSize();
 		const int mean = w / 2;
+		const float* kernel = kernelData();
 
 		Color sum = { 0.0f, 0.0f, 0.0f, 1.0f };
 		for (int n = -mean; n <= mean; n++) {
 			for (int m = -mean; m <= mean; m++) {
 				Color col = pa.get(ix + n, iy + m);
-				float kv = KERNEL[int(filter) - 1][(n + mean) + (m + mean) * w];
+				float kv = kernel[(n + mean) + (m + mean) * w];
 				sum.r += col.r * kv;
 				sum.g += col.g * kv;
 				sum.b += col.b * kv;
@@ -362,64 +460,111 @@ public:
 		return sum;
 	}
 
+	inline virtual PixelData process(const PixelData& in) override {
+		auto&& pa = param(0).value;
+		if (!validKernel() || pa.width() == 0 || pa.height() == 0) return Node::process(in);
+
+		const int fftSize = FFTConvolver::plan(pa.width(), pa.height(), kernelSize());
+		if (fftSize == 0) return Node::process(in);
+
+		reset();
+
+		// Large kernels: convolve each channel once at the source resolution
+		const int sw = pa.width(), sh = pa.height();
+		std::vector<float> planes[3];
+		for (auto&& p : planes) p.resize(sw * sh);
+
+		#pragma omp parallel for schedule(static)
+		for (int k = 0; k < sw * sh; k++) {
+			Color col = pa.get(k % sw, k / sw);
+			planes[0][k] = col.r;
+			planes[1][k] = col.g;
+			planes[2][k] = col.b;
+		}
+
+		const int w = kernelSize();
+		m_fft.kernel(std::vector<float>(kernelData(), kernelData() + w * w), w);
+		for (auto&& p : planes) m_fft.convolve(p.data(), p.data(), sw, sh, fftSize);
+
+		const int mean = w / 2;
+		PixelData out(in.width(), in.height());
+		#pragma omp parallel for schedule(static)
+		for (int k = 0; k < in.width() * in.height(); k++) {
+			int x = k % in.width();
+			int y = k / in.width();
+			int ix = int((sw + 0.5f) * (float(x) / in.width()));
+			int iy = int((sh + 0.5f) * (float(y) / in.height()));
+			int j = std::clamp(ix, 0, sw - 1) + std::clamp(iy, 0, sh - 1) * sw;
+			float a = pa.get(ix + mean, iy + mean).a;
+			out.set(x, y, planes[0][j], planes[1][j], planes[2][j], a);
+		}
+		return out;
+	}
+
 	inline virtual NodeType type() override { return NodeType::Convolute; }
 
 	virtual void load(const Json& json) override {
 		filter = Filter(json.value("filter", 1));
+		customSize = json.value("kernelSize", 3);
+		customKernel = json.value("kernel", std::vector<float>());
 	}
 
 	virtual void save(Json& json) override {
 		json["filter"] = int(filter);
+		if (filter == Filter::Custom) {
+			json["kernelSize"] = customSize;
+			json["kernel"] = customKernel;
+		}
 	}
 
 	Filter filter{ Filter::GaussianBlur };
 
+	// Row-major customSize x customSize weights, used by Filter::Custom
+	std::vector<float> customKernel;
+	int customSize{ 3 };
+
+private:
+	FFTConvolver m_fft;
 };
 
 static std::vector<float> histogram(const PixelData& pa) {
-	int res[256] = { 0 };
-	for (size_t hx = 0; hx < pa.width(); hx++) {
-		for (size_t hy = 0; hy < pa.height(); hy++) {
-			uint8_t g = uint8_t(luma(pa.get(hx, hy)) * 255.0f);
-			res[g]++;
-		}
-	}
-
-	std::vector<float> ret;
-	ret.resize(256);
-	for (size_t i = 0; i < ret.size(); i++) ret[i] = float(res[i]) / 255.0f;
-	return ret;
+	Histogram hist;
+	hist.compute(pa);
+	return hist.normalized(Histogram::Luma);
 }
 
 class MedianNode : public Node {
 public:
 	inline MedianNode() {
-		addParam("A");
+		addParam("A", true);
 	}
 
 	inline virtual Color process(const PixelData& in, float x, float y) override {
 		auto&& pa = param(0).value;
+		auto&& lp = param(0).luma();
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 
-		std::vector<Color> v;
+		// (luma, window index) pairs, the colour is only fetched for the median
+		std::vector<std::pair<float, int>> v;
 		const int m = int(size) / 2;
+		const int w = m * 2 + 1;
 
-		v.reserve(int(size) * int(size));
+		v.reserve(w * w);
 
 		for (int ky = -m; ky <= m; ky++) {
 			for (int kx = -m; kx <= m; kx++) {
-				int ox = kx + ix;
-				int oy = ky + iy;
-				v.push_back(pa.get(ox, oy));
+				v.push_back({ lp.get(kx + ix, ky + iy), (kx + m) + (ky + m) * w });
 			}
 		}
 
-		std::sort(v.begin(), v.end(), [](const Color& a, const Color& b) {
-			return luma(a) > luma(b);
+		auto mid = v.begin() + v.size() / 2;
+		std::nth_element(v.begin(), mid, v.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+			return a.first > b.first;
 		});
 
-		return v[v.size() / 2];
+		int k = mid->second;
+		return pa.get(ix + (k % w) - m, iy + (k / w) - m);
 	}
 
 	inline virtual NodeType type() override { return NodeType::Median; }
@@ -446,7 +591,12 @@ public:
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 
-		Color na = pa.get(ix, iy);
+		return transform(pa.get(ix, iy));
+	}
+
+	inline virtual Pointwise pointwise() override { return Pointwise::PerChannel; }
+
+	inline virtual Color transform(Color na) override {
 		return {
 			std::clamp(na.r * contrast + brightness, 0.0f, 1.0f),
 			std::clamp(na.g * contrast + brightness, 0.0f, 1.0f),
@@ -472,14 +622,75 @@ public:
 
 class WebCamNode : public Node {
 public:
+	inline virtual PixelData process(const PixelData& in) override {
+		open();
+		return Node::process(in);
+	}
+
 	inline virtual Color process(const PixelData& in, float x, float y) override {
-		auto&& pa = m_system->cameraFrame();
+		if (!m_stream) return def;
+		if (m_stream->gray()) {
+			auto&& lp = m_stream->luma();
+			float l = lp.get(int((lp.width()+0.5f) * x), int((lp.height()+0.5f) * y));
+			return Color{ l, l, l, 1.0f };
+		}
+		auto&& pa = m_stream->frame();
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 		return pa.get(ix, iy);
 	}
 
 	inline virtual NodeType type() override { return NodeType::WebCam; }
+
+	inline virtual uint64_t hash() override {
+		return hashCombine(Node::hash(), m_stream ? m_stream->frameNumber() : 0);
+	}
+
+	virtual void load(const Json& json) override {
+		format.device = json.value("device", "");
+		format.width = json.value("width", 320);
+		format.height = json.value("height", 240);
+		format.fourcc = fourccValue(json.value("fourcc", ""));
+		format.fps = json.value("fps", 0);
+		format.cropX = json.value("cropX", 0);
+		format.cropY = json.value("cropY", 0);
+		format.cropWidth = json.value("cropWidth", 0);
+		format.cropHeight = json.value("cropHeight", 0);
+		format.scale = json.value("scale", 1.0f);
+		format.gray = json.value("gray", false);
+	}
+
+	virtual void save(Json& json) override {
+		json["device"] = format.device;
+		json["width"] = format.width;
+		json["height"] = format.height;
+		json["fourcc"] = format.fourcc ? fourccString(format.fourcc) : "";
+		json["fps"] = format.fps;
+		json["cropX"] = format.cropX;
+		json["cropY"] = format.cropY;
+		json["cropWidth"] = format.cropWidth;
+		json["cropHeight"] = format.cropHeight;
+		json["scale"] = format.scale;
+		json["gray"] = format.gray;
+	}
+
+	CameraStream* stream() { return m_stream.get(); }
+
+	CameraFormat format{};
+
+private:
+	// (Re)opens the camera when the settings changed. Failures are not
+	// retried until they change again, since probing devices is slow.
+	inline void open() {
+		if (m_opened && m_openedFormat == format) return;
+		m_opened = true;
+		m_openedFormat = format;
+		m_stream = m_system->camera(format);
+	}
+
+	std::shared_ptr<CameraStream> m_stream;
+	CameraFormat m_openedFormat{};
+	bool m_opened{ false };
 };
 
 class MirrorNode : public Node {
@@ -493,18 +704,32 @@ public:
 		return m2 < 1.0 ? m2 : 2 - m2;
 	}
 
-	inline virtual Color process(const PixelData& in, float x, float y) override {
+	inline std::tuple<float, float> mirror(float x, float y) {
 		float mx = cyclef(x * 2.0f) * 0.5f;
 		float my = y;
 		if (vertical) {
 			my = cyclef(y * 2.0f) * 0.5f;
 		}
+		return { mx, my };
+	}
+
+	inline virtual Color process(const PixelData& in, float x, float y) override {
+		auto uv = mirror(x, y);
 		auto&& pa = param(0).value;
-		int ix = int((pa.width()+0.5f) * mx);
-		int iy = int((pa.height()+0.5f) * my);
+		int ix = int((pa.width()+0.5f) * std::get<0>(uv));
+		int iy = int((pa.height()+0.5f) * std::get<1>(uv));
 		return pa.get(ix, iy);
 	}
 
+	inline virtual PixelData process(const PixelData& in) override {
+		auto&& pa = param(0).value;
+		auto mapping = [this](float x, float y) { return mirror(x, y); };
+		if (!m_warp.update(settingsHash(), in.width(), in.height(), pa.width(), pa.height(), mapping)) {
+			return Node::process(in);
+		}
+		return m_warp.gather(pa);
+	}
+
 	inline virtual NodeType type() override { return NodeType::Mirror; }
 
 	virtual void load(const Json& json) override {
@@ -516,6 +741,9 @@ public:
 	}
 
 	bool vertical{ false };
+
+private:
+	WarpMap m_warp;
 };
 
 class FishEyeNode : public Node {
@@ -533,25 +761,35 @@ public:
 		return { 0.5f * (px + 1.0f), 0.5f * (py + 1.0f) };
 	}
 
-	inline virtual Color process(const PixelData& in, float x, float y) override {
-		auto&& pa = param(0).value;
-
+	inline std::tuple<float, float> lens(float x, float y) {
 		float fx = x * 2.0f - 1.0f;
 		float fy = y * 2.0f - 1.0f;
 
-		auto uv = std::make_tuple(0.0f, 0.0f);
 		float d = std::sqrt(fx * fx + fy * fy);
 		if (d < 1.0f) {
-			uv = distort(fx, fy);
-		} else {
-			uv = std::make_tuple(x, y);
+			return distort(fx, fy);
 		}
+		return { x, y };
+	}
 
+	inline virtual Color process(const PixelData& in, float x, float y) override {
+		auto&& pa = param(0).value;
+		auto uv = lens(x, y);
 		int ix = int((pa.width()+0.5f) * std::get<0>(uv));
 		int iy = int((pa.height()+0.5f) * std::get<1>(uv));
 		return pa.get(ix, iy);
 	}
 
+	// The mapping only depends on 'quant' and the sizes, so it's cached
+	inline virtual PixelData process(const PixelData& in) override {
+		auto&& pa = param(0).value;
+		auto mapping = [this](float x, float y) { return lens(x, y); };
+		if (!m_warp.update(settingsHash(), in.width(), in.height(), pa.width(), pa.height(), mapping)) {
+			return Node::process(in);
+		}
+		return m_warp.gather(pa);
+	}
+
 	inline virtual NodeType type() override { return NodeType::FishEye; }
 
 	virtual void load(const Json& json) override {
@@ -564,6 +802,8 @@ public:
 
 	float quant{ 1.0f };
 
+private:
+	WarpMap m_warp;
 };
 
 class InvertNode : public Node {
@@ -576,7 +816,12 @@ public:
 		auto&& pa = param(0).value;
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
-		Color col = pa.get(ix, iy);
+		return transform(pa.get(ix, iy));
+	}
+
+	inline virtual Pointwise pointwise() override { return Pointwise::PerChannel; }
+
+	inline virtual Color transform(Color col) override {
 		col.r = 1.0f - col.r;
 		col.g = 1.0f - col.g;
 		col.b = 1.0f - col.b;
@@ -624,7 +869,7 @@ class NormalMapNode : public Node {
 	using vec3 = std::array<float, 3>;
 public:
 	inline NormalMapNode() {
-		addParam("A");
+		addParam("A", true);
 	}
 
 	inline float vlen(const vec3& v) {
@@ -649,10 +894,11 @@ public:
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
 
-		float s01 = luma(pa.get(ix - 1, iy));
-		float s21 = luma(pa.get(ix + 1, iy));
-		float s10 = luma(pa.get(ix, iy - 1));
-		float s12 = luma(pa.get(ix, iy + 1));
+		auto&& lp = param(0).luma();
+		float s01 = lp.get(ix - 1, iy);
+		float s21 = lp.get(ix + 1, iy);
+		float s10 = lp.get(ix, iy - 1);
+		float s12 = lp.get(ix, iy + 1);
 
 		vec3 va = vnorm({ size, 0.0, s21 - s01 });
 		vec3 vb = vnorm({ 0.0, size, s12 - s10 });
@@ -682,18 +928,150 @@ public:
 class GrayscaleNode : public Node {
 public:
 	inline GrayscaleNode() {
-		addParam("A");
+		addParam("A", true);
 	}
 
 	inline virtual Color process(const PixelData& in, float x, float y) override {
 		auto&& pa = param(0).value;
 		int ix = int((pa.width()+0.5f) * x);
 		int iy = int((pa.height()+0.5f) * y);
-		float lm = luma(pa.get(ix, iy));
+		float lm = param(0).luma().get(ix, iy);
+		return { lm, lm, lm, 1.0f };
+	}
+
+	inline virtual Pointwise pointwise() override { return Pointwise::Luma; }
+
+	inline virtual Color transform(Color col) override {
+		float lm = luma(col);
 		return { lm, lm, lm, 1.0f };
 	}
 
 	inline virtual NodeType type() override { return NodeType::Grayscale; }
 };
 
+class EqualizeNode : public Node {
+public:
+	enum Mode {
+		Equalize = 0,
+		AutoLevels
+	};
+
+	inline EqualizeNode() {
+		addParam("A");
+	}
+
+	// Called once before every frame; only rebins when the input changed
+	inline virtual void reset() override {
+		auto&& pa = param(0);
+		if (!m_valid || pa.hash != m_inputHash || perChannel != m_perChannel) {
+			m_histogram.compute(pa.value, perChannel);
+			m_inputHash = pa.hash;
+			m_perChannel = perChannel;
+			m_valid = true;
+		}
+
+		const int channels = perChannel ? int(Histogram::ChannelCount) : 1;
+		for (int c = 0; c < channels; c++) {
+			buildLUT(Histogram::Channel(c));
+		}
+	}
+
+	inline virtual Color process(const PixelData& in, float x, float y) override {
+		auto&& pa = param(0).value;
+		int ix = int((pa.width()+0.5f) * x);
+		int iy = int((pa.height()+0.5f) * y);
+		Color col = pa.get(ix, iy);
+
+		if (perChannel) {
+			return {
+				lookup(Histogram::Red, col.r),
+				lookup(Histogram::Green, col.g),
+				lookup(Histogram::Blue, col.b),
+				col.a
+			};
+		}
+
+		if (mode == Mode::AutoLevels) {
+			return {
+				lookup(Histogram::Luma, col.r),
+				lookup(Histogram::Luma, col.g),
+				lookup(Histogram::Luma, col.b),
+				col.a
+			};
+		}
+
+		// Equalize the luma and keep the chroma by scaling the channels
+		float lm = luma(col);
+		float nl = lookup(Histogram::Luma, lm);
+		if (lm <= 1e-4f) return { nl, nl, nl, col.a };
+		float s = nl / lm;
+		return {
+			std::clamp(col.r * s, 0.0f, 1.0f),
+			std::clamp(col.g * s, 0.0f, 1.0f),
+			std::clamp(col.b * s, 0.0f, 1.0f),
+			col.a
+		};
+	}
+
+	inline virtual NodeType type() override { return NodeType::Equalize; }
+
+	virtual void load(const Json& json) override {
+		mode = Mode(json.value("mode", 0));
+		perChannel = json.value("perChannel", false);
+		clip = json.value("clip", 0.005f);
+	}
+
+	virtual void save(Json& json) override {
+		json["mode"] = int(mode);
+		json["perChannel"] = perChannel;
+		json["clip"] = clip;
+	}
+
+	const Histogram& histogram() const { return m_histogram; }
+
+	Mode mode{ Mode::Equalize };
+	bool perChannel{ false };
+	float clip{ 0.005f };
+
+private:
+	using LUT = std::array<float, Histogram::Bins>;
+
+	inline float lookup(Histogram::Channel ch, float v) const {
+		const LUT& lut = m_luts[ch];
+		float f = std::clamp(v, 0.0f, 1.0f) * float(Histogram::Bins - 1);
+		int i = std::min(int(f), Histogram::Bins - 2);
+		float t = f - float(i);
+		return lut[i] + (lut[i + 1] - lut[i]) * t;
+	}
+
+	inline void buildLUT(Histogram::Channel ch) {
+		LUT& lut = m_luts[ch];
+		const float last = float(Histogram::Bins - 1);
+		for (int i = 0; i < Histogram::Bins; i++) lut[i] = float(i) / last;
+		if (m_histogram.total() == 0) return;
+
+		if (mode == Mode::Equalize) {
+			auto cdf = m_histogram.cdf(ch);
+			float cmin = 0.0f;
+			for (float c : cdf) if (c > 0.0f) { cmin = c; break; }
+			if (cmin >= 1.0f) return;
+			for (int i = 0; i < Histogram::Bins; i++) {
+				lut[i] = std::clamp((cdf[i] - cmin) / (1.0f - cmin), 0.0f, 1.0f);
+			}
+		} else {
+			float lo = float(m_histogram.percentile(ch, clip));
+			float hi = float(m_histogram.percentile(ch, 1.0f - clip));
+			if (hi <= lo) return;
+			for (int i = 0; i < Histogram::Bins; i++) {
+				lut[i] = std::clamp((float(i) - lo) / (hi - lo), 0.0f, 1.0f);
+			}
+		}
+	}
+
+	Histogram m_histogram;
+	std::array<LUT, Histogram::ChannelCount> m_luts;
+	uint64_t m_inputHash{ 0 };
+	bool m_perChannel{ false }, m_valid{ false };
+};
+
 #endif // NODES_HPP
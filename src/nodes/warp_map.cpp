@@ -0,0 +1,50 @@
+#include "warp_map.h"
+
+#include <limits>
+#include <algorithm>
+
+bool WarpMap::update(uint64_t key, int width, int height, int srcWidth, int srcHeight, const Mapping& mapping) {
+	if (m_valid && key == m_key &&
+		width == m_width && height == m_height &&
+		srcWidth == m_srcWidth && srcHeight == m_srcHeight)
+	{
+		return true;
+	}
+
+	// Coordinates are packed as 16-bit pairs
+	const int limit = std::numeric_limits<int16_t>::max() / 2;
+	if (srcWidth > limit || srcHeight > limit) {
+		m_valid = false;
+		return false;
+	}
+
+	m_coords.resize(width * height);
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < width * height; k++) {
+		int x = k % width;
+		int y = k / width;
+		auto uv = mapping(float(x) / width, float(y) / height);
+		int ix = int((srcWidth+0.5f) * std::get<0>(uv));
+		int iy = int((srcHeight+0.5f) * std::get<1>(uv));
+		m_coords[k] = { int16_t(std::clamp(ix, -limit, limit)), int16_t(std::clamp(iy, -limit, limit)) };
+	}
+
+	m_key = key;
+	m_width = width;
+	m_height = height;
+	m_srcWidth = srcWidth;
+	m_srcHeight = srcHeight;
+	m_valid = true;
+	return true;
+}
+
+PixelData WarpMap::gather(const PixelData& src) const {
+	PixelData out(m_width, m_height);
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < m_width * m_height; k++) {
+		const Coord c = m_coords[k];
+		Color col = src.get(c.x, c.y);
+		out.set(k % m_width, k / m_width, col.r, col.g, col.b, col.a);
+	}
+	return out;
+}
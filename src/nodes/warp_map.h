@@ -0,0 +1,35 @@
+#ifndef WARP_MAP_H
+#define WARP_MAP_H
+
+#include <vector>
+#include <tuple>
+#include <functional>
+#include <cstdint>
+
+#include "image.h"
+
+// Precomputed source coordinates for geometric nodes.
+// The map is rebuilt only when the key (node settings) or a resolution changes,
+// after that every frame is a single gather pass.
+class WarpMap {
+public:
+	// Maps normalized output coordinates to normalized source coordinates
+	using Mapping = std::function<std::tuple<float, float>(float, float)>;
+
+	// Returns false if the map can't represent the source size
+	bool update(uint64_t key, int width, int height, int srcWidth, int srcHeight, const Mapping& mapping);
+
+	PixelData gather(const PixelData& src) const;
+
+	void invalidate() { m_valid = false; }
+
+private:
+	struct Coord { int16_t x, y; };
+
+	std::vector<Coord> m_coords;
+	uint64_t m_key{ 0 };
+	int m_width{ 0 }, m_height{ 0 }, m_srcWidth{ 0 }, m_srcHeight{ 0 };
+	bool m_valid{ false };
+};
+
+#endif // WARP_MAP_H
@@ -32,6 +32,7 @@ R"(
 					<item>Distort</item>
 					<item>Normal Map</item>
 					<item>Grayscale</item>
+					<item>Equalize</item>
 				</list>
 				<panel layout="flow" height="20" background="false" padding="0" param="bottom">
 					<button name="btnAdd" text="+" width="20" />
@@ -45,10 +46,11 @@ R"(
 
 					</panel>
 				</panel>
-				<panel param="bottom" height="120" layout="stack">
+				<panel name="pnlImage" param="bottom" height="140" layout="stack">
 					<label text="Image" />
 					<spinner name="spnWidth" suffix=" Width" min="1" max="1024" value="320" step="1" draggable="false" height="20" />
 					<spinner name="spnHeight" suffix=" Height" min="1" max="1024" value="240" step="1" draggable="false" height="20" />
+					<spinner name="spnCompression" suffix=" PNG Compression" min="0" max="9" value="6" step="1" draggable="false" height="20" />
 				</panel>
 			</panel>
 		</panel>